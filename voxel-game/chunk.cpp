@@ -1,19 +1,36 @@
 #include <future>
 #include <chrono>
 #include "chunk.h"
+#include "chunkio.h"
+#include "connectivity.h"
+#include "edit.h"
+#include "jobs.h"
+#include "light.h"
+#include "lod.h"
+#include "occlusion.h"
+#include "residency.h"
+#include "viewer.h"
+#include "worldgen.h"
 
 std::unordered_map<ChunkKey, PerChunkState> perChunkState; //chunk blocks
 std::unordered_map<ChunkKey, BufferAndPanelCount> chunkGLBuffers; //opengl buffer objects
 std::unordered_set<ChunkKey> chunksRequiringBufferUpdates; //chunks selected for drawing
 std::unordered_set<ChunkKey> chunksThatShouldBeDrawn; //ready-to-draw chunks that should be drawn
 std::unordered_set<ChunkKey> notUpdated; //chunks that need to have their draw meshes updated
+uint64_t drawableChunksVersion = 1;
 
 struct KeyAndChunkFuture {
     ChunkKey key;
-    std::future<std::vector<ChunkVertexFormat>> chunkFuture;
+    std::future<ChunkMesh> chunkFuture;
 };
 std::list <KeyAndChunkFuture> pendingChunkPolygonizations;
 vec3 viewerPosition = { 0,0,0 };
+//stands in for unallocated sky chunks when meshing their neighbors
+PerChunkState emptyChunk = [] {
+    PerChunkState chunk = {};
+    chunk.skyLight.fill(0xFF); //MAX_LIGHT in both nibbles
+    return chunk;
+}();
 
 float chunkCloseness(ChunkKey chunkKey) {
     vec3 chunkKeyPos = {
@@ -71,34 +88,61 @@ const std::array<glm::vec3, 6> panelVertex4 = {
     { 1.f, 1.f, 1.f }
 };
 
-std::vector<ChunkVertexFormat> getChunkGLBuffer(PerChunkState chunk, std::array<bool, 6> doAdjacentsExist, std::array<PerChunkState*, 6> adjacents, TemporaryChunksSnapshot* tcs) {
-    //PerChunkState chunk = perChunkState[chunkKey];
-    std::vector<ChunkVertexFormat> chunkGLBufferData;
-    chunkGLBufferData.reserve(STARTING_CHUNK_ATTRIB_BUFFER_SIZE);
+bool isSolid(const OccupancyRows& occupancy, ivec3 coords) {
+    return (occupancy[(coords.y + 1) + PADDED_SIDE * (coords.z + 1)] >> (coords.x + 1)) & 1;
+}
+
+//each corner is darkened by the blocks in front of the face that touch it: 0 to 3 levels, and 3 between two sides.
+template <typename OutputIterator>
+void writePanel(OutputIterator& out, const OccupancyRows& occupancy, glm::vec3 baseVertexPos, uint8_t orientation, Block block, uint8_t light) {
+    const std::array<glm::vec3, 4> corners = { panelVertex1[orientation], panelVertex2[orientation], panelVertex3[orientation], panelVertex4[orientation] };
+    ivec3 front = ivec3{ baseVertexPos } + ADJACENT_CHUNK_OFFSETS[orientation];
+    int uAxis = (orientation / 2 + 1) % 3;
+    int vAxis = (orientation / 2 + 2) % 3;
+    std::array<uint8_t, 4> occlusion;
+    for (int i = 0; i < 4; i++) {
+        ivec3 u{ 0 };
+        ivec3 v{ 0 };
+        u[uAxis] = corners[i][uAxis] > 0.f ? 1 : -1;
+        v[vAxis] = corners[i][vAxis] > 0.f ? 1 : -1;
+        int sides = isSolid(occupancy, front + u) + isSolid(occupancy, front + v);
+        occlusion[i] = static_cast<uint8_t>(sides == 2 ? 3 : sides + isSolid(occupancy, front + u + v));
+    }
+    //CHUNK_PANEL_INDICES split the quad along corners 1-2. the other diagonal is used when its corners are the
+    //lighter pair, so a single dark or light corner fades the same way in both triangles
+    std::array<int, 4> order = { 0, 1, 2, 3 };
+    if (occlusion[0] + occlusion[3] < occlusion[1] + occlusion[2]) {
+        order = { 1, 3, 0, 2 };
+    }
+    for (int i : order) {
+        *out++ = ChunkVertexFormat(baseVertexPos + corners[i], normalTable[orientation], block, light, occlusion[i]);
+    }
+}
+
+//the light of the air in front of a face, packed like ChunkVertexFormat::light
+uint8_t lightAt(const PerChunkState& chunk, int index) {
+    return static_cast<uint8_t>(getNibble(chunk.skyLight, index) << 4 | getNibble(chunk.blockLight, index));
+}
+
+//calls emitPanel for every block face that borders air, all faces of one orientation after another.
+template <typename PanelSink>
+void emitChunkPanels(const PerChunkState& chunk, const std::array<bool, 6>& doAdjacentsExist, const std::array<PerChunkState*, 6>& adjacents, PanelSink&& emitPanel) {
 
     auto addPanelIfNoAdjacent = [&](ivec3 coords, int indexOffset, uint8_t orientation) {
         int index = getChunkIndex(coords);
         Block block = chunk.blocks[index];
         Block adjacent = chunk.blocks[index + indexOffset];
         if (block && !adjacent) {
-            glm::vec3 baseVertexPos = glm::vec3{ coords.x, coords.y, coords.z };
-            chunkGLBufferData.push_back(ChunkVertexFormat(baseVertexPos + panelVertex1[orientation], normalTable[orientation], block));
-            chunkGLBufferData.push_back(ChunkVertexFormat(baseVertexPos + panelVertex2[orientation], normalTable[orientation], block));
-            chunkGLBufferData.push_back(ChunkVertexFormat(baseVertexPos + panelVertex3[orientation], normalTable[orientation], block));
-            chunkGLBufferData.push_back(ChunkVertexFormat(baseVertexPos + panelVertex4[orientation], normalTable[orientation], block));
+            emitPanel(glm::vec3{ coords.x, coords.y, coords.z }, orientation, block, lightAt(chunk, index + indexOffset));
         }
     };
 
-    auto addPanelIfNoAdjacentWithAdjacentChunk = [&](BlockList adjacentBlockList, ivec3 coords, int indexOffset, uint8_t orientation) {
+    auto addPanelIfNoAdjacentWithAdjacentChunk = [&](const PerChunkState& adjacentChunk, ivec3 coords, int indexOffset, uint8_t orientation) {
         int index = getChunkIndex(coords);
         Block block = chunk.blocks[index];
-        Block adjacent = adjacentBlockList[index + indexOffset];
+        Block adjacent = adjacentChunk.blocks[index + indexOffset];
         if (block && !adjacent) {
-            glm::vec3 baseVertexPos = glm::vec3{ coords.x, coords.y, coords.z };
-            chunkGLBufferData.push_back(ChunkVertexFormat(baseVertexPos + panelVertex1[orientation], normalTable[orientation], block));
-            chunkGLBufferData.push_back(ChunkVertexFormat(baseVertexPos + panelVertex2[orientation], normalTable[orientation], block));
-            chunkGLBufferData.push_back(ChunkVertexFormat(baseVertexPos + panelVertex3[orientation], normalTable[orientation], block));
-            chunkGLBufferData.push_back(ChunkVertexFormat(baseVertexPos + panelVertex4[orientation], normalTable[orientation], block));
+            emitPanel(glm::vec3{ coords.x, coords.y, coords.z }, orientation, block, lightAt(adjacentChunk, index + indexOffset));
         }
     };
 
@@ -109,7 +153,7 @@ std::vector<ChunkVertexFormat> getChunkGLBuffer(PerChunkState chunk, std::array<
     if (doAdjacentsExist[0]) {
         PerChunkState& adjacentChunk = *adjacents[0];
         static3DLoop<0, 0, 0, 1, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE>([&](ivec3 coords) {
-            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk.blocks, coords, BLOCKS_PER_SIDE - 1, 0);
+            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk, coords, BLOCKS_PER_SIDE - 1, 0);
         });
     }
     static3DLoop<0, 0, 0, BLOCKS_PER_SIDE - 1, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE>([&](ivec3 coords) {
@@ -119,7 +163,7 @@ std::vector<ChunkVertexFormat> getChunkGLBuffer(PerChunkState chunk, std::array<
     if (doAdjacentsExist[1]) {
         PerChunkState& adjacentChunk = *adjacents[1];
         static3DLoop<BLOCKS_PER_SIDE - 1, 0, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE>([&](ivec3 coords) {
-            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk.blocks, coords, -(BLOCKS_PER_SIDE - 1), 1);
+            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk, coords, -(BLOCKS_PER_SIDE - 1), 1);
         });
     }
     static3DLoop<0, 1, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE>([&](ivec3 coords) {
@@ -129,7 +173,7 @@ std::vector<ChunkVertexFormat> getChunkGLBuffer(PerChunkState chunk, std::array<
     if (doAdjacentsExist[2]) {
         PerChunkState& adjacentChunk = *adjacents[2];
         static3DLoop<0, 0, 0, BLOCKS_PER_SIDE, 1, BLOCKS_PER_SIDE>([&](ivec3 coords) {
-            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk.blocks, coords, BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE - 1), 2);
+            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk, coords, BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE - 1), 2);
         });
     }
     static3DLoop<0, 0, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE - 1, BLOCKS_PER_SIDE>([&](ivec3 coords) {
@@ -139,7 +183,7 @@ std::vector<ChunkVertexFormat> getChunkGLBuffer(PerChunkState chunk, std::array<
     if (doAdjacentsExist[3]) {
         PerChunkState& adjacentChunk = *adjacents[3];
         static3DLoop<0, BLOCKS_PER_SIDE - 1, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE>([&](ivec3 coords) {
-            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk.blocks, coords, -BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE - 1), 3);
+            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk, coords, -BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE - 1), 3);
         });
     }
     static3DLoop<0, 0, 1, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE>([&](ivec3 coords) {
@@ -149,7 +193,7 @@ std::vector<ChunkVertexFormat> getChunkGLBuffer(PerChunkState chunk, std::array<
     if (doAdjacentsExist[4]) {
         PerChunkState& adjacentChunk = *adjacents[4];
         static3DLoop<0, 0, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE, 1>([&](ivec3 coords) {
-            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk.blocks, coords, BLOCKS_PER_SIDE * BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE - 1), 4);
+            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk, coords, BLOCKS_PER_SIDE * BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE - 1), 4);
         });
     }
     static3DLoop<0, 0, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE - 1>([&](ivec3 coords) {
@@ -159,70 +203,223 @@ std::vector<ChunkVertexFormat> getChunkGLBuffer(PerChunkState chunk, std::array<
     if (doAdjacentsExist[5]) {
         PerChunkState& adjacentChunk = *adjacents[5];
         static3DLoop<0, 0, BLOCKS_PER_SIDE - 1, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE>([&](ivec3 coords) {
-            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk.blocks, coords, -BLOCKS_PER_SIDE * BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE - 1), 5);
+            addPanelIfNoAdjacentWithAdjacentChunk(adjacentChunk, coords, -BLOCKS_PER_SIDE * BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE - 1), 5);
         });
     }
+}
 
-    tcs->users--;
-    if (tcs->users == 0) {
+//sets the bits of the chunk itself and of the face neighbors' layers around it.
+void fillOccupancy(OccupancyRows& occupancy, const PerChunkState& chunk, const std::array<bool, 6>& doAdjacentsExist, const std::array<PerChunkState*, 6>& adjacents) {
+    ivec3 coords;
+    for (coords.z = -1; coords.z <= BLOCKS_PER_SIDE; coords.z++) {
+        for (coords.y = -1; coords.y <= BLOCKS_PER_SIDE; coords.y++) {
+            uint32_t& row = occupancy[(coords.y + 1) + PADDED_SIDE * (coords.z + 1)];
+            for (coords.x = -1; coords.x <= BLOCKS_PER_SIDE; coords.x++) {
+                int outside = 0;
+                int face = 0;
+                for (int axis = 0; axis < 3; axis++) {
+                    if (coords[axis] < 0 || coords[axis] >= BLOCKS_PER_SIDE) {
+                        outside++;
+                        face = axis * 2 + (coords[axis] >= BLOCKS_PER_SIDE);
+                    }
+                }
+                const PerChunkState* source = outside == 0 ? &chunk : outside == 1 && doAdjacentsExist[face] ? adjacents[face] : nullptr;
+                if (source != nullptr && source->blocks[getChunkIndex((coords + BLOCKS_PER_SIDE) % BLOCKS_PER_SIDE)] != AIR) {
+                    row |= 1u << (coords.x + 1);
+                }
+            }
+        }
+    }
+}
+
+OccupancyRows diagonalOccupancy(ChunkKey key) {
+    OccupancyRows occupancy = {};
+    ivec3 offset;
+    for (offset.z = -1; offset.z <= 1; offset.z++) {
+        for (offset.y = -1; offset.y <= 1; offset.y++) {
+            for (offset.x = -1; offset.x <= 1; offset.x++) {
+                if (std::abs(offset.x) + std::abs(offset.y) + std::abs(offset.z) < 2) {
+                    continue;
+                }
+                auto iter = perChunkState.find(key + offset);
+                if (iter == perChunkState.end()) {
+                    continue; //not generated yet, or sky
+                }
+                //the cells of the layer in this neighbor: -1 or BLOCKS_PER_SIDE along the axes offset points out on
+                ivec3 first;
+                ivec3 last;
+                for (int axis = 0; axis < 3; axis++) {
+                    first[axis] = offset[axis] < 0 ? -1 : offset[axis] > 0 ? BLOCKS_PER_SIDE : 0;
+                    last[axis] = offset[axis] == 0 ? BLOCKS_PER_SIDE - 1 : first[axis];
+                }
+                ivec3 coords;
+                for (coords.z = first.z; coords.z <= last.z; coords.z++) {
+                    for (coords.y = first.y; coords.y <= last.y; coords.y++) {
+                        for (coords.x = first.x; coords.x <= last.x; coords.x++) {
+                            if (iter->second.blocks[getChunkIndex((coords + BLOCKS_PER_SIDE) % BLOCKS_PER_SIDE)] != AIR) {
+                                occupancy[(coords.y + 1) + PADDED_SIDE * (coords.z + 1)] |= 1u << (coords.x + 1);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return occupancy;
+}
+
+ChunkMesh getChunkGLBuffer(PerChunkState chunk, std::array<bool, 6> doAdjacentsExist, std::array<PerChunkState*, 6> adjacents, OccupancyRows occupancy, TemporaryChunksSnapshot* tcs) {
+    fillOccupancy(occupancy, chunk, doAdjacentsExist, adjacents);
+    //count first so the vertices can be written straight into the upload ring
+    ChunkMesh mesh;
+    mesh.boundsMin = vec3{ static_cast<float>(BLOCKS_PER_SIDE) };
+    mesh.boundsMax = vec3{ 0.f };
+    emitChunkPanels(chunk, doAdjacentsExist, adjacents, [&](glm::vec3 baseVertexPos, uint8_t orientation, Block block, uint8_t light) {
+        mesh.vertexCount += 4;
+        mesh.orientationPanels[orientation]++;
+        mesh.boundsMin = glm::min(mesh.boundsMin, baseVertexPos);
+        mesh.boundsMax = glm::max(mesh.boundsMax, baseVertexPos + 1.f);
+    });
+    if (uploadring::reserve(mesh.vertexCount * sizeof(ChunkVertexFormat), mesh.staged)) {
+        ChunkVertexFormat* out = static_cast<ChunkVertexFormat*>(mesh.staged.data);
+        emitChunkPanels(chunk, doAdjacentsExist, adjacents, [&](glm::vec3 baseVertexPos, uint8_t orientation, Block block, uint8_t light) {
+            writePanel(out, occupancy, baseVertexPos, orientation, block, light);
+        });
+    }
+    else {
+        mesh.vertices.reserve(mesh.vertexCount);
+        auto out = std::back_inserter(mesh.vertices);
+        emitChunkPanels(chunk, doAdjacentsExist, adjacents, [&](glm::vec3 baseVertexPos, uint8_t orientation, Block block, uint8_t light) {
+            writePanel(out, occupancy, baseVertexPos, orientation, block, light);
+        });
+    }
+
+    mesh.faceConnections = connectivity::findFaceConnections(chunk.blocks);
+    mesh.occluders = occlusion::findOccluders(chunk.blocks);
+
+    if (--tcs->users == 0) {
         delete tcs;
     }
 
-    return chunkGLBufferData;
+    return mesh;
 }
 
 int getChunkIndex(ivec3 coords) {
     return coords.x + BLOCKS_PER_SIDE * (coords.y + BLOCKS_PER_SIDE * coords.z);
 }
 
+uint64_t findSolidBricks(const BlockList& blocks) {
+    uint64_t solidBricks = 0;
+    ivec3 coords;
+    for (coords.z = 0; coords.z < BLOCKS_PER_SIDE; coords.z++) {
+        for (coords.y = 0; coords.y < BLOCKS_PER_SIDE; coords.y++) {
+            for (coords.x = 0; coords.x < BLOCKS_PER_SIDE; coords.x++) {
+                if (blocks[getChunkIndex(coords)] != AIR) {
+                    solidBricks |= 1ull << getBrickIndex(coords);
+                }
+            }
+        }
+    }
+    return solidBricks;
+}
+
 enum AdjacentChunkState {
     USE_CHUNK, FILL, NO_FILL
 };
 
+//a chunk is meshed once all its neighbors are known, so it isn't meshed again when they arrive.
+//neighbors that aren't resident yet are asked for.
+bool areNeighborsResolved(ChunkKey chunkKey) {
+    bool resolved = true;
+    for (auto& offset : ADJACENT_CHUNK_OFFSETS) {
+        ChunkKey neighbor = chunkKey + offset;
+        if (perChunkState.find(neighbor) == perChunkState.end() && !worldgen::isEmptySky(neighbor)) {
+            chunkio::requestLoad(neighbor);
+            resolved = false;
+        }
+    }
+    return resolved;
+}
+
+void storeChunkMesh(ChunkMesh& mesh, BufferAndPanelCount& chunkGLState) {
+    gpumem::free(chunkGLState.mesh);
+    if (mesh.staged.bytes > 0) {
+        chunkGLState.mesh = gpumem::storeFromBuffer(uploadring::buffer(), mesh.staged.offset, mesh.vertexCount);
+        uploadring::consumed(mesh.staged);
+    }
+    else {
+        chunkGLState.mesh = gpumem::store(mesh.vertices.data(), mesh.vertexCount);
+    }
+    chunkGLState.vertexCount = mesh.vertexCount / 4 * 6;
+    chunkGLState.boundsMin = mesh.boundsMin;
+    chunkGLState.boundsMax = mesh.boundsMax;
+    chunkGLState.orientationPanels = mesh.orientationPanels;
+    chunkGLState.faceConnections = mesh.faceConnections;
+    chunkGLState.occluders = std::move(mesh.occluders);
+}
+
 void updateChunkGLBuffers() {
-    pendingChunkPolygonizations.remove_if([](auto& futureAndKey) -> bool {
-        //auto& futureAndKey = *iter;
+    //upload the finished meshes closest to where the viewer is heading first
+    std::vector<KeyAndChunkFuture*> readyPolygonizations;
+    for (auto& futureAndKey : pendingChunkPolygonizations) {
         if (futureAndKey.chunkFuture.wait_for(std::chrono::nanoseconds(1)) == std::future_status::ready) {
-            auto bufferData = futureAndKey.chunkFuture.get();
-            GLuint buf;
-            auto iter = chunkGLBuffers.find(futureAndKey.key);
-            if (iter == chunkGLBuffers.end()) {
-                glGenBuffers(1, &buf);
-                chunkGLBuffers[futureAndKey.key] = BufferAndPanelCount(buf, 0);
-                iter = chunkGLBuffers.find(futureAndKey.key);
-            }
-            else {
-                buf = (*iter).second.buffer;
-            }
-            glBindBuffer(GL_ARRAY_BUFFER, buf);
-            (*iter).second.vertexCount = bufferData.size() / 4 * 6;
-            glBufferData(GL_ARRAY_BUFFER, bufferData.size() * sizeof(ChunkVertexFormat), bufferData.data(), GL_STATIC_DRAW);
-            return true;
+            readyPolygonizations.push_back(&futureAndKey);
         }
-        return false;
+    }
+    std::sort(readyPolygonizations.begin(), readyPolygonizations.end(), [](auto a, auto b) {
+        return viewer::chunkPriority(a->key) < viewer::chunkPriority(b->key);
+    });
+    if (readyPolygonizations.size() > MAX_CHUNK_UPLOADS_PER_FRAME) {
+        readyPolygonizations.resize(MAX_CHUNK_UPLOADS_PER_FRAME);
+    }
+    for (auto futureAndKey : readyPolygonizations) {
+        ChunkMesh mesh = futureAndKey->chunkFuture.get();
+        auto& chunkGLState = chunkGLBuffers[futureAndKey->key];
+        storeChunkMesh(mesh, chunkGLState);
+        residency::meshStored(futureAndKey->key, gpumem::allocatedBytes(chunkGLState.mesh));
+    }
+    if (!readyPolygonizations.empty()) {
+        drawableChunksVersion++;
+    }
+    uploadring::endFrame();
+    pendingChunkPolygonizations.remove_if([](auto& futureAndKey) -> bool {
+        return !futureAndKey.chunkFuture.valid(); //already uploaded above
     });
 
+    //only keep a bounded number of meshing jobs queued so that newly urgent chunks don't wait behind stale ones
+    size_t meshingSlots = MAX_MESHING_JOBS_PER_WORKER * workerPool().size();
+    if (chunksRequiringBufferUpdates.empty() || pendingChunkPolygonizations.size() >= meshingSlots) {
+        return;
+    }
+    //a chunk already being meshed waits for that job, so an older mesh can never be uploaded over a newer one
+    std::unordered_set<ChunkKey> chunksBeingPolygonized;
+    for (auto& futureAndKey : pendingChunkPolygonizations) {
+        chunksBeingPolygonized.insert(futureAndKey.key);
+    }
+    std::vector<ChunkKey> meshingOrder;
+    meshingOrder.reserve(chunksRequiringBufferUpdates.size());
+    for (auto& chunkKey : chunksRequiringBufferUpdates) {
+        if (chunksBeingPolygonized.find(chunkKey) == chunksBeingPolygonized.end() && areNeighborsResolved(chunkKey) && !light::isPending(chunkKey)) {
+            meshingOrder.push_back(chunkKey);
+        }
+    }
+    std::sort(meshingOrder.begin(), meshingOrder.end(), [](auto a, auto b) {
+        return viewer::chunkPriority(a) < viewer::chunkPriority(b);
+    });
+    meshingOrder.resize(std::min(meshingOrder.size(), meshingSlots - pendingChunkPolygonizations.size()));
+
     TemporaryChunksSnapshot* tcs = new TemporaryChunksSnapshot();
-    for (auto iter = chunksRequiringBufferUpdates.begin(); iter != chunksRequiringBufferUpdates.end(); ++iter) {
-        auto chunkKey = *iter;
+    tcs->users = 1; //held until every job has been handed its pointers
+    for (auto chunkKey : meshingOrder) {
+        chunksRequiringBufferUpdates.erase(chunkKey);
         //auto chunk = perChunkState[chunkKey];
 
         PerChunkState chunkData = perChunkState[chunkKey];
         std::array<bool, 6> doAdjacentsExist;
         std::array<PerChunkState*, 6> adjacentChunks = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
 
-
-        const std::array<ivec3, 6> adjacentOffsets = {
-            ivec3{ -1, 0, 0 },
-            { 1, 0, 0 },
-            { 0, -1, 0 },
-            { 0, 1, 0 },
-            { 0, 0, -1 },
-            { 0, 0, 1 }
-        };
-
         for (int i = 0; i < 6; i++) {
-            auto adjacentCoords = chunkKey + adjacentOffsets[i];
+            auto adjacentCoords = chunkKey + ADJACENT_CHUNK_OFFSETS[i];
             auto iter = perChunkState.find(adjacentCoords);
             if (iter != perChunkState.end()) {
                 doAdjacentsExist[i] = true;
@@ -235,24 +432,98 @@ void updateChunkGLBuffers() {
                     adjacentChunks[i] = &tcs->chunks[adjacentCoords];
                 }
             }
+            else if (worldgen::isEmptySky(adjacentCoords)) {
+                doAdjacentsExist[i] = true;
+                adjacentChunks[i] = &emptyChunk;
+            }
             else {
                 doAdjacentsExist[i] = false;
             }
         }
 
         tcs->users += 1;
-        pendingChunkPolygonizations.push_front({
-            chunkKey, std::async(std::launch::async,&getChunkGLBuffer, chunkData, doAdjacentsExist, adjacentChunks, tcs)
-        });
+        auto polygonization = std::make_shared<std::packaged_task<ChunkMesh()>>(
+            std::bind(&getChunkGLBuffer, chunkData, doAdjacentsExist, adjacentChunks, diagonalOccupancy(chunkKey), tcs)
+        );
+        pendingChunkPolygonizations.push_front({ chunkKey, polygonization->get_future() });
+        workerPool().submit([polygonization]() { (*polygonization)(); });
 
         //auto bufferData = getChunkGLBuffer(chunkData, doAdjacentsExist, adjacentChunks);
         //glBindBuffer(GL_ARRAY_BUFFER, chunkGLBuffers[chunkKey].buffer);
         //chunkGLBuffers[chunkKey].vertexCount = bufferData.size() / 4 * 6;
         //glBufferData(GL_ARRAY_BUFFER, bufferData.size() * sizeof(ChunkVertexFormat), bufferData.data(), GL_STATIC_DRAW);
     }
-    chunksRequiringBufferUpdates.clear();
+    if (--tcs->users == 0) {
+        delete tcs;
+    }
+}
+
+
+//whether the chunk's blocks can darken a visible face of its edge or corner neighbor at offset through
+//ambient occlusion: a solid block of the neighbor's layer against one of ours, with air on one of its sides.
+//see diagonalOccupancy
+bool shadesDiagonal(ChunkKey key, const PerChunkState& chunk, ivec3 offset) {
+    auto blockAt = [](ivec3 position) -> Block {
+        ChunkKey containing = connectivity::chunkContaining(vec3{ position });
+        auto iter = perChunkState.find(containing);
+        //a neighbor that isn't resident may well be air
+        return iter != perChunkState.end() ? iter->second.blocks[getChunkIndex(position - containing * BLOCKS_PER_SIDE)] : AIR;
+    };
+    ivec3 origin = key * BLOCKS_PER_SIDE;
+    //this chunk's cells the neighbor reads
+    ivec3 first;
+    ivec3 last;
+    for (int axis = 0; axis < 3; axis++) {
+        first[axis] = offset[axis] > 0 ? BLOCKS_PER_SIDE - 1 : 0;
+        last[axis] = offset[axis] == 0 ? BLOCKS_PER_SIDE - 1 : first[axis];
+    }
+    ivec3 coords;
+    for (coords.z = first.z; coords.z <= last.z; coords.z++) {
+        for (coords.y = first.y; coords.y <= last.y; coords.y++) {
+            for (coords.x = first.x; coords.x <= last.x; coords.x++) {
+                if (chunk.blocks[getChunkIndex(coords)] == AIR) {
+                    continue;
+                }
+                //the neighbor's blocks whose corners touch this one, one step along the edge either way
+                ivec3 low = coords + offset;
+                ivec3 high = coords + offset;
+                for (int axis = 0; axis < 3; axis++) {
+                    if (offset[axis] == 0) {
+                        low[axis] = std::max(low[axis] - 1, 0);
+                        high[axis] = std::min(high[axis] + 1, BLOCKS_PER_SIDE - 1);
+                    }
+                }
+                ivec3 touching;
+                for (touching.z = low.z; touching.z <= high.z; touching.z++) {
+                    for (touching.y = low.y; touching.y <= high.y; touching.y++) {
+                        for (touching.x = low.x; touching.x <= high.x; touching.x++) {
+                            ivec3 position = origin + touching;
+                            if (blockAt(position) == AIR) {
+                                continue;
+                            }
+                            for (auto& side : ADJACENT_CHUNK_OFFSETS) {
+                                if (blockAt(position + side) == AIR) {
+                                    return true;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return false;
 }
 
+void queueRemesh(ChunkKey posAndLod) {
+    if (chunksThatShouldBeDrawn.find(posAndLod) != chunksThatShouldBeDrawn.end()) {
+        chunksRequiringBufferUpdates.insert(posAndLod);
+        notUpdated.erase(posAndLod);
+    }
+    else {
+        notUpdated.insert(posAndLod);
+    }
+}
 
 void addChunkAt(ChunkKey posAndLod) {
     perChunkState[posAndLod] = PerChunkState();
@@ -263,8 +534,62 @@ void addChunkAt(ChunkKey posAndLod) {
     //chunkGLBuffers[posAndLod] = BufferAndPanelCount(buf, 0);
 }
 
+void insertChunk(ChunkKey posAndLod, const Block* blocks) {
+    addChunkAt(posAndLod);
+    PerChunkState& chunk = perChunkState[posAndLod];
+    std::copy(blocks, blocks + VOLUME, chunk.blocks.begin());
+    chunk.solidBricks = findSolidBricks(chunk.blocks);
+    light::chunkInserted(posAndLod);
+    markChunkForRemesh(posAndLod);
+    //meshing only waits for the face neighbors, so edge and corner ones may have been meshed without this
+    //chunk's blocks in their ambient occlusion
+    ivec3 offset;
+    for (offset.z = -1; offset.z <= 1; offset.z++) {
+        for (offset.y = -1; offset.y <= 1; offset.y++) {
+            for (offset.x = -1; offset.x <= 1; offset.x++) {
+                if (std::abs(offset.x) + std::abs(offset.y) + std::abs(offset.z) < 2 || perChunkState.find(posAndLod + offset) == perChunkState.end()) {
+                    continue;
+                }
+                if (shadesDiagonal(posAndLod, chunk, offset)) {
+                    queueRemesh(posAndLod + offset);
+                }
+            }
+        }
+    }
+}
+
+void markChunkForRemesh(ChunkKey posAndLod) {
+    lod::chunkChanged(posAndLod);
+    queueRemesh(posAndLod);
+}
+
+bool setBlock(ivec3 position, Block block) {
+    ChunkKey key = connectivity::chunkContaining(vec3{ position });
+    auto iter = perChunkState.find(key);
+    if (iter == perChunkState.end()) {
+        return false;
+    }
+    ivec3 local = position - key * BLOCKS_PER_SIDE;
+    Block& stored = iter->second.blocks[getChunkIndex(local)];
+    if (stored == block) {
+        return true;
+    }
+    stored = block;
+    //relit, saved and remeshed along with each neighbor whose faces or occlusion show it, like any edit
+    edit::commit({ position });
+    return true;
+}
+
+//true for chunks that only ever contain generated sky, which are neither allocated nor drawn.
+bool isUnallocatedSky(ChunkKey posAndLod) {
+    return perChunkState.find(posAndLod) == perChunkState.end() && worldgen::isEmptySky(posAndLod);
+}
 
 void addChunkToDraw(ChunkKey posAndLod) {
+    if (isUnallocatedSky(posAndLod)) {
+        return;
+    }
+    chunkio::requestLoad(posAndLod);
     auto iter = notUpdated.find(posAndLod);
     if (iter != notUpdated.end()) {
         //notUpdated.insert(posAndLod);
@@ -274,15 +599,62 @@ void addChunkToDraw(ChunkKey posAndLod) {
     chunksThatShouldBeDrawn.insert(posAndLod);
 }
 
+//loads and meshes a chunk without drawing it yet. returns whether that queued any work.
+bool prewarmChunk(ChunkKey posAndLod) {
+    if (isUnallocatedSky(posAndLod)) {
+        return false;
+    }
+    bool queued = chunkio::prefetch(posAndLod);
+    auto iter = notUpdated.find(posAndLod);
+    if (iter != notUpdated.end()) {
+        chunksRequiringBufferUpdates.insert(posAndLod);
+        notUpdated.erase(iter);
+        queued = true;
+    }
+    return queued;
+}
+
 glm::ivec3 renderDistance = { 4, 4, 4 };
 void setChunksToDraw() {
-    chunksThatShouldBeDrawn.clear();
-    glm::ivec3 chunkSpaceViewerPos = glm::ivec3{ viewerPosition.x, viewerPosition.y, viewerPosition.z } / BLOCKS_PER_SIDE;
+    std::unordered_set<ChunkKey> previouslyDrawn;
+    previouslyDrawn.swap(chunksThatShouldBeDrawn);
+    ChunkKey viewerChunk = connectivity::chunkContaining(viewerPosition);
+    //the finest chunks are the ones in the coarser chunks nearest the viewer, see lod.h
+    lod::setViewerChunk(viewerChunk);
+    lod::Region region = lod::region(0);
     glm::ivec3 chunkCoord;
-    for (chunkCoord.z = -renderDistance.z; chunkCoord.z < renderDistance.z + 1; chunkCoord.z++) {
-        for (chunkCoord.y = -renderDistance.y; chunkCoord.y < renderDistance.y + 1; chunkCoord.y++) {
-            for (chunkCoord.x = -renderDistance.x; chunkCoord.x < renderDistance.x + 1; chunkCoord.x++) {
-                addChunkToDraw(ivec4{ chunkCoord + chunkSpaceViewerPos, 0 });
+    for (chunkCoord.z = region.min.z; chunkCoord.z <= region.max.z; chunkCoord.z++) {
+        for (chunkCoord.y = region.min.y; chunkCoord.y <= region.max.y; chunkCoord.y++) {
+            for (chunkCoord.x = region.min.x; chunkCoord.x <= region.max.x; chunkCoord.x++) {
+                addChunkToDraw(chunkCoord);
+            }
+        }
+    }
+    if (chunksThatShouldBeDrawn != previouslyDrawn) {
+        drawableChunksVersion++;
+    }
+    //everything in range is still loaded and meshed; only drawing is limited to what the viewer can see into
+    connectivity::update(viewerChunk, region.min, region.max);
+
+    //pre-warm cubes along the predicted path so fast flight doesn't outrun loading and meshing
+    float pathLength = glm::length(viewer::velocity()) * viewer::PREWARM_SECONDS;
+    int pathSamples = static_cast<int>(ceilf(pathLength / (renderDistance.x * BLOCKS_PER_SIDE)));
+    int prewarmed = 0;
+    for (int sample = 1; sample <= pathSamples; sample++) {
+        vec3 predicted = viewer::predictedPosition(viewer::PREWARM_SECONDS * sample / pathSamples);
+        ChunkKey predictedChunk = connectivity::chunkContaining(predicted);
+        for (chunkCoord.z = -renderDistance.z; chunkCoord.z < renderDistance.z + 1; chunkCoord.z++) {
+            for (chunkCoord.y = -renderDistance.y; chunkCoord.y < renderDistance.y + 1; chunkCoord.y++) {
+                for (chunkCoord.x = -renderDistance.x; chunkCoord.x < renderDistance.x + 1; chunkCoord.x++) {
+                    ChunkKey posAndLod = predictedChunk + chunkCoord;
+                    if (chunksThatShouldBeDrawn.find(posAndLod) != chunksThatShouldBeDrawn.end()) {
+                        continue;
+                    }
+                    //chunks already loaded and meshed cost nothing and don't count
+                    if (prewarmChunk(posAndLod) && ++prewarmed >= MAX_PREWARMED_CHUNKS_PER_UPDATE) {
+                        return;
+                    }
+                }
             }
         }
     }
@@ -299,33 +671,40 @@ std::array<uint32_t, 8> lodNoiseIndexOffsets = {
     BLOCKS_PER_SIDE * BLOCKS_PER_SIDE + BLOCKS_PER_SIDE + 1
 };
 
-void freeFarawayDrawChunksFromGPU(int limit) {
-    if (chunkGLBuffers.size() > limit) {
-        struct PosAndLODAndDistance {
-            ChunkKey posAndLod;
-            float distance;
-        };
-        std::vector<PosAndLODAndDistance> distanceSortedChunks;
-        distanceSortedChunks.reserve(chunkGLBuffers.size());
-        for (const auto& kv : chunkGLBuffers) {
-            auto posAndLod = kv.first;
-            distanceSortedChunks.push_back({ posAndLod, glm::distance(
-                {
-                    posAndLod.x * BLOCKS_PER_SIDE,
-                    posAndLod.y * BLOCKS_PER_SIDE,
-                    posAndLod.z * BLOCKS_PER_SIDE
-                },
-                viewerPosition
-            ) });
-        }
-        std::sort(distanceSortedChunks.begin(), distanceSortedChunks.end(), [](auto a, auto b) -> bool { return a.distance > b.distance; });
-        printf("first elem: %f\n", distanceSortedChunks[0].distance);
-        int chunksToFreeCount = chunkGLBuffers.size() - limit;
-        for (int i = 0; i < chunksToFreeCount; i++) {
-            auto bufferData = chunkGLBuffers[distanceSortedChunks[i].posAndLod];
-            glDeleteBuffers(1, &(bufferData.buffer));
-            chunkGLBuffers.erase(distanceSortedChunks[i].posAndLod);
-            chunksThatShouldBeDrawn.erase(distanceSortedChunks[i].posAndLod);
+void mergeChunksIntoHigherLOD(const std::array<const PerChunkState*, 8>& children, PerChunkState& merged) {
+    const int HALF = BLOCKS_PER_SIDE / 2;
+    for (int child = 0; child < 8; child++) {
+        const BlockList& blocks = children[child]->blocks;
+        ivec3 childOffset = ivec3{ child & 1, (child >> 1) & 1, child >> 2 } * HALF;
+        ivec3 coords;
+        for (coords.z = 0; coords.z < HALF; coords.z++) {
+            for (coords.y = 0; coords.y < HALF; coords.y++) {
+                for (coords.x = 0; coords.x < HALF; coords.x++) {
+                    int first = getChunkIndex(coords * 2);
+                    int solid = 0;
+                    Block material = AIR;
+                    for (int i = 0; i < 8; i++) {
+                        Block block = blocks[first + lodNoiseIndexOffsets[i]];
+                        if (block != AIR) {
+                            solid++;
+                            //offsets 2, 3, 6 and 7 are the top layer, so grass wins over the dirt under it
+                            if (material == AIR || (i & 2)) {
+                                material = block;
+                            }
+                        }
+                    }
+                    int mergedIndex = getChunkIndex(childOffset + coords);
+                    merged.blocks[mergedIndex] = solid >= 4 ? material : AIR;
+                    uint8_t skyLevel = 0;
+                    uint8_t blockLevel = 0;
+                    for (int i = 0; i < 8; i++) {
+                        skyLevel = std::max(skyLevel, getNibble(children[child]->skyLight, first + lodNoiseIndexOffsets[i]));
+                        blockLevel = std::max(blockLevel, getNibble(children[child]->blockLight, first + lodNoiseIndexOffsets[i]));
+                    }
+                    setNibble(merged.skyLight, mergedIndex, skyLevel);
+                    setNibble(merged.blockLight, mergedIndex, blockLevel);
+                }
+            }
         }
     }
-}
\ No newline at end of file
+}
@@ -11,8 +11,8 @@
 #include <unordered_set>
 #include <vector>
 #include <functional>
-#include "glad.h"
-#include <GLFW/glfw3.h>
+#include "gpumem.h"
+#include "uploadring.h"
 #include <array>
 #include <atomic>
 
@@ -21,6 +21,9 @@ using namespace glm;
 const int BLOCKS_PER_SIDE = 16;
 const int VOLUME = BLOCKS_PER_SIDE * BLOCKS_PER_SIDE * BLOCKS_PER_SIDE;
 const int STARTING_CHUNK_ATTRIB_BUFFER_SIZE = 1024;
+const size_t MAX_CHUNK_UPLOADS_PER_FRAME = 64;
+const size_t MAX_MESHING_JOBS_PER_WORKER = 4;
+const int MAX_PREWARMED_CHUNKS_PER_UPDATE = 512;
 
 const std::array<vec2, 4> CHUNK_PANEL_VERTS = std::array<vec2, 4>{
     vec2{ 0.f, 0.f },
@@ -32,10 +35,53 @@ const std::array<vec2, 4> CHUNK_PANEL_VERTS = std::array<vec2, 4>{
 const std::array<uint8_t, 6> CHUNK_PANEL_INDICES = { 0,1,2,2,1,3 };
 
 typedef glm::ivec3 ChunkKey; //fine to use this as primary key because # of chunks will stay quite small
+
+const std::array<ivec3, 6> ADJACENT_CHUNK_OFFSETS = {
+    ivec3{ -1, 0, 0 },
+    { 1, 0, 0 },
+    { 0, -1, 0 },
+    { 0, 1, 0 },
+    { 0, 0, -1 },
+    { 0, 0, 1 }
+};
 typedef uint16_t Block;
+enum BlockMaterial : Block {
+    AIR = 0,
+    STONE = 1,
+    DIRT,
+    GRASS,
+    LOG,
+    LEAVES,
+    ORE,
+    LAMP,
+    SAND, //falls. see simulation.h
+    WATER
+};
 typedef std::array<uint16_t, VOLUME> BlockList;
+//one 4-bit light level per block, two to a byte, indexed like BlockList. see light.h
+typedef std::array<uint8_t, VOLUME / 2> NibbleList;
+const uint8_t MAX_LIGHT = 15;
+const uint8_t FULL_SKY_LIGHT = MAX_LIGHT << 4; //as packed into ChunkVertexFormat::light
+
+inline uint8_t getNibble(const NibbleList& list, int index) {
+    return (list[index >> 1] >> ((index & 1) * 4)) & 15;
+}
+inline void setNibble(NibbleList& list, int index, uint8_t level) {
+    int shift = (index & 1) * 4;
+    list[index >> 1] = static_cast<uint8_t>((list[index >> 1] & ~(15 << shift)) | (level << shift));
+}
+
+//a chunk is 4x4x4 bricks of 4x4x4 blocks, so a brick summary fits in 64 bits
+const int BRICK_SIDE = 4;
+inline int getBrickIndex(ivec3 coords) {
+    return coords.x / BRICK_SIDE + BLOCKS_PER_SIDE / BRICK_SIDE * (coords.y / BRICK_SIDE + BLOCKS_PER_SIDE / BRICK_SIDE * (coords.z / BRICK_SIDE));
+}
+
 struct PerChunkState {
     BlockList blocks;
+    NibbleList skyLight;
+    NibbleList blockLight;
+    uint64_t solidBricks; //bit getBrickIndex is set if the brick has any solid block. only kept for resident chunks
 };
 
 struct TemporaryChunksSnapshot {
@@ -47,11 +93,29 @@ struct TemporaryChunksSnapshot {
 float chunkCloseness(ChunkKey chunkKey);
 bool isChunkCloser(const ChunkKey& chunkKey1, const ChunkKey& chunkKey2);
 
+//bit b of entry a is set if face b of a chunk can be reached from face a through air. faces are numbered
+//like ADJACENT_CHUNK_OFFSETS.
+typedef std::array<uint8_t, 6> FaceConnections;
+const FaceConnections ALL_FACES_CONNECTED = { 63, 63, 63, 63, 63, 63 };
+
+//a rectangle of solid blocks that hides whatever is behind it, used for occlusion culling. it lies in the
+//plane at plane / 2 blocks along axis and covers [u0, u1) x [v0, v1) along the two axes after it.
+struct OccluderQuad {
+    uint8_t axis;
+    uint8_t plane; //in half blocks, so the quad can sit in the middle of a layer
+    uint8_t u0, v0, u1, v1;
+};
+
 struct BufferAndPanelCount {
-    GLuint buffer;
+    gpumem::MeshHandle mesh;
     unsigned int vertexCount;
-    BufferAndPanelCount(GLuint b, unsigned int p) : buffer{ b }, vertexCount{ p } {};
-    BufferAndPanelCount() {};
+    vec3 boundsMin; //of the mesh, in blocks from the chunk origin
+    vec3 boundsMax;
+    std::array<uint32_t, 6> orientationPanels; //the mesh is six runs of panels, one per normalTable orientation
+    FaceConnections faceConnections; //of the blocks the mesh was made from
+    std::vector<OccluderQuad> occluders; //in blocks from the chunk origin
+    BufferAndPanelCount(gpumem::MeshHandle m, unsigned int p) : mesh{ m }, vertexCount{ p }, boundsMin{ 0.f }, boundsMax{ 0.f }, orientationPanels{}, faceConnections(ALL_FACES_CONNECTED) {};
+    BufferAndPanelCount() : mesh{ gpumem::NO_MESH }, vertexCount{ 0 }, boundsMin{ 0.f }, boundsMax{ 0.f }, orientationPanels{}, faceConnections(ALL_FACES_CONNECTED) {};
 };
 
 extern std::unordered_map<ChunkKey, PerChunkState> perChunkState;
@@ -59,7 +123,11 @@ extern std::unordered_map<ChunkKey, BufferAndPanelCount> chunkGLBuffers;
 extern std::unordered_set<ChunkKey> chunksRequiringBufferUpdates;
 extern std::unordered_set<ChunkKey> chunksThatShouldBeDrawn;
 extern std::unordered_set<ChunkKey> notUpdated;
+//changes whenever a mesh is uploaded or freed, chunksThatShouldBeDrawn changes or the set of chunks the
+//viewer can see into does, so per-frame code can keep what it derives from them until then.
+extern uint64_t drawableChunksVersion;
 extern vec3 viewerPosition;
+extern glm::ivec3 renderDistance;
 
 
 
@@ -77,27 +145,65 @@ void static3DLoop(std::function<void(ivec3 coords)> callback) {
 
 int getChunkIndex(ivec3 coords);
 
+uint64_t findSolidBricks(const BlockList& blocks);
+
 struct ChunkVertexFormat {
     uint32_t posXY;
-    uint32_t posZAndMaterial;
+    uint32_t posZAndMaterial; //the material half holds the corner's occlusion from 0 to 3 above the material's 8 bits
     glm::i8vec3 normalOut;
-    glm::i8 padding;
-    ChunkVertexFormat(glm::vec3 position, glm::i8vec3 normal, uint16_t material) {
+    uint8_t light; //sky light level in the high nibble, block light in the low one
+    ChunkVertexFormat(glm::vec3 position, glm::i8vec3 normal, uint16_t material, uint8_t light = FULL_SKY_LIGHT, uint8_t occlusion = 0) {
         posXY = glm::packHalf2x16(position.xy);
-        posZAndMaterial = glm::packHalf2x16(glm::vec2{ position.z });
+        posZAndMaterial = glm::packHalf2x16(glm::vec2{ position.z, material | occlusion << 8 });
         normalOut = normal;
+        this->light = light;
     }
 };
 
-std::vector<ChunkVertexFormat> getChunkGLBuffer(PerChunkState chunk, std::array<bool, 6> doAdjacentsExist, std::array<PerChunkState*, 6> adjacents, TemporaryChunksSnapshot* tcs);
+//a finished mesh, either staged in the upload ring or, if the ring had no room, in vertices.
+struct ChunkMesh {
+    uint32_t vertexCount = 0;
+    vec3 boundsMin; //of the emitted faces, in blocks from the chunk origin
+    vec3 boundsMax;
+    std::array<uint32_t, 6> orientationPanels = {}; //the vertices hold these many -x, +x, -y, +y, -z, +z panels in that order
+    FaceConnections faceConnections = ALL_FACES_CONNECTED;
+    std::vector<OccluderQuad> occluders;
+    uploadring::Reservation staged;
+    std::vector<ChunkVertexFormat> vertices;
+};
+
+const int PADDED_SIDE = BLOCKS_PER_SIDE + 2;
+//one bit per solid block of a chunk and the layer of blocks around it, for ambient occlusion. bit x + 1 of row
+//(y + 1) + PADDED_SIDE * (z + 1) is the block at (x, y, z) from the chunk origin.
+typedef std::array<uint32_t, PADDED_SIDE * PADDED_SIDE> OccupancyRows;
+
+//the edges and corners of the layer around the chunk, from its diagonal neighbors. the rest of the layer
+//comes from the face neighbors getChunkGLBuffer is given.
+OccupancyRows diagonalOccupancy(ChunkKey key);
+
+ChunkMesh getChunkGLBuffer(PerChunkState chunk, std::array<bool, 6> doAdjacentsExist, std::array<PerChunkState*, 6> adjacents, OccupancyRows occupancy, TemporaryChunksSnapshot* tcs);
+
+//moves a finished mesh into gpumem in place of the chunk's old one.
+void storeChunkMesh(ChunkMesh& mesh, BufferAndPanelCount& chunkGLState);
 
 void updateChunkGLBuffers();
 
 void addChunkAt(ChunkKey posAndLod);
+//adds a finished chunk (loaded or generated) and queues it for meshing.
+void insertChunk(ChunkKey posAndLod, const Block* blocks);
 
-void setChunksToDraw();
+//queues a remesh now if the chunk is being drawn, otherwise the next time it is.
+void markChunkForRemesh(ChunkKey posAndLod);
+//markChunkForRemesh without merging its lod levels again, for chunks whose blocks haven't changed.
+void queueRemesh(ChunkKey posAndLod);
 
+//changes one block of a resident chunk, relights around it and remeshes the chunks it shows in.
+//returns false if the chunk isn't resident.
+bool setBlock(ivec3 position, Block block);
 
-void mergeChunksIntoHigherLOD(ChunkKey posAndLod);
+void setChunksToDraw();
 
-void freeFarawayDrawChunksFromGPU(int limit);
\ No newline at end of file
+//downsamples 8 chunks, numbered x + 2 * (y + 2 * z), into one with half as many blocks per side. each
+//2x2x2 group of blocks becomes solid if at least half of it is, with the material of its top layer if any,
+//and takes the brightest light of the group.
+void mergeChunksIntoHigherLOD(const std::array<const PerChunkState*, 8>& children, PerChunkState& merged);
\ No newline at end of file
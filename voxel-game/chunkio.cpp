@@ -0,0 +1,569 @@
+#include "chunkio.h"
+#include "jobs.h"
+#include "viewer.h"
+#include "worldgen.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+
+#if defined(__linux__) && defined(VOXEL_USE_IO_URING)
+#include <liburing.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace chunkio {
+    namespace {
+        using Clock = std::chrono::steady_clock;
+
+        const std::streamoff SLOT_BYTES = sizeof(BlockList);
+        const std::streamoff HEADER_BYTES = CHUNKS_PER_REGION; //one "slot has been written" byte per chunk
+        const size_t LATENCY_SAMPLE_COUNT = 4096;
+        const unsigned int IO_THREAD_COUNT = 2;
+
+        enum class RegionOpKind { LOAD, SAVE };
+
+        //a run of consecutive slots in one region file, read or written as a single op.
+        struct RegionOp {
+            RegionOpKind kind;
+            ivec3 region;
+            int firstSlot;
+            std::vector<ChunkKey> keys;
+            std::vector<Clock::time_point> issued;
+            std::vector<Block> blocks; //keys.size() * VOLUME
+            std::vector<uint8_t> present;
+            size_t completedSlots = 0; //slots actually read/written; anything past a short read is treated as missing
+        };
+
+        struct QueuedLoad {
+            ChunkKey key;
+            Clock::time_point issued;
+        };
+
+        struct QueuedSave {
+            ChunkKey key;
+            Clock::time_point issued;
+            BlockList blocks;
+        };
+
+        struct LatencySamples {
+            std::vector<float> samples;
+            size_t next = 0;
+            void add(float ms) {
+                if (samples.size() < LATENCY_SAMPLE_COUNT) {
+                    samples.push_back(ms);
+                }
+                else {
+                    samples[next] = ms;
+                }
+                next = (next + 1) % LATENCY_SAMPLE_COUNT;
+            }
+            float percentile(float p) const {
+                if (samples.empty()) {
+                    return 0.f;
+                }
+                std::vector<float> sorted = samples;
+                auto nth = sorted.begin() + static_cast<size_t>(p * (sorted.size() - 1));
+                std::nth_element(sorted.begin(), nth, sorted.end());
+                return *nth;
+            }
+        };
+
+        struct IOStats {
+            uint64_t demandMisses = 0;
+            uint64_t prefetchRequests = 0;
+            uint64_t prefetchHits = 0;
+            uint64_t chunksRead = 0;
+            uint64_t chunksMissing = 0;
+            uint64_t chunksWritten = 0;
+            uint64_t readOps = 0;
+            uint64_t writeOps = 0;
+        };
+
+        std::string worldDirectory;
+        std::unique_ptr<ThreadPool> ioPool;
+        std::mutex completedOpsMutex;
+        std::vector<std::shared_ptr<RegionOp>> completedOps;
+
+        //main-thread bookkeeping
+        std::vector<QueuedLoad> queuedLoads;
+        std::unordered_map<ChunkKey, std::unique_ptr<QueuedSave>> queuedSaves;
+        std::unordered_map<ChunkKey, bool> loadsInFlight; //value is true while only a prefetch wants the chunk
+        std::unordered_set<ChunkKey> prefetchedUnused;
+        std::unordered_set<ChunkKey> missingChunks;
+
+        IOStats stats;
+        LatencySamples readLatencies;
+        LatencySamples writeLatencies;
+
+        int floorDiv(int a, int b) {
+            return (a >= 0 ? a : a - b + 1) / b;
+        }
+
+        ivec3 regionOf(ChunkKey key) {
+            return {
+                floorDiv(key.x, REGION_CHUNKS_PER_SIDE),
+                floorDiv(key.y, REGION_CHUNKS_PER_SIDE),
+                floorDiv(key.z, REGION_CHUNKS_PER_SIDE)
+            };
+        }
+
+        int slotOf(ChunkKey key) {
+            ivec3 local = key - regionOf(key) * REGION_CHUNKS_PER_SIDE;
+            return local.x + REGION_CHUNKS_PER_SIDE * (local.y + REGION_CHUNKS_PER_SIDE * local.z);
+        }
+
+        bool isSlotBefore(ChunkKey a, ChunkKey b) {
+            ivec3 regionA = regionOf(a);
+            ivec3 regionB = regionOf(b);
+            if (regionA.x != regionB.x) return regionA.x < regionB.x;
+            if (regionA.y != regionB.y) return regionA.y < regionB.y;
+            if (regionA.z != regionB.z) return regionA.z < regionB.z;
+            return slotOf(a) < slotOf(b);
+        }
+
+        //the sky chunks edits have claimed, three ints each. see worldgen::claimSky
+        std::string claimedSkyPath() {
+            return worldDirectory + "/claimed-sky.bin";
+        }
+
+        std::string regionPath(ivec3 region) {
+            return worldDirectory + "/r." + std::to_string(region.x) + "." + std::to_string(region.y) + "." + std::to_string(region.z) + ".bin";
+        }
+
+        void finishOp(std::shared_ptr<RegionOp> op) {
+            std::lock_guard<std::mutex> lock(completedOpsMutex);
+            completedOps.push_back(std::move(op));
+        }
+
+        //================ thread pool backend ================
+        std::mutex regionMutexesMutex;
+        std::unordered_map<ivec3, std::unique_ptr<std::mutex>> regionMutexes;
+
+        std::mutex& regionMutex(ivec3 region) {
+            std::lock_guard<std::mutex> lock(regionMutexesMutex);
+            auto& mutex = regionMutexes[region];
+            if (!mutex) {
+                mutex = std::make_unique<std::mutex>();
+            }
+            return *mutex;
+        }
+
+        void executeLoad(RegionOp& op) {
+            size_t count = op.keys.size();
+            op.present.assign(count, 0);
+            op.blocks.resize(count * VOLUME);
+            std::lock_guard<std::mutex> lock(regionMutex(op.region));
+            std::ifstream file(regionPath(op.region), std::ios::binary);
+            if (!file.is_open()) {
+                return;
+            }
+            file.seekg(op.firstSlot);
+            file.read(reinterpret_cast<char*>(op.present.data()), count);
+            if (!file) {
+                return;
+            }
+            file.seekg(HEADER_BYTES + op.firstSlot * SLOT_BYTES);
+            file.read(reinterpret_cast<char*>(op.blocks.data()), count * SLOT_BYTES);
+            op.completedSlots = static_cast<size_t>(file.gcount() / SLOT_BYTES);
+        }
+
+        void executeSave(RegionOp& op) {
+            size_t count = op.keys.size();
+            std::string path = regionPath(op.region);
+            std::lock_guard<std::mutex> lock(regionMutex(op.region));
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            if (!file.is_open()) {
+                std::ofstream(path, std::ios::binary);
+                file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+            }
+            if (!file.is_open()) {
+                std::cout << "failed to open region file " << path << std::endl;
+                return;
+            }
+            //data first, then the header bytes, so a torn write never marks garbage as present
+            file.seekp(HEADER_BYTES + op.firstSlot * SLOT_BYTES);
+            file.write(reinterpret_cast<const char*>(op.blocks.data()), count * SLOT_BYTES);
+            op.present.assign(count, 1);
+            file.seekp(op.firstSlot);
+            file.write(reinterpret_cast<const char*>(op.present.data()), count);
+            if (!file) {
+                std::cout << "failed to write region file " << path << std::endl;
+                return;
+            }
+            op.completedSlots = count;
+        }
+
+        //================ io_uring backend ================
+#if defined(__linux__) && defined(VOXEL_USE_IO_URING)
+        const unsigned int RING_ENTRIES = 256;
+
+        io_uring ring;
+        bool ringAvailable = false;
+        std::thread ringThread;
+        std::mutex ringQueueMutex;
+        std::condition_variable ringQueueCondition;
+        std::vector<std::shared_ptr<RegionOp>> ringQueue;
+        bool ringStopping = false;
+        std::unordered_map<ivec3, int> regionFileDescriptors; //only touched by the ring thread
+
+        int regionFileDescriptor(ivec3 region, bool create) {
+            auto iter = regionFileDescriptors.find(region);
+            if (iter != regionFileDescriptors.end()) {
+                return iter->second;
+            }
+            int fd = open(regionPath(region).c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+            if (fd >= 0) {
+                regionFileDescriptors[region] = fd;
+            }
+            return fd;
+        }
+
+        //queues up to two sqes for the op and returns how many it used.
+        unsigned int prepareRingOp(RegionOp& op) {
+            size_t count = op.keys.size();
+            if (op.kind == RegionOpKind::LOAD) {
+                op.present.assign(count, 0);
+                op.blocks.resize(count * VOLUME);
+                int fd = regionFileDescriptor(op.region, false);
+                if (fd < 0) {
+                    return 0;
+                }
+                io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_read(sqe, fd, op.present.data(), count, op.firstSlot);
+                io_uring_sqe_set_data(sqe, nullptr);
+                sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_read(sqe, fd, op.blocks.data(), count * SLOT_BYTES, HEADER_BYTES + op.firstSlot * SLOT_BYTES);
+                io_uring_sqe_set_data(sqe, &op);
+            }
+            else {
+                int fd = regionFileDescriptor(op.region, true);
+                if (fd < 0) {
+                    std::cout << "failed to open region file " << regionPath(op.region) << std::endl;
+                    return 0;
+                }
+                op.present.assign(count, 1);
+                io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_write(sqe, fd, op.blocks.data(), count * SLOT_BYTES, HEADER_BYTES + op.firstSlot * SLOT_BYTES);
+                sqe->flags |= IOSQE_IO_LINK; //header bytes only after the data landed
+                io_uring_sqe_set_data(sqe, nullptr);
+                sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_write(sqe, fd, op.present.data(), count, op.firstSlot);
+                io_uring_sqe_set_data(sqe, &op);
+            }
+            return 2;
+        }
+
+        void ringLoop() {
+            while (true) {
+                std::vector<std::shared_ptr<RegionOp>> batch;
+                {
+                    std::unique_lock<std::mutex> lock(ringQueueMutex);
+                    ringQueueCondition.wait(lock, []() { return ringStopping || !ringQueue.empty(); });
+                    if (ringQueue.empty()) {
+                        return;
+                    }
+                    batch.swap(ringQueue);
+                }
+                for (size_t start = 0; start < batch.size(); start += RING_ENTRIES / 2) {
+                    size_t end = std::min(batch.size(), start + RING_ENTRIES / 2);
+                    unsigned int submitted = 0;
+                    for (size_t i = start; i < end; i++) {
+                        submitted += prepareRingOp(*batch[i]);
+                    }
+                    io_uring_submit_and_wait(&ring, submitted);
+                    for (unsigned int i = 0; i < submitted; i++) {
+                        io_uring_cqe* cqe;
+                        if (io_uring_wait_cqe(&ring, &cqe) < 0) {
+                            break;
+                        }
+                        RegionOp* op = static_cast<RegionOp*>(io_uring_cqe_get_data(cqe));
+                        if (op != nullptr && cqe->res > 0) {
+                            op->completedSlots = op->kind == RegionOpKind::LOAD
+                                ? static_cast<size_t>(cqe->res / SLOT_BYTES)
+                                : op->keys.size();
+                        }
+                        io_uring_cqe_seen(&ring, cqe);
+                    }
+                }
+                for (auto& op : batch) {
+                    finishOp(std::move(op));
+                }
+            }
+        }
+#endif
+
+        void submitOps(std::vector<std::shared_ptr<RegionOp>>& ops) {
+#if defined(__linux__) && defined(VOXEL_USE_IO_URING)
+            if (ringAvailable) {
+                {
+                    std::lock_guard<std::mutex> lock(ringQueueMutex);
+                    ringQueue.insert(ringQueue.end(), ops.begin(), ops.end());
+                }
+                ringQueueCondition.notify_one();
+                return;
+            }
+#endif
+            for (auto& op : ops) {
+                ioPool->submit([op]() {
+                    if (op->kind == RegionOpKind::LOAD) {
+                        executeLoad(*op);
+                    }
+                    else {
+                        executeSave(*op);
+                    }
+                    finishOp(op);
+                });
+            }
+        }
+
+        //appends the chunk to the last op if it is the next slot of the same region file, otherwise starts a new op.
+        RegionOp& coalesce(std::vector<std::shared_ptr<RegionOp>>& ops, RegionOpKind kind, ChunkKey key, Clock::time_point issued) {
+            ivec3 region = regionOf(key);
+            int slot = slotOf(key);
+            if (ops.empty() || ops.back()->kind != kind || ops.back()->region != region
+                || ops.back()->firstSlot + static_cast<int>(ops.back()->keys.size()) != slot) {
+                auto op = std::make_shared<RegionOp>();
+                op->kind = kind;
+                op->region = region;
+                op->firstSlot = slot;
+                ops.push_back(op);
+            }
+            RegionOp& op = *ops.back();
+            op.keys.push_back(key);
+            op.issued.push_back(issued);
+            return op;
+        }
+
+        void submitQueued() {
+            std::vector<std::shared_ptr<RegionOp>> ops;
+
+            std::sort(queuedLoads.begin(), queuedLoads.end(), [](const QueuedLoad& a, const QueuedLoad& b) { return isSlotBefore(a.key, b.key); });
+            for (auto& load : queuedLoads) {
+                coalesce(ops, RegionOpKind::LOAD, load.key, load.issued);
+            }
+            size_t loadOpCount = ops.size();
+            //reads for where the viewer is heading go out first
+            std::vector<std::pair<float, std::shared_ptr<RegionOp>>> prioritizedLoads;
+            prioritizedLoads.reserve(loadOpCount);
+            for (auto& op : ops) {
+                float priority = std::numeric_limits<float>::max();
+                for (auto& key : op->keys) {
+                    priority = std::min(priority, viewer::chunkPriority(key));
+                }
+                prioritizedLoads.push_back({ priority, op });
+            }
+            std::sort(prioritizedLoads.begin(), prioritizedLoads.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            for (size_t i = 0; i < loadOpCount; i++) {
+                ops[i] = prioritizedLoads[i].second;
+            }
+
+            std::vector<QueuedSave*> saves;
+            saves.reserve(queuedSaves.size());
+            for (auto& kv : queuedSaves) {
+                saves.push_back(kv.second.get());
+            }
+            std::sort(saves.begin(), saves.end(), [](QueuedSave* a, QueuedSave* b) { return isSlotBefore(a->key, b->key); });
+            for (auto save : saves) {
+                RegionOp& op = coalesce(ops, RegionOpKind::SAVE, save->key, save->issued);
+                op.blocks.insert(op.blocks.end(), save->blocks.begin(), save->blocks.end());
+            }
+
+            stats.readOps += loadOpCount;
+            stats.writeOps += ops.size() - loadOpCount;
+            queuedLoads.clear();
+            queuedSaves.clear();
+            if (!ops.empty()) {
+                submitOps(ops);
+            }
+        }
+
+        void queueLoad(ChunkKey key, bool speculative) {
+            loadsInFlight[key] = speculative;
+            queuedLoads.push_back({ key, Clock::now() });
+        }
+
+        bool tryPrefetch(ChunkKey key) {
+            if (perChunkState.find(key) != perChunkState.end()
+                || loadsInFlight.find(key) != loadsInFlight.end()
+                || prefetchedUnused.find(key) != prefetchedUnused.end()) {
+                return false;
+            }
+            if (missingChunks.find(key) != missingChunks.end()) {
+                return worldgen::request(key);
+            }
+            stats.prefetchRequests++;
+            queueLoad(key, true);
+            return true;
+        }
+    }
+
+    void init(const std::string& directory) {
+        worldDirectory = directory;
+        std::filesystem::create_directories(worldDirectory);
+        std::ifstream claimed(claimedSkyPath(), std::ios::binary);
+        int32_t coords[3];
+        while (claimed.read(reinterpret_cast<char*>(coords), sizeof(coords))) {
+            worldgen::claimSky({ coords[0], coords[1], coords[2] });
+        }
+        ioPool = std::make_unique<ThreadPool>(IO_THREAD_COUNT);
+#if defined(__linux__) && defined(VOXEL_USE_IO_URING)
+        ringAvailable = io_uring_queue_init(RING_ENTRIES, &ring, 0) == 0;
+        if (ringAvailable) {
+            ringThread = std::thread(ringLoop);
+        }
+        else {
+            std::cout << "io_uring unavailable, using thread pool for chunk I/O" << std::endl;
+        }
+#endif
+    }
+
+    void shutdown() {
+        submitQueued();
+#if defined(__linux__) && defined(VOXEL_USE_IO_URING)
+        if (ringAvailable) {
+            {
+                std::lock_guard<std::mutex> lock(ringQueueMutex);
+                ringStopping = true;
+            }
+            ringQueueCondition.notify_one();
+            ringThread.join();
+            for (auto& kv : regionFileDescriptors) {
+                close(kv.second);
+            }
+            regionFileDescriptors.clear();
+            io_uring_queue_exit(&ring);
+            ringAvailable = false;
+        }
+#endif
+        if (ioPool) {
+            ioPool->waitIdle();
+            ioPool.reset();
+        }
+        std::lock_guard<std::mutex> lock(completedOpsMutex);
+        completedOps.clear();
+    }
+
+    void requestLoad(ChunkKey key) {
+        auto prefetched = prefetchedUnused.find(key);
+        if (prefetched != prefetchedUnused.end()) {
+            stats.prefetchHits++;
+            prefetchedUnused.erase(prefetched);
+            return;
+        }
+        auto inFlight = loadsInFlight.find(key);
+        if (inFlight != loadsInFlight.end()) {
+            if (inFlight->second) {
+                stats.prefetchHits++;
+                inFlight->second = false;
+            }
+            return;
+        }
+        if (perChunkState.find(key) != perChunkState.end()) {
+            return;
+        }
+        if (missingChunks.find(key) != missingChunks.end()) {
+            worldgen::request(key); //no-op while it is already generating
+            return;
+        }
+        stats.demandMisses++;
+        queueLoad(key, false);
+    }
+
+    bool prefetch(ChunkKey key) {
+        return tryPrefetch(key);
+    }
+
+    void requestSave(ChunkKey key, const PerChunkState& chunk) {
+        auto& save = queuedSaves[key];
+        if (!save) {
+            save = std::make_unique<QueuedSave>();
+        }
+        save->key = key;
+        save->issued = Clock::now();
+        save->blocks = chunk.blocks;
+        missingChunks.erase(key);
+    }
+
+    void claimSky(ChunkKey key) {
+        worldgen::claimSky(key);
+        if (worldDirectory.empty()) {
+            return;
+        }
+        //rare enough to write straight away, so the chunk can't be saved without the claim that loads it
+        std::ofstream claimed(claimedSkyPath(), std::ios::binary | std::ios::app);
+        int32_t coords[3] = { key.x, key.y, key.z };
+        claimed.write(reinterpret_cast<const char*>(coords), sizeof(coords));
+    }
+
+    bool isLoading(ChunkKey key) {
+        return loadsInFlight.find(key) != loadsInFlight.end();
+    }
+
+    void update() {
+        std::vector<std::shared_ptr<RegionOp>> completed;
+        {
+            std::lock_guard<std::mutex> lock(completedOpsMutex);
+            completed.swap(completedOps);
+        }
+        auto now = Clock::now();
+        for (auto& op : completed) {
+            for (size_t i = 0; i < op->keys.size(); i++) {
+                float latencyMs = std::chrono::duration<float, std::milli>(now - op->issued[i]).count();
+                ChunkKey key = op->keys[i];
+                if (op->kind == RegionOpKind::SAVE) {
+                    writeLatencies.add(latencyMs);
+                    if (i < op->completedSlots) {
+                        stats.chunksWritten++;
+                    }
+                    continue;
+                }
+
+                readLatencies.add(latencyMs);
+                bool speculative = false;
+                auto inFlight = loadsInFlight.find(key);
+                if (inFlight != loadsInFlight.end()) {
+                    speculative = inFlight->second;
+                    loadsInFlight.erase(inFlight);
+                }
+                if (i >= op->completedSlots || !op->present[i]) {
+                    stats.chunksMissing++;
+                    missingChunks.insert(key);
+                    worldgen::request(key);
+                    continue;
+                }
+                stats.chunksRead++;
+                if (perChunkState.find(key) != perChunkState.end()) {
+                    continue; //created in memory while the read was in flight; that copy is newer
+                }
+                insertChunk(key, op->blocks.data() + i * VOLUME);
+                if (speculative) {
+                    prefetchedUnused.insert(key);
+                }
+            }
+        }
+        submitQueued();
+    }
+
+    void printStats() {
+        uint64_t demanded = stats.prefetchHits + stats.demandMisses;
+        float hitRate = demanded == 0 ? 0.f : 100.f * static_cast<float>(stats.prefetchHits) / static_cast<float>(demanded);
+        printf("chunk io: prefetch hit rate %.1f%% (%llu hits, %llu misses, %llu prefetched), %llu read / %llu missing / %llu written in %llu+%llu ops\n",
+            hitRate,
+            static_cast<unsigned long long>(stats.prefetchHits),
+            static_cast<unsigned long long>(stats.demandMisses),
+            static_cast<unsigned long long>(stats.prefetchRequests),
+            static_cast<unsigned long long>(stats.chunksRead),
+            static_cast<unsigned long long>(stats.chunksMissing),
+            static_cast<unsigned long long>(stats.chunksWritten),
+            static_cast<unsigned long long>(stats.readOps),
+            static_cast<unsigned long long>(stats.writeOps));
+        printf("chunk io: read latency p50 %.2fms p90 %.2fms p99 %.2fms, write latency p50 %.2fms p90 %.2fms p99 %.2fms\n",
+            readLatencies.percentile(0.5f), readLatencies.percentile(0.9f), readLatencies.percentile(0.99f),
+            writeLatencies.percentile(0.5f), writeLatencies.percentile(0.9f), writeLatencies.percentile(0.99f));
+    }
+}
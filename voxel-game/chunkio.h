@@ -0,0 +1,35 @@
+#pragma once
+#include "chunk.h"
+#include <string>
+
+//asynchronous chunk persistence. chunks are stored in region files of 8x8x8 chunks with one fixed-size
+//slot per chunk, so x-adjacent chunks are adjacent on disk and can be read or written with a single op.
+//loads and saves are queued during the frame and submitted as one coalesced batch from update(), which
+//never blocks on the disk. on linux builds with VOXEL_USE_IO_URING defined the batch goes through
+//io_uring; otherwise (or if the ring can't be created) it runs on a small I/O thread pool. load ops are
+//submitted in viewer::chunkPriority order so reads for where the camera is heading complete first.
+//chunks that aren't on disk are handed to worldgen, which saves them back once generated.
+namespace chunkio {
+    const int REGION_CHUNKS_PER_SIDE = 8;
+    const int CHUNKS_PER_REGION = REGION_CHUNKS_PER_SIDE * REGION_CHUNKS_PER_SIDE * REGION_CHUNKS_PER_SIDE;
+
+    void init(const std::string& worldDirectory);
+    //submits anything still queued and waits for all outstanding I/O.
+    void shutdown();
+
+    //loads a chunk the renderer wants now, or generates it if it isn't on disk. no-op if it is resident or in flight.
+    void requestLoad(ChunkKey key);
+    //speculative load; counted towards the prefetch hit rate once requestLoad asks for it. returns whether a read
+    //or, for a chunk known to be missing, a generation was queued.
+    bool prefetch(ChunkKey key);
+    void requestSave(ChunkKey key, const PerChunkState& chunk);
+    //worldgen::claimSky, remembered with the world so the chunk is loaded again after a restart.
+    void claimSky(ChunkKey key);
+
+    bool isLoading(ChunkKey key);
+
+    //called once per frame: moves finished loads into perChunkState and submits the queued batch.
+    void update();
+
+    void printStats();
+}
@@ -0,0 +1,294 @@
+#include "clipmap.h"
+#include "heightmap.h"
+#include "jobs.h"
+#include "lod.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+
+static_assert((BLOCKS_PER_SIDE << lod::MAX_LEVEL) % clipmap::FINEST_CELL_BLOCKS == 0, "ring 0's hole has to lie on its cells");
+
+namespace clipmap {
+    namespace {
+        const int RING_VERTICES = RING_CELLS + 1; //per side
+        const float STEEP_SLOPE = 1.f; //blocks up per block across, past which a cell is bare stone
+        const int MAX_PANELS = 3 * BLOCKS_PER_SIDE * BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE + 1); //that the chunk panel index buffer has indices for
+        static_assert(RING_CELLS * RING_CELLS <= MAX_PANELS, "a ring's quads have to fit the chunk panel index buffer");
+
+        //the cells a ring leaves out, in cells of the ring with max exclusive. ring 0 only leaves out the
+        //columns whose heights lie within the height range the voxels are drawn over.
+        struct Hole {
+            ivec2 min = { 0, 0 };
+            ivec2 max = { 0, 0 };
+            float bottom = -FLT_MAX;
+            float top = FLT_MAX;
+
+            bool operator==(const Hole& other) const {
+                return min == other.min && max == other.max && bottom == other.bottom && top == other.top;
+            }
+        };
+
+        struct RingBuild {
+            ivec2 origin;
+            Hole hole;
+            std::vector<float> heights;
+            ChunkMesh mesh;
+            uint64_t sampled = 0;
+        };
+
+        struct Ring {
+            bool built = false;
+            ivec2 origin = { 0, 0 }; //in cells, of the first vertex
+            Hole hole;
+            std::vector<float> heights; //as sampled, before morphing. RING_VERTICES x RING_VERTICES from origin
+            BufferAndPanelCount state;
+            std::future<RingBuild> build; //valid while a rebuild is running
+        };
+
+        struct ClipmapStats {
+            uint64_t rebuilds = 0;
+            uint64_t heightsSampled = 0;
+            uint64_t heightsReused = 0;
+        };
+
+        std::array<Ring, RING_COUNT> rings;
+        std::vector<std::pair<vec4, const BufferAndPanelCount*>> drawn;
+        ClipmapStats stats;
+
+        int cellBlocks(int ring) {
+            return FINEST_CELL_BLOCKS << ring;
+        }
+
+        //snapped to even cells, so the ring's edges lie on the next coarser ring's vertices
+        ivec2 originFor(int ring) {
+            ivec2 cellPairs = ivec2{ glm::floor(vec2{ viewerPosition.x, viewerPosition.z } / (2.f * cellBlocks(ring))) };
+            return cellPairs * 2 - RING_CELLS / 2;
+        }
+
+        Hole holeFor(int ring) {
+            Hole hole;
+            if (ring == 0) {
+                lod::Region region = lod::region(lod::MAX_LEVEL);
+                int chunkBlocks = BLOCKS_PER_SIDE << lod::MAX_LEVEL;
+                hole.min = ivec2{ region.min.x, region.min.z } * (chunkBlocks / FINEST_CELL_BLOCKS);
+                hole.max = ivec2{ region.max.x + 1, region.max.z + 1 } * (chunkBlocks / FINEST_CELL_BLOCKS);
+                hole.bottom = static_cast<float>(region.min.y * chunkBlocks);
+                hole.top = static_cast<float>((region.max.y + 1) * chunkBlocks);
+            }
+            else {
+                //the finer ring covers half as many of this ring's cells per side
+                hole.min = originFor(ring - 1) / 2;
+                hole.max = hole.min + RING_CELLS / 2;
+            }
+            return hole;
+        }
+
+        RingBuild buildRing(int ring, ivec2 origin, Hole hole, ivec2 previousOrigin, std::vector<float> previousHeights) {
+            RingBuild build;
+            build.origin = origin;
+            build.hole = hole;
+            float blocks = static_cast<float>(cellBlocks(ring));
+
+            //only the heights that weren't in the previous window are sampled
+            build.heights.resize(RING_VERTICES * RING_VERTICES);
+            for (int z = 0; z < RING_VERTICES; z++) {
+                for (int x = 0; x < RING_VERTICES; x++) {
+                    ivec2 previous = origin + ivec2{ x, z } - previousOrigin;
+                    if (!previousHeights.empty() && glm::all(glm::greaterThanEqual(previous, ivec2{ 0 })) && glm::all(glm::lessThan(previous, ivec2{ RING_VERTICES }))) {
+                        build.heights[x + RING_VERTICES * z] = previousHeights[previous.x + RING_VERTICES * previous.y];
+                    }
+                    else {
+                        build.heights[x + RING_VERTICES * z] = heightmap::terrainHeight(vec2{ origin + ivec2{ x, z } } * blocks);
+                        build.sampled++;
+                    }
+                }
+            }
+
+            //towards the outer edge, blend into the heights the next coarser ring interpolates between its
+            //vertices, which are the even ones here. its quads are split along the x + 1, z - 1 diagonal.
+            std::vector<float> heights = build.heights;
+            auto sampled = [&](int x, int z) {
+                return build.heights[x + RING_VERTICES * z];
+            };
+            for (int z = 0; z < RING_VERTICES && ring < RING_COUNT - 1; z++) {
+                for (int x = 0; x < RING_VERTICES; x++) {
+                    int edgeDistance = std::min(std::min(x, z), std::min(RING_CELLS - x, RING_CELLS - z));
+                    if (edgeDistance >= MORPH_CELLS) {
+                        continue;
+                    }
+                    bool oddX = x % 2 == 1;
+                    bool oddZ = z % 2 == 1;
+                    float coarse = oddX && oddZ ? (sampled(x - 1, z + 1) + sampled(x + 1, z - 1)) * 0.5f
+                        : oddX ? (sampled(x - 1, z) + sampled(x + 1, z)) * 0.5f
+                        : oddZ ? (sampled(x, z - 1) + sampled(x, z + 1)) * 0.5f
+                        : sampled(x, z);
+                    heights[x + RING_VERTICES * z] = glm::mix(sampled(x, z), coarse, 1.f - static_cast<float>(edgeDistance) / MORPH_CELLS);
+                }
+            }
+
+            auto height = [&](int x, int z) {
+                return heights[glm::clamp(x, 0, RING_CELLS) + RING_VERTICES * glm::clamp(z, 0, RING_CELLS)];
+            };
+            auto isHole = [&](int x, int z) {
+                if (x < 0 || z < 0 || x >= RING_CELLS || z >= RING_CELLS) {
+                    return false;
+                }
+                ivec2 cell = origin + ivec2{ x, z };
+                if (glm::any(glm::lessThan(cell, hole.min)) || glm::any(glm::greaterThanEqual(cell, hole.max))) {
+                    return false;
+                }
+                float low = std::min(std::min(height(x, z), height(x + 1, z)), std::min(height(x, z + 1), height(x + 1, z + 1)));
+                float high = std::max(std::max(height(x, z), height(x + 1, z)), std::max(height(x, z + 1), height(x + 1, z + 1)));
+                return low >= hole.bottom && high < hole.top;
+            };
+            auto normalAt = [&](int x, int z) {
+                vec3 normal = glm::normalize(vec3{ height(x - 1, z) - height(x + 1, z), 2.f * blocks, height(x, z - 1) - height(x, z + 1) });
+                return glm::i8vec3{ normal * 127.f };
+            };
+
+            //positions in cells, heights scaled to match
+            std::vector<ChunkVertexFormat> vertices;
+            vertices.reserve(RING_CELLS * RING_CELLS * 4);
+            ChunkMesh& mesh = build.mesh;
+            mesh.boundsMin = vec3{ FLT_MAX };
+            mesh.boundsMax = vec3{ -FLT_MAX };
+            auto emit = [&](vec3 position, glm::i8vec3 normal, Block material) {
+                vertices.push_back(ChunkVertexFormat(position, normal, material));
+                mesh.boundsMin = glm::min(mesh.boundsMin, position);
+                mesh.boundsMax = glm::max(mesh.boundsMax, position);
+            };
+            auto top = [&](ivec2 corner) {
+                return vec3{ corner.x, height(corner.x, corner.y) / blocks, corner.y };
+            };
+            for (int z = 0; z < RING_CELLS; z++) {
+                for (int x = 0; x < RING_CELLS; x++) {
+                    if (isHole(x, z)) {
+                        continue;
+                    }
+                    float low = std::min(std::min(height(x, z), height(x + 1, z)), std::min(height(x, z + 1), height(x + 1, z + 1)));
+                    float high = std::max(std::max(height(x, z), height(x + 1, z)), std::max(height(x, z + 1), height(x + 1, z + 1)));
+                    Block material = high - low > STEEP_SLOPE * blocks ? STONE : GRASS;
+                    //in the vertex order of a +y block face
+                    emit(top({ x, z }), normalAt(x, z), material);
+                    emit(top({ x, z + 1 }), normalAt(x, z + 1), material);
+                    emit(top({ x + 1, z }), normalAt(x + 1, z), material);
+                    emit(top({ x + 1, z + 1 }), normalAt(x + 1, z + 1), material);
+
+                    //skirts down from the edges next to the hole, facing into it, in the vertex order of block faces
+                    for (int face : { 0, 1, 4, 5 }) {
+                        ivec3 offset = ADJACENT_CHUNK_OFFSETS[face];
+                        if (!isHole(x + offset.x, z + offset.z) || vertices.size() / 4 + RING_CELLS * RING_CELLS >= MAX_PANELS) {
+                            continue;
+                        }
+                        ivec2 first = { x + (face == 1), z + (face == 5) };
+                        ivec2 second = first + (face < 2 ? ivec2{ 0, 1 } : ivec2{ 1, 0 });
+                        vec3 firstTop = top(first);
+                        vec3 secondTop = top(second);
+                        vec3 depth = { 0.f, SKIRT_DEPTH, 0.f };
+                        glm::i8vec3 normal = glm::i8vec3{ offset * 127 };
+                        if (face == 0 || face == 5) {
+                            emit(firstTop - depth, normal, material);
+                            emit(secondTop - depth, normal, material);
+                            emit(firstTop, normal, material);
+                            emit(secondTop, normal, material);
+                        }
+                        else {
+                            emit(firstTop - depth, normal, material);
+                            emit(firstTop, normal, material);
+                            emit(secondTop - depth, normal, material);
+                            emit(secondTop, normal, material);
+                        }
+                    }
+                }
+            }
+
+            mesh.vertexCount = static_cast<uint32_t>(vertices.size());
+            mesh.orientationPanels[3] = mesh.vertexCount / 4; //one run, see ChunkDraw::heightfield
+            if (mesh.vertexCount == 0) {
+                mesh.boundsMin = mesh.boundsMax = vec3{ 0.f };
+            }
+            size_t bytes = vertices.size() * sizeof(ChunkVertexFormat);
+            if (uploadring::reserve(bytes, mesh.staged)) {
+                memcpy(mesh.staged.data, vertices.data(), bytes);
+            }
+            else {
+                mesh.vertices = std::move(vertices);
+            }
+            return build;
+        }
+    }
+
+    void update() {
+        bool changed = false;
+        for (int ring = 0; ring < RING_COUNT; ring++) {
+            Ring& state = rings[ring];
+            if (state.build.valid()) {
+                if (state.build.wait_for(std::chrono::nanoseconds(1)) != std::future_status::ready) {
+                    continue;
+                }
+                RingBuild build = state.build.get();
+                storeChunkMesh(build.mesh, state.state);
+                stats.rebuilds++;
+                stats.heightsSampled += build.sampled;
+                stats.heightsReused += RING_VERTICES * RING_VERTICES - build.sampled;
+                state.origin = build.origin;
+                state.hole = build.hole;
+                state.heights = std::move(build.heights);
+                state.built = true;
+                changed = true;
+            }
+
+            ivec2 origin = originFor(ring);
+            Hole hole = holeFor(ring);
+            if (state.built && origin == state.origin && hole == state.hole) {
+                continue;
+            }
+            auto building = std::make_shared<std::packaged_task<RingBuild()>>(
+                std::bind(&buildRing, ring, origin, hole, state.origin, state.heights)
+            );
+            state.build = building->get_future();
+            workerPool().submit([building]() { (*building)(); });
+        }
+
+        if (changed) {
+            drawn.clear();
+            for (int ring = 0; ring < RING_COUNT; ring++) {
+                if (rings[ring].built && rings[ring].state.mesh != gpumem::NO_MESH) {
+                    float blocks = static_cast<float>(cellBlocks(ring));
+                    vec2 origin = vec2{ rings[ring].origin } * blocks;
+                    drawn.push_back({ vec4{ origin.x, 0.f, origin.y, blocks }, &rings[ring].state });
+                }
+            }
+            drawableChunksVersion++;
+        }
+    }
+
+    bool isSettled() {
+        for (int ring = 0; ring < RING_COUNT; ring++) {
+            if (!rings[ring].built || rings[ring].build.valid() || rings[ring].origin != originFor(ring) || !(rings[ring].hole == holeFor(ring))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const std::vector<std::pair<vec4, const BufferAndPanelCount*>>& drawnRings() {
+        return drawn;
+    }
+
+    void printStats() {
+        uint64_t panels = 0;
+        uint64_t bytes = 0;
+        for (auto& ring : rings) {
+            panels += ring.state.vertexCount / 6;
+            bytes += gpumem::allocatedBytes(ring.state.mesh);
+        }
+        printf("clipmap: %d rings out to %d blocks, %llu quads (%.1fMB), %llu rebuilds, %llu heights sampled, %llu reused\n",
+            RING_COUNT, RING_CELLS / 2 * cellBlocks(RING_COUNT - 1), static_cast<unsigned long long>(panels), bytes / (1024.0 * 1024.0),
+            static_cast<unsigned long long>(stats.rebuilds), static_cast<unsigned long long>(stats.heightsSampled),
+            static_cast<unsigned long long>(stats.heightsReused));
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "chunk.h"
+
+//far terrain past the level of detail rings, drawn straight from heightmap::terrainHeight as nested
+//square rings of quads. ring k has RING_CELLS x RING_CELLS cells of FINEST_CELL_BLOCKS << k blocks, is
+//snapped to every other of its cells around the viewer and leaves out the footprint of ring k - 1, so each
+//ring's inner edge lies on vertices of the next finer ring. ring 0 leaves out the columns the coarsest
+//voxel ring draws. towards its outer edge a ring's heights morph into the next coarser ring's, so the
+//seams match exactly, and the inner edges hang skirts down to hide any gap to the voxels.
+//a ring is rebuilt on a worker whenever its snapped position or hole moves, sampling only the heights
+//that weren't in its previous window.
+namespace clipmap {
+    const int RING_COUNT = 5;
+    const int RING_CELLS = 64;
+    const int FINEST_CELL_BLOCKS = 16;
+    const int MORPH_CELLS = 8;
+    const float SKIRT_DEPTH = 2.f; //in cells of the ring
+
+    //once per frame after lod::update.
+    void update();
+    //every ring is built for where the viewer is.
+    bool isSettled();
+
+    //the rings with a mesh, with their origin (first vertex, and blocks per cell in w) as for lod::chunkOrigin.
+    const std::vector<std::pair<vec4, const BufferAndPanelCount*>>& drawnRings();
+
+    void printStats();
+}
@@ -0,0 +1,141 @@
+#include "connectivity.h"
+#include <algorithm>
+#include <bitset>
+#include <deque>
+
+namespace connectivity {
+    namespace {
+        ChunkKey searchStart = { 0, 0, 0 };
+        ChunkKey searchMin = { 0, 0, 0 };
+        ChunkKey searchMax = { 0, 0, 0 };
+        bool searched = false;
+        std::unordered_map<ChunkKey, uint8_t> enteredFaces; //faces each reached chunk was entered by
+
+        //the faces of the chunk a block lies on
+        uint8_t facesTouched(ivec3 coords) {
+            uint8_t faces = 0;
+            for (int axis = 0; axis < 3; axis++) {
+                if (coords[axis] == 0) {
+                    faces |= 1 << (axis * 2);
+                }
+                if (coords[axis] == BLOCKS_PER_SIDE - 1) {
+                    faces |= 1 << (axis * 2 + 1);
+                }
+            }
+            return faces;
+        }
+
+        FaceConnections connectionsOf(ChunkKey key) {
+            auto iter = chunkGLBuffers.find(key);
+            return iter == chunkGLBuffers.end() ? ALL_FACES_CONNECTED : iter->second.faceConnections;
+        }
+
+        int oppositeFace(int face) {
+            return face ^ 1;
+        }
+    }
+
+    FaceConnections findFaceConnections(const BlockList& blocks) {
+        FaceConnections connections = {};
+        std::bitset<VOLUME> visited;
+        std::vector<int> stack;
+        stack.reserve(VOLUME);
+        for (int start = 0; start < VOLUME; start++) {
+            if (blocks[start] != AIR || visited[start]) {
+                continue;
+            }
+            //one pocket of air; every face it touches sees every other face it touches
+            uint8_t faces = 0;
+            visited[start] = true;
+            stack.push_back(start);
+            while (!stack.empty()) {
+                int index = stack.back();
+                stack.pop_back();
+                ivec3 coords = { index % BLOCKS_PER_SIDE, index / BLOCKS_PER_SIDE % BLOCKS_PER_SIDE, index / (BLOCKS_PER_SIDE * BLOCKS_PER_SIDE) };
+                faces |= facesTouched(coords);
+                for (auto& offset : ADJACENT_CHUNK_OFFSETS) {
+                    ivec3 next = coords + offset;
+                    if (glm::any(glm::lessThan(next, ivec3{ 0 })) || glm::any(glm::greaterThanEqual(next, ivec3{ BLOCKS_PER_SIDE }))) {
+                        continue;
+                    }
+                    int nextIndex = getChunkIndex(next);
+                    if (blocks[nextIndex] == AIR && !visited[nextIndex]) {
+                        visited[nextIndex] = true;
+                        stack.push_back(nextIndex);
+                    }
+                }
+            }
+            for (int face = 0; face < 6; face++) {
+                if (faces & (1 << face)) {
+                    connections[face] |= faces;
+                }
+            }
+        }
+        return connections;
+    }
+
+    ChunkKey chunkContaining(vec3 position) {
+        return ChunkKey{ glm::floor(position / static_cast<float>(BLOCKS_PER_SIDE)) };
+    }
+
+    void update(ChunkKey viewerChunk, ChunkKey regionMin, ChunkKey regionMax) {
+        searchStart = viewerChunk;
+        searchMin = regionMin;
+        searchMax = regionMax;
+        searched = true;
+        std::unordered_map<ChunkKey, uint8_t> previouslyEntered;
+        previouslyEntered.swap(enteredFaces);
+
+        struct Step {
+            ChunkKey key;
+            int enteredBy; //-1 for the viewer's chunk, which can be left through any face
+        };
+        std::deque<Step> queue;
+        enteredFaces[viewerChunk] = 0;
+        queue.push_back({ viewerChunk, -1 });
+        while (!queue.empty()) {
+            Step step = queue.front();
+            queue.pop_front();
+            FaceConnections connections = connectionsOf(step.key);
+            for (int face = 0; face < 6; face++) {
+                if (step.enteredBy >= 0 && !(connections[step.enteredBy] & (1 << face))) {
+                    continue;
+                }
+                ivec3 offset = ADJACENT_CHUNK_OFFSETS[face];
+                ChunkKey next = step.key + offset;
+                int axis = face / 2;
+                //only ever move away from the viewer, which also keeps the search from going in circles
+                if ((next[axis] - viewerChunk[axis]) * offset[axis] <= 0) {
+                    continue;
+                }
+                if (glm::any(glm::lessThan(next, regionMin)) || glm::any(glm::greaterThan(next, regionMax))) {
+                    continue;
+                }
+                //a chunk can be entered once through each face, as each may lead out through different faces
+                int enteredBy = oppositeFace(face);
+                uint8_t& entered = enteredFaces[next];
+                if (entered & (1 << enteredBy)) {
+                    continue;
+                }
+                entered |= 1 << enteredBy;
+                queue.push_back({ next, enteredBy });
+            }
+        }
+
+        bool sameChunks = enteredFaces.size() == previouslyEntered.size() && std::all_of(enteredFaces.begin(), enteredFaces.end(),
+            [&](const std::pair<const ChunkKey, uint8_t>& entry) { return previouslyEntered.count(entry.first) != 0; });
+        if (!sameChunks) {
+            drawableChunksVersion++;
+        }
+    }
+
+    void followViewer(ChunkKey viewerChunk) {
+        if (searched && viewerChunk != searchStart) {
+            update(viewerChunk, searchMin, searchMax);
+        }
+    }
+
+    bool isVisible(ChunkKey key) {
+        return !searched || enteredFaces.find(key) != enteredFaces.end();
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "chunk.h"
+
+//cave culling. every meshed chunk records which of its faces see each other through air, and the chunks
+//that can be visible are found with a breadth-first search from the viewer's chunk that only moves away
+//from the viewer and only leaves a chunk through a face connected to the one it came in by. chunks whose
+//connections aren't known (not meshed yet, or sky that is never allocated) let everything through.
+namespace connectivity {
+    //flood fills the air in the chunk.
+    FaceConnections findFaceConnections(const BlockList& blocks);
+
+    ChunkKey chunkContaining(vec3 position);
+
+    //searches the chunks from regionMin to regionMax, starting from viewerChunk.
+    void update(ChunkKey viewerChunk, ChunkKey regionMin, ChunkKey regionMax);
+    //searches again from viewerChunk if the viewer has moved into another chunk since the last search.
+    void followViewer(ChunkKey viewerChunk);
+    bool isVisible(ChunkKey key);
+}
@@ -0,0 +1,225 @@
+#include "density.h"
+#include "heightmap.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "glm/gtc/noise.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define DENSITY_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace density {
+    namespace {
+        //decorrelates the three noises, which would otherwise all be the same field at different scales
+        const vec3 OVERHANG_SEED = { 0.f, 0.f, 0.f };
+        const vec3 CAVE_A_SEED = { 311.7f, 57.3f, 113.1f };
+        const vec3 CAVE_B_SEED = { -97.9f, 431.3f, 19.7f };
+
+        int latticeIndex(int x, int y, int z) {
+            return x + LATTICE_POINTS * (y + LATTICE_POINTS * z);
+        }
+
+        vec3 chunkOrigin(ChunkKey key) {
+            return vec3{ key.x, key.y, key.z } * static_cast<float>(BLOCKS_PER_SIDE);
+        }
+
+        //trilinear interpolation is a convex combination, so the lattice bounds every upsampled value
+        void latticeRange(const Lattice& lattice, float& low, float& high) {
+            auto range = std::minmax_element(lattice.begin(), lattice.end());
+            low = *range.first;
+            high = *range.second;
+        }
+
+        float minSquare(float low, float high) {
+            if (low <= 0.f && high >= 0.f) {
+                return 0.f;
+            }
+            return std::min(low * low, high * high);
+        }
+
+        bool isCave(float caveA, float caveB) {
+            return caveA * caveA + caveB * caveB < CAVE_RADIUS * CAVE_RADIUS;
+        }
+    }
+
+    bool isAboveTerrain(ChunkKey key) {
+        return key.y * BLOCKS_PER_SIDE >= heightmap::column({ key.x, key.z }).maxSurface + static_cast<int>(ceilf(OVERHANG_AMPLITUDE));
+    }
+
+    void sampleLattice(ChunkKey key, float frequency, vec3 seedOffset, Lattice& lattice) {
+        vec3 origin = chunkOrigin(key);
+        for (int z = 0; z < LATTICE_POINTS; z++) {
+            for (int y = 0; y < LATTICE_POINTS; y++) {
+                for (int x = 0; x < LATTICE_POINTS; x++) {
+                    vec3 blockPosition = origin + vec3{ x, y, z } * static_cast<float>(LATTICE_SPACING);
+                    lattice[latticeIndex(x, y, z)] = glm::perlin(blockPosition * frequency + seedOffset);
+                }
+            }
+        }
+    }
+
+    void upsampleLattice(const Lattice& lattice, Field& field) {
+        const float step = 1.f / LATTICE_SPACING;
+        for (int z = 0; z < BLOCKS_PER_SIDE; z++) {
+            int cellZ = z / LATTICE_SPACING;
+            float tz = (z % LATTICE_SPACING) * step;
+            for (int y = 0; y < BLOCKS_PER_SIDE; y++) {
+                int cellY = y / LATTICE_SPACING;
+                float ty = (y % LATTICE_SPACING) * step;
+                const float* row00 = &lattice[latticeIndex(0, cellY, cellZ)];
+                const float* row10 = &lattice[latticeIndex(0, cellY + 1, cellZ)];
+                const float* row01 = &lattice[latticeIndex(0, cellY, cellZ + 1)];
+                const float* row11 = &lattice[latticeIndex(0, cellY + 1, cellZ + 1)];
+                float* out = &field[getChunkIndex({ 0, y, z })];
+
+                //collapse y and z first, leaving one row of lattice values along x
+                float row[LATTICE_POINTS];
+                float w00 = (1.f - ty) * (1.f - tz);
+                float w10 = ty * (1.f - tz);
+                float w01 = (1.f - ty) * tz;
+                float w11 = ty * tz;
+#ifdef DENSITY_USE_SSE
+                static_assert(LATTICE_POINTS == 5, "the SSE path collapses four lattice columns plus one scalar");
+                __m128 collapsed = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(row00), _mm_set1_ps(w00)), _mm_mul_ps(_mm_loadu_ps(row10), _mm_set1_ps(w10))),
+                    _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(row01), _mm_set1_ps(w01)), _mm_mul_ps(_mm_loadu_ps(row11), _mm_set1_ps(w11)))
+                );
+                _mm_storeu_ps(row, collapsed);
+                row[4] = row00[4] * w00 + row10[4] * w10 + row01[4] * w01 + row11[4] * w11;
+
+                //each lattice cell along x covers four blocks: start + (end - start) * (0, 1/4, 2/4, 3/4)
+                const __m128 blockOffsets = _mm_set_ps(3.f * step, 2.f * step, step, 0.f);
+                for (int cellX = 0; cellX < LATTICE_POINTS - 1; cellX++) {
+                    __m128 start = _mm_set1_ps(row[cellX]);
+                    __m128 delta = _mm_set1_ps(row[cellX + 1] - row[cellX]);
+                    _mm_storeu_ps(out + cellX * LATTICE_SPACING, _mm_add_ps(start, _mm_mul_ps(delta, blockOffsets)));
+                }
+#else
+                for (int x = 0; x < LATTICE_POINTS; x++) {
+                    row[x] = row00[x] * w00 + row10[x] * w10 + row01[x] * w01 + row11[x] * w11;
+                }
+                for (int x = 0; x < BLOCKS_PER_SIDE; x++) {
+                    int cellX = x / LATTICE_SPACING;
+                    float tx = (x % LATTICE_SPACING) * step;
+                    out[x] = row[cellX] + (row[cellX + 1] - row[cellX]) * tx;
+                }
+#endif
+            }
+        }
+    }
+
+    void generateChunk(ChunkKey key, PerChunkState& chunk) {
+        const ColumnHeights& heights = heightmap::column({ key.x, key.z });
+        int baseY = key.y * BLOCKS_PER_SIDE;
+        if (isAboveTerrain(key)) {
+            chunk.blocks.fill(0);
+            return;
+        }
+
+        Lattice overhangLattice, caveALattice, caveBLattice;
+        sampleLattice(key, OVERHANG_FREQUENCY, OVERHANG_SEED, overhangLattice);
+        sampleLattice(key, CAVE_FREQUENCY, CAVE_A_SEED, caveALattice);
+        sampleLattice(key, CAVE_FREQUENCY, CAVE_B_SEED, caveBLattice);
+
+        float overhangLow, overhangHigh, caveALow, caveAHigh, caveBLow, caveBHigh;
+        latticeRange(overhangLattice, overhangLow, overhangHigh);
+        latticeRange(caveALattice, caveALow, caveAHigh);
+        latticeRange(caveBLattice, caveBLow, caveBHigh);
+        overhangLow *= OVERHANG_AMPLITUDE;
+        overhangHigh *= OVERHANG_AMPLITUDE;
+        bool hasCaves = minSquare(caveALow, caveAHigh) + minSquare(caveBLow, caveBHigh) < CAVE_RADIUS * CAVE_RADIUS;
+
+        if (baseY >= heights.maxSurface + overhangHigh) {
+            chunk.blocks.fill(0);
+            return;
+        }
+        if (!hasCaves && baseY + BLOCKS_PER_SIDE <= heights.minSurface + overhangLow) {
+            chunk.blocks.fill(1);
+            return;
+        }
+
+        Field overhang, caveA, caveB;
+        upsampleLattice(overhangLattice, overhang);
+        if (hasCaves) {
+            upsampleLattice(caveALattice, caveA);
+            upsampleLattice(caveBLattice, caveB);
+        }
+
+        //x rows clear of every surface in them (after the largest possible overhang) are filled in one go
+        for (int z = 0; z < BLOCKS_PER_SIDE; z++) {
+            for (int y = 0; y < BLOCKS_PER_SIDE; y++) {
+                int index = getChunkIndex({ 0, y, z });
+                Block* row = &chunk.blocks[index];
+                int worldY = baseY + y;
+                if (worldY >= heights.rowMaxSurface[z] + overhangHigh) {
+                    std::fill(row, row + BLOCKS_PER_SIDE, Block(0));
+                    continue;
+                }
+                if (!hasCaves && worldY < heights.rowMinSurface[z] + overhangLow) {
+                    std::fill(row, row + BLOCKS_PER_SIDE, Block(1));
+                    continue;
+                }
+                for (int x = 0; x < BLOCKS_PER_SIDE; x++) {
+                    float density = (heights.surface[x + BLOCKS_PER_SIDE * z] - worldY) + OVERHANG_AMPLITUDE * overhang[index + x];
+                    row[x] = density > 0.f && !(hasCaves && isCave(caveA[index + x], caveB[index + x]));
+                }
+            }
+        }
+    }
+
+    void generateChunkFullResolution(ChunkKey key, PerChunkState& chunk) {
+        const ColumnHeights& heights = heightmap::column({ key.x, key.z });
+        vec3 origin = chunkOrigin(key);
+        static3DLoop<0, 0, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE>([&](ivec3 coords) {
+            vec3 blockPosition = origin + vec3{ coords.x, coords.y, coords.z };
+            float overhang = glm::perlin(blockPosition * OVERHANG_FREQUENCY + OVERHANG_SEED);
+            float caveA = glm::perlin(blockPosition * CAVE_FREQUENCY + CAVE_A_SEED);
+            float caveB = glm::perlin(blockPosition * CAVE_FREQUENCY + CAVE_B_SEED);
+            float density = (heights.surface[coords.x + BLOCKS_PER_SIDE * coords.z] - blockPosition.y) + OVERHANG_AMPLITUDE * overhang;
+            chunk.blocks[getChunkIndex(coords)] = density > 0.f && !isCave(caveA, caveB);
+        });
+    }
+
+    void benchmark(int chunkCount) {
+        //chunks crossing the surface, which is where generation can't take a shortcut
+        std::vector<ChunkKey> keys;
+        for (int columnIndex = 0; static_cast<int>(keys.size()) < chunkCount; columnIndex++) {
+            ivec2 columnKey = { columnIndex % 32, columnIndex / 32 };
+            const ColumnHeights& heights = heightmap::column(columnKey);
+            int lowestChunk = static_cast<int>(floorf((heights.minSurface - OVERHANG_AMPLITUDE) / BLOCKS_PER_SIDE)) - 1;
+            int highestChunk = static_cast<int>(floorf((heights.maxSurface + OVERHANG_AMPLITUDE) / BLOCKS_PER_SIDE));
+            for (int y = lowestChunk; y <= highestChunk && static_cast<int>(keys.size()) < chunkCount; y++) {
+                keys.push_back({ columnKey.x, y, columnKey.y });
+            }
+        }
+
+        std::vector<PerChunkState> latticeChunks(keys.size());
+        std::vector<PerChunkState> fullChunks(keys.size());
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < keys.size(); i++) {
+            generateChunk(keys[i], latticeChunks[i]);
+        }
+        auto latticeDone = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < keys.size(); i++) {
+            generateChunkFullResolution(keys[i], fullChunks[i]);
+        }
+        auto fullDone = std::chrono::steady_clock::now();
+
+        uint64_t differingBlocks = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            for (int j = 0; j < VOLUME; j++) {
+                differingBlocks += latticeChunks[i].blocks[j] != fullChunks[i].blocks[j];
+            }
+        }
+
+        double latticeMicroseconds = std::chrono::duration<double, std::micro>(latticeDone - start).count() / keys.size();
+        double fullMicroseconds = std::chrono::duration<double, std::micro>(fullDone - latticeDone).count() / keys.size();
+        printf("density: %zu chunks, lattice %.1fus/chunk, full resolution %.1fus/chunk (%.1fx), %.2f%% of blocks differ\n",
+            keys.size(), latticeMicroseconds, fullMicroseconds, fullMicroseconds / latticeMicroseconds,
+            100.0 * differingBlocks / (static_cast<double>(keys.size()) * VOLUME));
+    }
+}
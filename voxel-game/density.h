@@ -0,0 +1,35 @@
+#pragma once
+#include "chunk.h"
+
+//3D terrain. a block is solid when
+//  (surface height - y) + OVERHANG_AMPLITUDE * overhangNoise > 0
+//and it isn't inside a cave tube, where two cave noises are both close to zero. the 3D noises are
+//only evaluated on a lattice every LATTICE_SPACING blocks (5^3 points per chunk instead of 16^3) and
+//trilinearly upsampled, while the surface height comes from the per-column heightmap cache.
+namespace density {
+    const int LATTICE_SPACING = 4;
+    const int LATTICE_POINTS = BLOCKS_PER_SIDE / LATTICE_SPACING + 1;
+    const int LATTICE_VOLUME = LATTICE_POINTS * LATTICE_POINTS * LATTICE_POINTS;
+
+    const float OVERHANG_AMPLITUDE = 6.f; //blocks the surface can be pushed up or down
+    const float OVERHANG_FREQUENCY = 0.05f;
+    const float CAVE_FREQUENCY = 0.03f;
+    const float CAVE_RADIUS = 0.1f;
+
+    typedef std::array<float, LATTICE_VOLUME> Lattice;
+    typedef std::array<float, VOLUME> Field;
+
+    //conservative: true only if no overhang can reach into the chunk.
+    bool isAboveTerrain(ChunkKey key);
+
+    void sampleLattice(ChunkKey key, float frequency, vec3 seedOffset, Lattice& lattice);
+    //trilinear upsampling to one value per block, four blocks of a row at a time.
+    void upsampleLattice(const Lattice& lattice, Field& field);
+
+    void generateChunk(ChunkKey key, PerChunkState& chunk);
+    //reference implementation evaluating every noise at every block.
+    void generateChunkFullResolution(ChunkKey key, PerChunkState& chunk);
+
+    //times both generators over chunks that cross the surface and prints the per-chunk cost.
+    void benchmark(int chunkCount);
+}
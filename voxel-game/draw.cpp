@@ -1,4 +1,11 @@
 #include "draw.h"
+#include "clipmap.h"
+#include "connectivity.h"
+#include "frustum.h"
+#include "light.h"
+#include "lod.h"
+#include "occlusion.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
@@ -10,20 +17,79 @@ namespace matrix {
 }
 
 namespace program {
-	GLuint chunk;
-	GLuint chunk2;
+	render::ProgramId chunk;
+	render::ProgramId chunk2;
+	render::ProgramId depth;
 }
 
 namespace fbo {
 }
 
-namespace vao {
-	GLuint chunk;
+namespace vbo {
+	render::BufferId chunkPanel;
+	render::BufferId chunkPanelIndex;
+	render::BufferId chunkDrawCommands;
+	render::BufferId chunkOrigins;
 }
 
-namespace vbo {
-	GLuint chunkPanel;
-	GLuint chunkPanelIndex;
+bool useMultiDrawIndirect = true;
+bool useOcclusionCulling = true;
+bool useShadows = true;
+vec3 sunDirection = glm::normalize(vec3{ 1.f, 2.f, 3.f });
+DrawStats drawStats;
+
+struct ChunkDraw {
+	vec4 origin; //world space, with the mesh's blocks per block in w
+	gpumem::MeshHandle mesh;
+	gpumem::MeshLocation location; //looked up each frame, as compaction moves meshes
+	vec3 boundsMin; //world space
+	vec3 boundsMax;
+	std::array<uint32_t, 6> orientationPanels;
+	bool heightfield; //sloped panels in one run, which is never skipped as back-facing
+};
+
+struct OccluderChunk {
+	vec3 origin;
+	const std::vector<OccluderQuad>* occluders;
+};
+
+//resident chunks that should be drawn, front to back from the viewer. rebuilt only when
+//drawableChunksVersion changes or the viewer moves into another chunk, so a frame only walks these.
+namespace drawList {
+	std::vector<ChunkDraw> chunks; //with a mesh and reachable through the connectivity graph
+	//every chunk with a mesh, reachable or not, since terrain the viewer can't see still shadows what it can
+	std::vector<ChunkDraw> casters;
+	BoxList casterBounds;
+	std::vector<OccluderChunk> occluders; //any chunk with occluders, including solid ones without a mesh
+	unsigned int unreachable = 0;
+	uint64_t version = 0;
+	ChunkKey viewerChunk;
+}
+
+//cascaded shadow maps of the sun. each cascade covers a sphere of fixed radius around the viewer rather than a
+//slice of the view frustum, so what it holds doesn't change as the viewer turns. the nearest cascade is rendered
+//every frame. the others are kept until they move a whole step, the sun moves or a mesh inside them changes,
+//as they're large and change little. cascades move in whole texels in light space so shadow edges don't
+//shimmer. the casters are drawList::casters, drawn like the chunk pass with just the depth program.
+namespace shadow {
+	const int CASCADES = 3; //shadowMatrices in chunk.frag
+	const int MAP_SIZE = 1024;
+	const std::array<float, CASCADES> RADII = { 32.f, 128.f, 512.f };
+	//maps reach past their radius, so a cached cascade still covers it until the viewer has moved a step
+	const float EXTENT_PER_RADIUS = 1.25f;
+	const float CACHED_STEP_TEXELS = 64.f;
+	const float CASTER_REACH = 512.f; //above a cascade's radius, towards the sun
+
+	struct Cascade {
+		mat4 lightViewProjection = mat4(1.f); //it was rendered with
+		vec3 center = vec3(0.f); //in light space
+		uint64_t contents = 0; //of the meshes it was rendered with
+		bool rendered = false;
+	};
+
+	render::TextureId maps = render::NO_TEXTURE;
+	std::array<Cascade, CASCADES> cascades;
+	vec3 renderedSun = vec3(0.f);
 }
 
 std::vector<uint32_t> chunkIndexBufferDataSource;
@@ -40,62 +106,19 @@ std::string getTextFile(std::string fileName) {
 	}
 }
 
-GLuint makeShaderFromString(std::string shaderString, GLuint shaderType) {
-	GLuint shader = glCreateShader(shaderType);
-
-	const char* source = shaderString.c_str();
-	glShaderSource(shader, 1, &source, nullptr);
-	glCompileShader(shader);
-
-	GLint success;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-	if (!success) {
-		char infoLog[512];
-		glGetShaderInfoLog(shader, 512, NULL, infoLog);
-		std::cout << "shader compile error: \n" << infoLog << std::endl;
-	}
-	return shader;
-}
-
-GLuint makeShaderProgramFromStrings(std::string vertexShaderString, std::string fragmentShaderString) {
-	GLuint vertexShader = makeShaderFromString(vertexShaderString, GL_VERTEX_SHADER);
-	GLuint fragmentShader = makeShaderFromString(fragmentShaderString, GL_FRAGMENT_SHADER);
-
-	GLuint shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
-	glLinkProgram(shaderProgram);
-
-	GLint success;
-	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-	if (!success) {
-		char infoLog[512];
-		glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-		std::cout << "program linking failed:\n" << infoLog << std::endl;
-	}
-
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
-
-	return shaderProgram;
-}
-
-GLuint makeShaderProgramFromFiles(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
+render::ProgramId makeShaderProgramFromFiles(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
 	std::string vertexShaderString = getTextFile(vertexShaderFileName);
 	std::string fragmentShaderString = getTextFile(fragmentShaderFileName);
-	return makeShaderProgramFromStrings(vertexShaderString, fragmentShaderString);
+	return render::device().createProgram(vertexShaderString, fragmentShaderString);
 }
 
 void drawSetup() {
 	program::chunk = makeShaderProgramFromFiles("shader/chunk.vert", "shader/chunk.frag");
 	program::chunk2 = makeShaderProgramFromFiles("shader/chunk2.vert", "shader/chunk.frag");
+	program::depth = makeShaderProgramFromFiles("shader/chunk2.vert", "shader/depth.frag");
+	shadow::maps = render::device().createShadowMaps(shadow::MAP_SIZE, shadow::CASCADES);
 
-	glGenVertexArrays(1, &vao::chunk);
-	glBindVertexArray(vao::chunk);
-
-	glGenBuffers(1, &vbo::chunkPanel);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo::chunkPanel);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(CHUNK_PANEL_VERTS), CHUNK_PANEL_VERTS.data(), GL_STATIC_DRAW);
+	vbo::chunkPanel = render::device().createBuffer(sizeof(CHUNK_PANEL_VERTS), CHUNK_PANEL_VERTS.data());
 
 	chunkIndexBufferDataSource.reserve(3 * BLOCKS_PER_SIDE * BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE+1) * 6);
 	for (int i = 0; i < 3 * BLOCKS_PER_SIDE * BLOCKS_PER_SIDE * (BLOCKS_PER_SIDE + 1) * 6; i += 6) {
@@ -107,52 +130,369 @@ void drawSetup() {
 		chunkIndexBufferDataSource.push_back(3 + i / 6 * 4);
 	}
 
-	glGenBuffers(1, &vbo::chunkPanelIndex);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo::chunkPanelIndex);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, chunkIndexBufferDataSource.size() * sizeof(uint32_t), chunkIndexBufferDataSource.data(), GL_STATIC_DRAW);
+	vbo::chunkPanelIndex = render::device().createBuffer(chunkIndexBufferDataSource.size() * sizeof(uint32_t), chunkIndexBufferDataSource.data());
+	vbo::chunkDrawCommands = render::device().createBuffer(0, nullptr);
+	vbo::chunkOrigins = render::device().createBuffer(0, nullptr);
 }
 
-void drawFrame() {
-	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+vec4 chunkOrigin(ChunkKey posAndLOD) {
+	return vec4{ vec3{ posAndLOD } * static_cast<float>(BLOCKS_PER_SIDE), 1.f };
+}
 
-	//========================= DRAW CHUNKS =============================
-	glBindVertexArray(vao::chunk);
+//calls drawRange(firstPanel, panelCount) for the runs of a chunk's panels that can face the camera, merging
+//neighbouring runs. a face is back-facing when the camera is behind its plane, so e.g. no -y face is
+//visible from above the highest -y face plane, which is at most one (scaled) block below the top of the mesh.
+template <typename RangeSink>
+void forEachFrontFacingRange(const ChunkDraw& chunkDraw, vec3 camera, RangeSink&& drawRange) {
+	uint32_t firstPanel = 0;
+	uint32_t panelCount = 0;
+	uint32_t panel = 0;
+	for (int orientation = 0; orientation < 6; orientation++) {
+		int axis = orientation / 2;
+		bool frontFacing = chunkDraw.heightfield || (orientation % 2 == 0
+			? camera[axis] < chunkDraw.boundsMax[axis] - chunkDraw.origin.w
+			: camera[axis] > chunkDraw.boundsMin[axis] + chunkDraw.origin.w);
+		uint32_t panels = chunkDraw.orientationPanels[orientation];
+		if (frontFacing && panels > 0) {
+			if (panelCount == 0) {
+				firstPanel = panel;
+			}
+			panelCount += panels;
+		}
+		else if (!frontFacing) {
+			drawStats.backFacingPanels += panels;
+			if (panelCount > 0) {
+				drawRange(firstPanel, panelCount);
+				panelCount = 0;
+			}
+		}
+		panel += panels;
+	}
+	if (panelCount > 0) {
+		drawRange(firstPanel, panelCount);
+	}
+}
+
+//one multi-draw per arena. the chunk origin is an instanced attribute read from chunkOrigins at each
+//command's baseInstance, which is the index of the command's chunk.
+void drawChunksIndirect(const std::vector<ChunkDraw>& chunkDraws, vec3 camera) {
+	std::vector<render::DrawIndirectCommand> commands;
+	std::vector<size_t> arenaFirstChunks; //where each arena's chunks, and commands, start
+	std::vector<size_t> arenaFirstCommands;
+	std::vector<vec4> origins;
+	commands.reserve(chunkDraws.size() * 3);
+	origins.reserve(chunkDraws.size());
+	for (size_t i = 0; i < chunkDraws.size(); i++) {
+		auto& chunkDraw = chunkDraws[i];
+		if (i == 0 || chunkDraw.location.arena != chunkDraws[i - 1].location.arena) {
+			arenaFirstChunks.push_back(i);
+			arenaFirstCommands.push_back(commands.size());
+		}
+		uint32_t chunkIndex = static_cast<uint32_t>(origins.size());
+		forEachFrontFacingRange(chunkDraw, camera, [&](uint32_t firstPanel, uint32_t panelCount) {
+			commands.push_back({ panelCount * 6, 1, 0, chunkDraw.location.baseVertex + static_cast<int32_t>(firstPanel * 4), chunkIndex });
+			drawStats.panels += panelCount;
+		});
+		origins.push_back(chunkDraw.origin);
+	}
+	arenaFirstCommands.push_back(commands.size());
+
+	render::Device& device = render::device();
+	device.setBufferData(vbo::chunkDrawCommands, commands.size() * sizeof(render::DrawIndirectCommand), commands.data());
+	device.setBufferData(vbo::chunkOrigins, origins.size() * sizeof(vec4), origins.data());
+	device.setChunkOriginBuffer(vbo::chunkOrigins);
+
+	for (size_t i = 0; i < arenaFirstChunks.size(); i++) {
+		size_t first = arenaFirstCommands[i];
+		size_t last = arenaFirstCommands[i + 1];
+		if (last == first) {
+			continue;
+		}
+		device.setChunkVertexBuffer(chunkDraws[arenaFirstChunks[i]].location.buffer);
+		device.multiDrawIndexedIndirect(vbo::chunkDrawCommands, first, last - first);
+		drawStats.drawCalls++;
+	}
+}
 
-	glUseProgram(program::chunk2);
+//one draw per front-facing run of each chunk, with the origin set once per chunk.
+void drawChunksDirect(const std::vector<ChunkDraw>& chunkDraws, vec3 camera) {
+	render::Device& device = render::device();
+	int boundArena = -1;
+	for (auto& chunkDraw : chunkDraws) {
+		//draws are grouped by arena, so each is bound once
+		if (chunkDraw.location.arena != boundArena) {
+			boundArena = chunkDraw.location.arena;
+			device.setChunkVertexBuffer(chunkDraw.location.buffer);
+		}
+		device.setChunkOrigin(chunkDraw.origin);
+		forEachFrontFacingRange(chunkDraw, camera, [&](uint32_t firstPanel, uint32_t panelCount) {
+			device.drawIndexed(panelCount * 6, chunkDraw.location.baseVertex + static_cast<int32_t>(firstPanel * 4));
+			drawStats.drawCalls++;
+			drawStats.panels += panelCount;
+		});
+	}
+}
+
+//binds each draw's mesh location and groups the draws by arena, see drawFrame.
+void locateChunkDraws(std::vector<ChunkDraw>& chunkDraws) {
+	for (auto& chunkDraw : chunkDraws) {
+		chunkDraw.location = gpumem::location(chunkDraw.mesh);
+	}
+	std::stable_sort(chunkDraws.begin(), chunkDraws.end(), [](const ChunkDraw& a, const ChunkDraw& b) {
+		return a.location.arena < b.location.arena;
+	});
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo::chunkPanelIndex);
+void drawChunks(const std::vector<ChunkDraw>& chunkDraws, vec3 camera) {
+	if (!chunkDraws.empty() && useMultiDrawIndirect) {
+		drawChunksIndirect(chunkDraws, camera);
+	}
+	else if (!chunkDraws.empty()) {
+		drawChunksDirect(chunkDraws, camera);
+	}
+}
+
+namespace shadow {
+	mat4 lightView(vec3 sun) {
+		vec3 up = abs(sun.y) > 0.99f ? vec3{ 1.f, 0.f, 0.f } : vec3{ 0.f, 1.f, 0.f };
+		return glm::lookAt(vec3(0.f), -sun, up);
+	}
+
+	uint64_t mix(uint64_t x) {
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+	//renders the cascades that need it. returns how many.
+	unsigned int update() {
+		render::Device& device = render::device();
+		vec3 sun = glm::normalize(sunDirection);
+		bool sunMoved = sun != renderedSun;
+		renderedSun = sun;
+		mat4 view = lightView(sun);
+		vec3 viewerInLight = (view * vec4(viewerPosition, 1.f)).xyz();
+		//a directional light is as far away as can be along its direction, which is all the back-face test needs
+		vec3 lightPosition = viewerPosition + sun * 1e5f;
+
+		static std::vector<uint8_t> inCascade;
+		std::vector<ChunkDraw> casters;
+		unsigned int rendered = 0;
+		for (int i = 0; i < CASCADES; i++) {
+			Cascade& cascade = cascades[i];
+			float halfExtent = RADII[i] * EXTENT_PER_RADIUS;
+			float texel = 2.f * halfExtent / MAP_SIZE;
+			float step = i == 0 ? texel : texel * CACHED_STEP_TEXELS;
+			vec3 center = glm::round(viewerInLight / step) * step;
+			//the light view looks down -z, so casters towards the sun have the larger z
+			mat4 lightViewProjection = glm::ortho(center.x - halfExtent, center.x + halfExtent, center.y - halfExtent, center.y + halfExtent,
+				-(center.z + RADII[i] + CASTER_REACH), -(center.z - RADII[i])) * view;
+			Frustum(lightViewProjection).intersectBoxes(drawList::casterBounds, inCascade);
+			//summed so it doesn't depend on the order of the casters
+			uint64_t contents = 0;
+			for (size_t j = 0; j < drawList::casters.size(); j++) {
+				if (inCascade[j]) {
+					contents += mix(gpumem::generation(drawList::casters[j].mesh));
+				}
+			}
+			if (i > 0 && cascade.rendered && !sunMoved && center == cascade.center && contents == cascade.contents) {
+				continue;
+			}
+
+			casters.clear();
+			for (size_t j = 0; j < drawList::casters.size(); j++) {
+				if (inCascade[j]) {
+					casters.push_back(drawList::casters[j]);
+				}
+			}
+			locateChunkDraws(casters);
+			if (rendered == 0) {
+				device.useProgram(program::depth);
+			}
+			device.beginShadowPass(maps, i);
+			device.setUniform(3, lightViewProjection);
+			drawChunks(casters, lightPosition);
+			device.endShadowPass();
+			cascade.lightViewProjection = lightViewProjection;
+			cascade.center = center;
+			cascade.contents = contents;
+			cascade.rendered = true;
+			rendered++;
+		}
+		return rendered;
+	}
+
+	//the uniforms chunk.frag shades with, for the current program.
+	void bind() {
+		render::Device& device = render::device();
+		device.bindShadowMaps(0, maps);
+		device.setUniform(4, vec4(glm::normalize(sunDirection), 0.f));
+		device.setUniform(5, vec4(viewerPosition, 1.f));
+		vec4 radii(0.f);
+		vec4 texels(0.f);
+		for (int i = 0; i < CASCADES; i++) {
+			radii[i] = useShadows && cascades[i].rendered ? RADII[i] : 0.f;
+			texels[i] = 2.f * RADII[i] * EXTENT_PER_RADIUS / MAP_SIZE;
+			device.setUniform(8 + i, cascades[i].lightViewProjection);
+		}
+		device.setUniform(6, radii);
+		device.setUniform(7, texels);
+	}
+}
+
+void rebuildDrawList(ChunkKey viewerChunk) {
+	drawList::chunks.clear();
+	drawList::casters.clear();
+	drawList::casterBounds.clear();
+	drawList::occluders.clear();
+	drawList::unreachable = 0;
+	std::vector<std::pair<float, ChunkDraw>> chunksByDistance;
+	std::vector<std::pair<float, ChunkKey>> occludersByDistance;
+	auto addChunkDraw = [&](vec4 origin, const BufferAndPanelCount& chunkGLState, bool heightfield, bool reachable) {
+		float distance = glm::distance(origin.xyz() + origin.w * (BLOCKS_PER_SIDE * 0.5f), viewerPosition);
+		vec3 boundsMin = origin.xyz() + chunkGLState.boundsMin * origin.w;
+		vec3 boundsMax = origin.xyz() + chunkGLState.boundsMax * origin.w;
+		ChunkDraw chunkDraw = { origin, chunkGLState.mesh, {}, boundsMin, boundsMax, chunkGLState.orientationPanels, heightfield };
+		drawList::casters.push_back(chunkDraw);
+		drawList::casterBounds.add(boundsMin, boundsMax);
+		if (reachable) {
+			chunksByDistance.push_back({ distance, chunkDraw });
+		}
+	};
+	for (auto& posAndLOD : chunksThatShouldBeDrawn) {
+		auto iter = chunkGLBuffers.find(posAndLOD);
+		if (iter == chunkGLBuffers.end() || !lod::isDrawnAtFinestLevel(posAndLOD)) {
+			continue;
+		}
+		if (!iter->second.occluders.empty()) {
+			occludersByDistance.push_back({ glm::distance(chunkOrigin(posAndLOD).xyz() + BLOCKS_PER_SIDE * 0.5f, viewerPosition), posAndLOD });
+		}
+		if (iter->second.mesh == gpumem::NO_MESH) {
+			continue;
+		}
+		bool reachable = connectivity::isVisible(posAndLOD);
+		if (!reachable) {
+			drawList::unreachable++;
+		}
+		addChunkDraw(chunkOrigin(posAndLOD), iter->second, false, reachable);
+	}
+	//coarser chunks only ever lie outside the finest ones, so they aren't culled by connectivity
+	for (auto& keyAndMesh : lod::drawnChunks()) {
+		addChunkDraw(lod::chunkOrigin(keyAndMesh.first), *keyAndMesh.second, false, true);
+	}
+	//and the far terrain past those
+	for (auto& originAndMesh : clipmap::drawnRings()) {
+		addChunkDraw(originAndMesh.first, *originAndMesh.second, true, true);
+	}
+	std::sort(chunksByDistance.begin(), chunksByDistance.end(), [](const std::pair<float, ChunkDraw>& a, const std::pair<float, ChunkDraw>& b) {
+		return a.first < b.first;
+	});
+	std::sort(occludersByDistance.begin(), occludersByDistance.end(), [](const std::pair<float, ChunkKey>& a, const std::pair<float, ChunkKey>& b) {
+		return a.first < b.first;
+	});
+
+	drawList::chunks.reserve(chunksByDistance.size());
+	for (auto& distanceAndDraw : chunksByDistance) {
+		drawList::chunks.push_back(distanceAndDraw.second);
+	}
+	drawList::occluders.reserve(occludersByDistance.size());
+	for (auto& distanceAndKey : occludersByDistance) {
+		drawList::occluders.push_back({ chunkOrigin(distanceAndKey.second).xyz(), &chunkGLBuffers[distanceAndKey.second].occluders });
+	}
+	drawList::version = drawableChunksVersion;
+	drawList::viewerChunk = viewerChunk;
+}
+
+//rasterizes the occluders of the nearest chunks in view and drops the draws they hide. returns how many.
+unsigned int removeHiddenChunkDraws(std::vector<ChunkDraw>& chunkDraws, const mat4& viewProjection) {
+	//whole chunks are used for choosing occluders, since completely solid chunks have no mesh at all
+	Frustum frustum(viewProjection);
+	occlusion::beginFrame(viewProjection);
+	size_t occluderChunks = 0;
+	for (auto& occluderChunk : drawList::occluders) {
+		if (occluderChunks == occlusion::MAX_OCCLUDER_CHUNKS) {
+			break;
+		}
+		if (frustum.intersectsBox(occluderChunk.origin, occluderChunk.origin + static_cast<float>(BLOCKS_PER_SIDE))) {
+			occlusion::addOccluders(occluderChunk.origin, *occluderChunk.occluders);
+			occluderChunks++;
+		}
+	}
+	occlusion::finishOccluders();
+
+	size_t visibleCount = 0;
+	for (auto& chunkDraw : chunkDraws) {
+		if (occlusion::isBoxVisible(chunkDraw.boundsMin, chunkDraw.boundsMax)) {
+			chunkDraws[visibleCount++] = chunkDraw;
+		}
+	}
+	unsigned int hidden = static_cast<unsigned int>(chunkDraws.size() - visibleCount);
+	chunkDraws.resize(visibleCount);
+	return hidden;
+}
+
+void drawFrame() {
+	render::Device& device = render::device();
+	device.clear();
+
+	//========================= DRAW CHUNKS =============================
+	device.setIndexBuffer(vbo::chunkPanelIndex);
 
 	matrix::view = mat4(1.0f);
 	matrix::view = glm::rotate(matrix::view, rotation.y, { 1.f, 0.f, 0.f });
 	matrix::view = glm::rotate(matrix::view, rotation.x, { 0.f, 1.f, 0.f });
 	matrix::view = glm::translate(matrix::view, -viewerPosition);
 
+	light::update();
 	updateChunkGLBuffers();
-	for (auto chunkGLStatePair : chunkGLBuffers) {
-		auto& chunkGLState = chunkGLStatePair.second;
-		auto& posAndLOD = chunkGLStatePair.first;
-		if (chunksThatShouldBeDrawn.find(posAndLOD) != chunksThatShouldBeDrawn.end()) {
-			glBindBuffer(GL_ARRAY_BUFFER, /*chunkGLBuffers[{0, 0, 0, 0}].buffer*/chunkGLState.buffer);
-
-			glVertexAttribPointer(0, 4, GL_HALF_FLOAT, false, 12, 0);
-			glEnableVertexAttribArray(0);
-			glVertexAttribPointer(1, 4, GL_BYTE, true, 12, (GLvoid*)8);
-			glEnableVertexAttribArray(1);
+	lod::update();
+	clipmap::update();
 
-			vec3 floatPos = vec3{ posAndLOD.x, posAndLOD.y, posAndLOD.z } *static_cast<float>(BLOCKS_PER_SIDE);
-
-			auto model = glm::mat4(1.0f);
-			model = glm::translate(model, floatPos);
-			//model = glm::scale(model, glm::vec3(pow(2, posAndLOD.w)));
-
-			auto mvp = matrix::projection * matrix::view * model;
-
-			glUniform1ui(0, 15u);
-			glUniform1ui(1, 4);
-			glUniform1ui(2, 8);
-			glUniformMatrix4fv(3, 1, false, glm::value_ptr(mvp));
+	ChunkKey viewerChunk = connectivity::chunkContaining(viewerPosition);
+	connectivity::followViewer(viewerChunk);
+	if (drawList::version != drawableChunksVersion || drawList::viewerChunk != viewerChunk) {
+		rebuildDrawList(viewerChunk);
+	}
 
-			glDrawElements(GL_TRIANGLES, chunkGLState.vertexCount, GL_UNSIGNED_INT, 0);
+	//test the tight mesh bounds of every candidate against the frustum in one batch
+	auto viewProjection = matrix::projection * matrix::view;
+	static BoxList chunkBounds;
+	static std::vector<uint8_t> chunkVisible;
+	chunkBounds.clear();
+	for (auto& chunkDraw : drawList::chunks) {
+		chunkBounds.add(chunkDraw.boundsMin, chunkDraw.boundsMax);
+	}
+	Frustum(viewProjection).intersectBoxes(chunkBounds, chunkVisible);
+	std::vector<ChunkDraw> chunkDraws;
+	chunkDraws.reserve(drawList::chunks.size());
+	for (size_t i = 0; i < drawList::chunks.size(); i++) {
+		if (chunkVisible[i]) {
+			chunkDraws.push_back(drawList::chunks[i]);
 		}
 	}
+	size_t inFrustum = chunkDraws.size();
+	unsigned int hidden = useOcclusionCulling ? removeHiddenChunkDraws(chunkDraws, viewProjection) : 0;
+
+	//meshes live in a few shared arenas; draws are grouped so each arena is bound and described once,
+	//staying front to back within an arena so the depth test rejects hidden fragments early
+	locateChunkDraws(chunkDraws);
+
+	//the shadow passes go through the same draw functions, so their stats are taken apart from the chunk pass
+	drawStats = DrawStats();
+	unsigned int shadowCascades = useShadows ? shadow::update() : 0;
+	unsigned int shadowDrawCalls = drawStats.drawCalls;
+
+	drawStats = DrawStats();
+	drawStats.shadowCascades = shadowCascades;
+	drawStats.shadowDrawCalls = shadowDrawCalls;
+	drawStats.chunks = static_cast<unsigned int>(chunkDraws.size());
+	drawStats.culled = static_cast<unsigned int>(drawList::chunks.size() - inFrustum);
+	drawStats.occluded = drawList::unreachable;
+	drawStats.hidden = hidden;
+	uint64_t callsBefore = device.stats().calls;
+	device.useProgram(program::chunk2);
+	device.setUniform(3, viewProjection);
+	shadow::bind();
+	drawChunks(chunkDraws, viewerPosition);
+	drawStats.deviceCalls = static_cast<unsigned int>(device.stats().calls - callsBefore);
 }
\ No newline at end of file
@@ -4,7 +4,7 @@
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
-#include "glad.h"
+#include "renderdevice.h"
 
 #include "chunk.h"
 
@@ -13,6 +13,9 @@
 #include <unordered_set>
 #include <set>
 
+//far enough for the corners of the outermost clipmap ring. chunk.frag fogs towards it.
+const float FAR_PLANE = 12000.f;
+
 extern vec2 rotation;
 
 namespace matrix {
@@ -21,22 +24,45 @@ namespace matrix {
 }
 
 namespace program {
-	extern GLuint chunk;
-	extern GLuint chunk2;
+	extern render::ProgramId chunk;
+	extern render::ProgramId chunk2;
+	extern render::ProgramId depth; //chunk2's vertices for shadow maps
 }
 
 namespace fbo {
 }
 
-namespace vao {
-	extern GLuint chunk;
-}
-
 namespace vbo {
-	extern GLuint chunkPanel;
-	extern GLuint chunkPanelIndex;
+	extern render::BufferId chunkPanel;
+	extern render::BufferId chunkPanelIndex;
+	extern render::BufferId chunkDrawCommands;
+	extern render::BufferId chunkOrigins;
 }
 
+//what the last frame's chunk pass drew and how many render device calls it took
+struct DrawStats {
+	unsigned int chunks = 0;
+	unsigned int culled = 0; //meshes outside the view frustum
+	unsigned int occluded = 0; //meshes the viewer can't see into through the chunk connectivity graph
+	unsigned int hidden = 0; //meshes behind the software occlusion depth buffer
+	unsigned int panels = 0;
+	unsigned int backFacingPanels = 0; //skipped per orientation run, without reaching the GPU
+	unsigned int drawCalls = 0;
+	unsigned int deviceCalls = 0;
+	unsigned int shadowCascades = 0; //shadow maps rendered this frame rather than reused
+	unsigned int shadowDrawCalls = 0;
+};
+
+//false falls back to one draw call per chunk, e.g. to compare against the indirect path.
+extern bool useMultiDrawIndirect;
+//false skips the CPU occlusion pass, e.g. to compare against drawing everything in view.
+extern bool useOcclusionCulling;
+//false leaves everything lit by the sun, e.g. to compare against rendering the shadow maps.
+extern bool useShadows;
+//towards the sun. changing it renders every shadow cascade again.
+extern vec3 sunDirection;
+extern DrawStats drawStats;
+
 
 void drawSetup();
 
@@ -0,0 +1,260 @@
+#include "edit.h"
+#include "chunkio.h"
+#include "light.h"
+#include "simulation.h"
+#include "worldgen.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace edit {
+    namespace {
+        struct EditStats {
+            uint64_t edits = 0;
+            uint64_t blocksChanged = 0;
+            uint64_t chunksTouched = 0;
+            uint64_t remeshes = 0;
+            uint64_t skippedChunks = 0; //in an edit's box but not resident
+            uint64_t skyChunksCreated = 0;
+            double milliseconds = 0.0;
+        };
+
+        struct TouchedChunk {
+            ivec3 low = ivec3(BLOCKS_PER_SIDE); //of the changed blocks, from the chunk origin
+            ivec3 high = ivec3(-1);
+        };
+
+        EditStats stats;
+
+        int floorDiv(int a, int b) {
+            return (a >= 0 ? a : a - b + 1) / b;
+        }
+
+        ChunkKey chunkOf(ivec3 position) {
+            return { floorDiv(position.x, BLOCKS_PER_SIDE), floorDiv(position.y, BLOCKS_PER_SIDE), floorDiv(position.z, BLOCKS_PER_SIDE) };
+        }
+
+        //calls visitRow(chunk, local, position, length) for each row of up to a chunk's width of the resident
+        //blocks in the box, where local and position are the row's first block in the chunk and the world.
+        template <typename RowVisitor>
+        void forEachRow(ivec3 min, ivec3 max, RowVisitor&& visitRow) {
+            ChunkKey firstChunk = chunkOf(min);
+            ChunkKey lastChunk = chunkOf(max);
+            ChunkKey key;
+            for (key.z = firstChunk.z; key.z <= lastChunk.z; key.z++) {
+                for (key.y = firstChunk.y; key.y <= lastChunk.y; key.y++) {
+                    for (key.x = firstChunk.x; key.x <= lastChunk.x; key.x++) {
+                        auto iter = perChunkState.find(key);
+                        if (iter == perChunkState.end()) {
+                            stats.skippedChunks++;
+                            continue;
+                        }
+                        ivec3 origin = key * BLOCKS_PER_SIDE;
+                        ivec3 low = glm::max(min, origin) - origin;
+                        ivec3 high = glm::min(max, origin + (BLOCKS_PER_SIDE - 1)) - origin;
+                        ivec3 local = low;
+                        for (local.z = low.z; local.z <= high.z; local.z++) {
+                            for (local.y = low.y; local.y <= high.y; local.y++) {
+                                visitRow(key, iter->second, local, origin + local, high.x - low.x + 1);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        struct Committed {
+            size_t chunksTouched = 0;
+            size_t remeshes = 0;
+        };
+
+        Committed commitChanges(const std::vector<ivec3>& changed) {
+            std::unordered_map<ChunkKey, TouchedChunk> touchedChunks;
+            for (ivec3 position : changed) {
+                ChunkKey key = chunkOf(position);
+                TouchedChunk& touched = touchedChunks[key];
+                touched.low = glm::min(touched.low, position - key * BLOCKS_PER_SIDE);
+                touched.high = glm::max(touched.high, position - key * BLOCKS_PER_SIDE);
+            }
+
+            light::blocksChanged(changed);
+            simulation::blocksChanged(changed);
+            //the touched chunks and any neighbor whose mesh shows their border blocks, through faces or the
+            //ambient occlusion of edges and corners, each remeshed once
+            std::unordered_set<ChunkKey> remeshes;
+            for (auto& keyAndTouched : touchedChunks) {
+                ChunkKey key = keyAndTouched.first;
+                const TouchedChunk& touched = keyAndTouched.second;
+                PerChunkState& chunk = perChunkState[key];
+                chunk.solidBricks = findSolidBricks(chunk.blocks);
+                chunkio::requestSave(key, chunk);
+                ivec3 offset;
+                for (offset.z = -1; offset.z <= 1; offset.z++) {
+                    for (offset.y = -1; offset.y <= 1; offset.y++) {
+                        for (offset.x = -1; offset.x <= 1; offset.x++) {
+                            bool bordered = true;
+                            for (int axis = 0; axis < 3; axis++) {
+                                bordered = bordered && (offset[axis] == 0
+                                    || (offset[axis] < 0 ? touched.low[axis] == 0 : touched.high[axis] == BLOCKS_PER_SIDE - 1));
+                            }
+                            if (bordered && perChunkState.find(key + offset) != perChunkState.end()) {
+                                remeshes.insert(key + offset);
+                            }
+                        }
+                    }
+                }
+            }
+            for (const ChunkKey& key : remeshes) {
+                markChunkForRemesh(key);
+            }
+            return { touchedChunks.size(), remeshes.size() };
+        }
+
+        //sky chunks are never generated, so each one the edit would put blocks in is created as air first. the
+        //claim makes it load from disk from then on, and it's saved even if the edit leaves it as air.
+        template <typename RowEditor>
+        void createSkyChunks(ivec3 min, ivec3 max, RowEditor& editRow) {
+            ChunkKey firstChunk = chunkOf(min);
+            ChunkKey lastChunk = chunkOf(max);
+            std::array<Block, BLOCKS_PER_SIDE> edited;
+            ChunkKey key;
+            for (key.z = firstChunk.z; key.z <= lastChunk.z; key.z++) {
+                for (key.y = firstChunk.y; key.y <= lastChunk.y; key.y++) {
+                    for (key.x = firstChunk.x; key.x <= lastChunk.x; key.x++) {
+                        if (perChunkState.find(key) != perChunkState.end() || !worldgen::isEmptySky(key)) {
+                            continue;
+                        }
+                        ivec3 origin = key * BLOCKS_PER_SIDE;
+                        ivec3 low = glm::max(min, origin);
+                        ivec3 high = glm::min(max, origin + (BLOCKS_PER_SIDE - 1));
+                        int length = high.x - low.x + 1;
+                        bool placesBlocks = false;
+                        for (int z = low.z; z <= high.z && !placesBlocks; z++) {
+                            for (int y = low.y; y <= high.y && !placesBlocks; y++) {
+                                edited.fill(AIR);
+                                editRow(ivec3{ low.x, y, z }, length, edited.data());
+                                placesBlocks = std::any_of(edited.begin(), edited.begin() + length, [](Block block) { return block != AIR; });
+                            }
+                        }
+                        if (!placesBlocks) {
+                            continue;
+                        }
+                        chunkio::claimSky(key);
+                        BlockList air = {};
+                        insertChunk(key, air.data());
+                        chunkio::requestSave(key, perChunkState[key]);
+                        stats.skyChunksCreated++;
+                    }
+                }
+            }
+        }
+
+        //rewrites every row of the box with editRow(position, length, row), which changes row in place, and
+        //commits the blocks that came out different.
+        template <typename RowEditor>
+        size_t editRows(ivec3 min, ivec3 max, RowEditor&& editRow) {
+            auto begin = std::chrono::steady_clock::now();
+            createSkyChunks(min, max, editRow);
+            std::vector<ivec3> changed;
+            std::array<Block, BLOCKS_PER_SIDE> edited;
+            forEachRow(min, max, [&](ChunkKey, PerChunkState& chunk, ivec3 local, ivec3 position, int length) {
+                Block* row = &chunk.blocks[getChunkIndex(local)];
+                std::copy(row, row + length, edited.begin());
+                editRow(position, length, edited.data());
+                bool rowChanged = false;
+                for (int i = 0; i < length; i++) {
+                    if (edited[i] != row[i]) {
+                        changed.push_back(position + ivec3{ i, 0, 0 });
+                        rowChanged = true;
+                    }
+                }
+                if (rowChanged) {
+                    std::copy(edited.begin(), edited.begin() + length, row);
+                }
+            });
+            if (changed.empty()) {
+                return 0;
+            }
+
+            Committed committed = commitChanges(changed);
+            stats.edits++;
+            stats.blocksChanged += changed.size();
+            stats.chunksTouched += committed.chunksTouched;
+            stats.remeshes += committed.remeshes;
+            stats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            return changed.size();
+        }
+    }
+
+    size_t fillBox(ivec3 min, ivec3 max, Block block) {
+        return editRows(min, max, [block](ivec3, int length, Block* row) {
+            std::fill(row, row + length, block);
+        });
+    }
+
+    size_t fillSphere(vec3 center, float radius, Block block) {
+        ivec3 min = ivec3(glm::floor(center - radius));
+        ivec3 max = ivec3(glm::ceil(center + radius));
+        return editRows(min, max, [center, radius, block](ivec3 position, int length, Block* row) {
+            float dy = position.y + 0.5f - center.y;
+            float dz = position.z + 0.5f - center.z;
+            float remaining = radius * radius - dy * dy - dz * dz;
+            if (remaining < 0.f) {
+                return;
+            }
+            //the span of block centers within sqrt(remaining) of the center along x
+            float halfWidth = sqrtf(remaining);
+            int first = glm::max(static_cast<int>(ceilf(center.x - halfWidth - 0.5f)) - position.x, 0);
+            int last = glm::min(static_cast<int>(floorf(center.x + halfWidth - 0.5f)) - position.x, length - 1);
+            if (first <= last) {
+                std::fill(row + first, row + last + 1, block);
+            }
+        });
+    }
+
+    size_t replace(ivec3 min, ivec3 max, Block from, Block to) {
+        return editRows(min, max, [from, to](ivec3, int length, Block* row) {
+            std::replace(row, row + length, from, to);
+        });
+    }
+
+    Schematic copy(ivec3 min, ivec3 max) {
+        Schematic schematic;
+        schematic.size = max - min + 1;
+        schematic.blocks.assign(static_cast<size_t>(schematic.size.x) * schematic.size.y * schematic.size.z, AIR);
+        forEachRow(min, max, [&](ChunkKey, PerChunkState& chunk, ivec3 local, ivec3 position, int length) {
+            ivec3 offset = position - min;
+            const Block* row = &chunk.blocks[getChunkIndex(local)];
+            std::copy(row, row + length, schematic.blocks.begin() + (offset.x + schematic.size.x * (offset.y + schematic.size.y * offset.z)));
+        });
+        return schematic;
+    }
+
+    size_t paste(const Schematic& schematic, ivec3 at, bool skipAir) {
+        return editRows(at, at + schematic.size - 1, [&](ivec3 position, int length, Block* row) {
+            ivec3 offset = position - at;
+            const Block* source = &schematic.blocks[offset.x + schematic.size.x * (offset.y + schematic.size.y * offset.z)];
+            if (!skipAir) {
+                std::copy(source, source + length, row);
+                return;
+            }
+            for (int i = 0; i < length; i++) {
+                row[i] = source[i] != AIR ? source[i] : row[i];
+            }
+        });
+    }
+
+    void commit(const std::vector<ivec3>& changed) {
+        if (!changed.empty()) {
+            commitChanges(changed);
+        }
+    }
+
+    void printStats() {
+        printf("edit: %llu edits changed %llu blocks in %llu chunks in %.1fms, %llu remeshes queued, %llu sky chunks created, %llu chunks skipped as not resident\n",
+            static_cast<unsigned long long>(stats.edits), static_cast<unsigned long long>(stats.blocksChanged),
+            static_cast<unsigned long long>(stats.chunksTouched), stats.milliseconds,
+            static_cast<unsigned long long>(stats.remeshes), static_cast<unsigned long long>(stats.skyChunksCreated),
+            static_cast<unsigned long long>(stats.skippedChunks));
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "chunk.h"
+
+//bulk block edits, e.g. explosions and pasted schematics. an edit writes straight into the resident chunks a
+//row of blocks at a time and then commits once: each touched chunk has its brick summary rebuilt and is saved
+//and queued for remeshing once, along with each neighbor whose shared border, edge or corner it touched, and
+//all changed blocks are relit in one pass. the queued chunks are meshed in updateChunkGLBuffers' next
+//batches, so a large edit costs one remesh per chunk instead of one per block. sky chunks, which are never
+//generated, are created as air where an edit puts blocks in them. blocks in other chunks that aren't resident
+//are left alone, like setBlock does.
+namespace edit {
+    //a box of blocks, x fastest then y then z like BlockList.
+    struct Schematic {
+        ivec3 size = ivec3(0);
+        std::vector<Block> blocks;
+    };
+
+    //boxes include both corners. each edit returns how many blocks it changed.
+    size_t fillBox(ivec3 min, ivec3 max, Block block);
+    //the blocks whose centers are within radius.
+    size_t fillSphere(vec3 center, float radius, Block block);
+    size_t replace(ivec3 min, ivec3 max, Block from, Block to);
+    //blocks that aren't resident are copied as AIR.
+    Schematic copy(ivec3 min, ivec3 max);
+    //with skipAir, the schematic's air leaves the world's blocks as they are.
+    size_t paste(const Schematic& schematic, ivec3 at, bool skipAir = false);
+
+    //for blocks already written straight into resident chunks, e.g. by simulation ticks: relights, saves and
+    //remeshes them as an edit would. not counted in the edit stats.
+    void commit(const std::vector<ivec3>& changed);
+
+    void printStats();
+}
@@ -0,0 +1,93 @@
+#include "frustum.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+void BoxList::add(vec3 boxMin, vec3 boxMax) {
+    minX.push_back(boxMin.x);
+    minY.push_back(boxMin.y);
+    minZ.push_back(boxMin.z);
+    maxX.push_back(boxMax.x);
+    maxY.push_back(boxMax.y);
+    maxZ.push_back(boxMax.z);
+}
+
+void BoxList::clear() {
+    minX.clear();
+    minY.clear();
+    minZ.clear();
+    maxX.clear();
+    maxY.clear();
+    maxZ.clear();
+}
+
+Frustum::Frustum(const mat4& viewProjection) {
+    //glm is column-major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+    vec4 row0 = { viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0] };
+    vec4 row1 = { viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1] };
+    vec4 row2 = { viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2] };
+    vec4 row3 = { viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3] };
+    planes = {
+        row3 + row0,
+        row3 - row0,
+        row3 + row1,
+        row3 - row1,
+        row3 + row2,
+        row3 - row2
+    };
+}
+
+bool Frustum::intersectsBox(vec3 boxMin, vec3 boxMax) const {
+    for (auto& plane : planes) {
+        //the box corner furthest along the plane normal
+        vec3 positiveVertex = {
+            plane.x >= 0.f ? boxMax.x : boxMin.x,
+            plane.y >= 0.f ? boxMax.y : boxMin.y,
+            plane.z >= 0.f ? boxMax.z : boxMin.z
+        };
+        if (glm::dot(vec3{ plane.x, plane.y, plane.z }, positiveVertex) + plane.w < 0.f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Frustum::intersectBoxes(const BoxList& boxes, std::vector<uint8_t>& visible) const {
+    size_t count = boxes.size();
+    visible.resize(count);
+    size_t i = 0;
+#ifdef FRUSTUM_USE_SSE
+    //the positive vertex picks min or max per axis from the sign of the plane normal, which is the same
+    //for every box, so each plane becomes three multiply-adds over four boxes
+    for (; i + 4 <= count; i += 4) {
+        __m128 boxMinX = _mm_loadu_ps(&boxes.minX[i]);
+        __m128 boxMinY = _mm_loadu_ps(&boxes.minY[i]);
+        __m128 boxMinZ = _mm_loadu_ps(&boxes.minZ[i]);
+        __m128 boxMaxX = _mm_loadu_ps(&boxes.maxX[i]);
+        __m128 boxMaxY = _mm_loadu_ps(&boxes.maxY[i]);
+        __m128 boxMaxZ = _mm_loadu_ps(&boxes.maxZ[i]);
+        __m128 outside = _mm_setzero_ps();
+        for (auto& plane : planes) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(
+                    _mm_mul_ps(_mm_set1_ps(plane.x), plane.x >= 0.f ? boxMaxX : boxMinX),
+                    _mm_mul_ps(_mm_set1_ps(plane.y), plane.y >= 0.f ? boxMaxY : boxMinY)),
+                _mm_add_ps(
+                    _mm_mul_ps(_mm_set1_ps(plane.z), plane.z >= 0.f ? boxMaxZ : boxMinZ),
+                    _mm_set1_ps(plane.w)));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+        }
+        int outsideMask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4; lane++) {
+            visible[i + lane] = (outsideMask >> lane & 1) ? 0 : 1;
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        visible[i] = intersectsBox(
+            vec3{ boxes.minX[i], boxes.minY[i], boxes.minZ[i] },
+            vec3{ boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i] }) ? 1 : 0;
+    }
+}
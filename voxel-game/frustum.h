@@ -0,0 +1,27 @@
+#pragma once
+#define GLM_FORCE_SWIZZLE
+#define GLM_ENABLE_EXPERIMENTAL
+#include "glm/glm.hpp"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+using namespace glm;
+
+//axis-aligned boxes stored as separate coordinate arrays, so they can be tested four at a time.
+struct BoxList {
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+    void add(vec3 boxMin, vec3 boxMax);
+    void clear();
+    size_t size() const { return minX.size(); }
+};
+
+//the six clip planes of a view-projection matrix, normals pointing inwards.
+struct Frustum {
+    std::array<vec4, 6> planes;
+    Frustum(const mat4& viewProjection);
+    bool intersectsBox(vec3 boxMin, vec3 boxMax) const;
+    //visible[i] is 1 if box i intersects the frustum, 0 if not.
+    void intersectBoxes(const BoxList& boxes, std::vector<uint8_t>& visible) const;
+};
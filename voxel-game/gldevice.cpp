@@ -0,0 +1,348 @@
+#include "renderdevice.h"
+#include "glad.h"
+#include "glm/gtc/type_ptr.hpp"
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace render {
+    namespace {
+        //GL 4.4 / ARB_buffer_storage, not in the generated glad
+        typedef void (APIENTRYP BufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+        const GLbitfield MAP_PERSISTENT_BIT = 0x0040;
+        const GLbitfield MAP_COHERENT_BIT = 0x0080;
+
+        const GLuint CHUNK_ORIGIN_ATTRIBUTE = 2;
+        const GLuint LIGHT_ATTRIBUTE = 3;
+
+        bool hasBufferStorage() {
+            if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4)) {
+                return true;
+            }
+            GLint extensionCount = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+            for (GLint i = 0; i < extensionCount; i++) {
+                if (strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_buffer_storage") == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        GLuint makeShaderFromString(const std::string& shaderString, GLenum shaderType) {
+            GLuint shader = glCreateShader(shaderType);
+
+            const char* source = shaderString.c_str();
+            glShaderSource(shader, 1, &source, nullptr);
+            glCompileShader(shader);
+
+            GLint success;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+            if (!success) {
+                char infoLog[512];
+                glGetShaderInfoLog(shader, 512, NULL, infoLog);
+                std::cout << "shader compile error: \n" << infoLog << std::endl;
+            }
+            return shader;
+        }
+
+        class GLDevice : public Device {
+        public:
+            GLDevice(ProcLoader loader) {
+                bufferStorage = hasBufferStorage() ? reinterpret_cast<BufferStorageProc>(loader("glBufferStorage")) : nullptr;
+                glGenVertexArrays(1, &vertexArray);
+                glBindVertexArray(vertexArray);
+                glClearColor(0.0, 0.0, 0.0, 1.0);
+                glEnable(GL_DEPTH_TEST);
+                glEnable(GL_CULL_FACE);
+                glCullFace(GL_BACK);
+            }
+
+            ~GLDevice() override {
+                for (auto& fence : fences) {
+                    glDeleteSync(fence.second);
+                }
+                glDeleteVertexArrays(1, &vertexArray);
+            }
+
+            BufferId createBuffer(size_t bytes, const void* data) override {
+                deviceStats.calls++;
+                deviceStats.buffersCreated++;
+                GLuint buffer;
+                glGenBuffers(1, &buffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(bytes), data, GL_DYNAMIC_DRAW);
+                if (data != nullptr) {
+                    deviceStats.bytesUploaded += bytes;
+                }
+                return buffer;
+            }
+
+            void setBufferData(BufferId buffer, size_t bytes, const void* data) override {
+                deviceStats.calls++;
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(bytes), data, GL_STREAM_DRAW);
+                if (data != nullptr) {
+                    deviceStats.bytesUploaded += bytes;
+                }
+            }
+
+            void uploadBuffer(BufferId buffer, size_t offset, size_t bytes, const void* data) override {
+                deviceStats.calls++;
+                deviceStats.bytesUploaded += bytes;
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(bytes), data);
+            }
+
+            void copyBuffer(BufferId source, size_t sourceOffset, BufferId target, size_t targetOffset, size_t bytes) override {
+                deviceStats.calls++;
+                deviceStats.bytesCopied += bytes;
+                glBindBuffer(GL_COPY_READ_BUFFER, source);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                    static_cast<GLintptr>(sourceOffset), static_cast<GLintptr>(targetOffset), static_cast<GLsizeiptr>(bytes));
+            }
+
+            void deleteBuffer(BufferId buffer) override {
+                deviceStats.calls++;
+                deviceStats.buffersDeleted++;
+                glDeleteBuffers(1, &buffer);
+            }
+
+            void* createMappedBuffer(size_t bytes, BufferId& buffer) override {
+                buffer = NO_BUFFER;
+                if (bufferStorage == nullptr) {
+                    std::cout << "glBufferStorage unavailable, no persistently mapped buffers" << std::endl;
+                    return nullptr;
+                }
+                deviceStats.calls++;
+                deviceStats.buffersCreated++;
+                GLbitfield flags = GL_MAP_WRITE_BIT | MAP_PERSISTENT_BIT | MAP_COHERENT_BIT;
+                glGenBuffers(1, &buffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                bufferStorage(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(bytes), nullptr, flags);
+                void* mapping = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, static_cast<GLsizeiptr>(bytes), flags);
+                if (mapping == nullptr) {
+                    std::cout << "failed to map a persistent buffer" << std::endl;
+                    deleteBuffer(buffer);
+                    buffer = NO_BUFFER;
+                }
+                return mapping;
+            }
+
+            void deleteMappedBuffer(BufferId buffer) override {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+                deleteBuffer(buffer);
+            }
+
+            FenceId insertFence() override {
+                deviceStats.calls++;
+                FenceId fence = nextFence++;
+                fences[fence] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                return fence;
+            }
+
+            bool isFenceSignaled(FenceId fence) override {
+                deviceStats.calls++;
+                GLenum status = glClientWaitSync(fences[fence], 0, 0);
+                return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+            }
+
+            void deleteFence(FenceId fence) override {
+                deviceStats.calls++;
+                auto iter = fences.find(fence);
+                if (iter != fences.end()) {
+                    glDeleteSync(iter->second);
+                    fences.erase(iter);
+                }
+            }
+
+            ProgramId createProgram(const std::string& vertexSource, const std::string& fragmentSource) override {
+                deviceStats.calls++;
+                GLuint vertexShader = makeShaderFromString(vertexSource, GL_VERTEX_SHADER);
+                GLuint fragmentShader = makeShaderFromString(fragmentSource, GL_FRAGMENT_SHADER);
+
+                GLuint shaderProgram = glCreateProgram();
+                glAttachShader(shaderProgram, vertexShader);
+                glAttachShader(shaderProgram, fragmentShader);
+                glLinkProgram(shaderProgram);
+
+                GLint success;
+                glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+                if (!success) {
+                    char infoLog[512];
+                    glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+                    std::cout << "program linking failed:\n" << infoLog << std::endl;
+                }
+
+                glDeleteShader(vertexShader);
+                glDeleteShader(fragmentShader);
+
+                return shaderProgram;
+            }
+
+            void setViewport(int width, int height) override {
+                deviceStats.calls++;
+                glViewport(0, 0, width, height);
+            }
+
+            void clear() override {
+                deviceStats.calls++;
+                glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+            }
+
+            void useProgram(ProgramId program) override {
+                deviceStats.calls++;
+                glUseProgram(program);
+            }
+
+            void setUniform(int location, const mat4& value) override {
+                deviceStats.calls++;
+                glUniformMatrix4fv(location, 1, false, glm::value_ptr(value));
+            }
+
+            void setUniform(int location, const vec4& value) override {
+                deviceStats.calls++;
+                glUniform4fv(location, 1, glm::value_ptr(value));
+            }
+
+            void setIndexBuffer(BufferId buffer) override {
+                deviceStats.calls++;
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+            }
+
+            void setChunkVertexBuffer(BufferId buffer) override {
+                deviceStats.calls++;
+                glBindBuffer(GL_ARRAY_BUFFER, buffer);
+                glVertexAttribPointer(0, 4, GL_HALF_FLOAT, false, 12, 0);
+                glEnableVertexAttribArray(0);
+                glVertexAttribPointer(1, 3, GL_BYTE, true, 12, (GLvoid*)8);
+                glEnableVertexAttribArray(1);
+                glVertexAttribIPointer(LIGHT_ATTRIBUTE, 1, GL_UNSIGNED_BYTE, 12, (GLvoid*)11);
+                glEnableVertexAttribArray(LIGHT_ATTRIBUTE);
+            }
+
+            void setChunkOriginBuffer(BufferId buffer) override {
+                deviceStats.calls++;
+                glBindBuffer(GL_ARRAY_BUFFER, buffer);
+                glVertexAttribPointer(CHUNK_ORIGIN_ATTRIBUTE, 4, GL_FLOAT, false, 0, 0);
+                glEnableVertexAttribArray(CHUNK_ORIGIN_ATTRIBUTE);
+                glVertexAttribDivisor(CHUNK_ORIGIN_ATTRIBUTE, 1);
+                originArrayEnabled = true;
+            }
+
+            void setChunkOrigin(vec4 origin) override {
+                deviceStats.calls++;
+                if (originArrayEnabled) {
+                    glDisableVertexAttribArray(CHUNK_ORIGIN_ATTRIBUTE);
+                    originArrayEnabled = false;
+                }
+                glVertexAttrib4f(CHUNK_ORIGIN_ATTRIBUTE, origin.x, origin.y, origin.z, origin.w);
+            }
+
+            void drawIndexed(uint32_t indexCount, int32_t baseVertex) override {
+                deviceStats.calls++;
+                deviceStats.drawCalls++;
+                deviceStats.draws++;
+                deviceStats.indices += indexCount;
+                glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(indexCount), GL_UNSIGNED_INT, 0, baseVertex);
+            }
+
+            void multiDrawIndexedIndirect(BufferId commands, size_t firstCommand, size_t commandCount) override {
+                deviceStats.calls++;
+                deviceStats.drawCalls++;
+                deviceStats.draws += commandCount;
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands);
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (GLvoid*)(firstCommand * sizeof(DrawIndirectCommand)), static_cast<GLsizei>(commandCount), 0);
+            }
+
+            TextureId createShadowMaps(int size, int layers) override {
+                deviceStats.calls++;
+                GLuint texture;
+                glGenTextures(1, &texture);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+                glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, size, size, layers);
+                //linear filtering with comparison gives 2x2 percentage closer filtering for free
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+                ShadowTarget& target = shadowTargets[texture];
+                target.size = size;
+                GLint previousFramebuffer;
+                glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+                glGenFramebuffers(1, &target.framebuffer);
+                glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+                glDrawBuffer(GL_NONE);
+                glReadBuffer(GL_NONE);
+                glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+                return texture;
+            }
+
+            void deleteShadowMaps(TextureId maps) override {
+                deviceStats.calls++;
+                auto iter = shadowTargets.find(maps);
+                if (iter != shadowTargets.end()) {
+                    glDeleteFramebuffers(1, &iter->second.framebuffer);
+                    shadowTargets.erase(iter);
+                }
+                glDeleteTextures(1, &maps);
+            }
+
+            void beginShadowPass(TextureId maps, int layer) override {
+                deviceStats.calls++;
+                const ShadowTarget& target = shadowTargets[maps];
+                //the headless driver draws into its own framebuffer, so whatever is bound is put back afterwards
+                glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+                glGetIntegerv(GL_VIEWPORT, savedViewport);
+                glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, maps, 0, layer);
+                glViewport(0, 0, target.size, target.size);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                glEnable(GL_POLYGON_OFFSET_FILL);
+                glPolygonOffset(2.f, 4.f);
+            }
+
+            void endShadowPass() override {
+                deviceStats.calls++;
+                glDisable(GL_POLYGON_OFFSET_FILL);
+                glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+                glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+            }
+
+            void bindShadowMaps(int unit, TextureId maps) override {
+                deviceStats.calls++;
+                glActiveTexture(GL_TEXTURE0 + unit);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, maps);
+            }
+
+            void finish() override {
+                deviceStats.calls++;
+                glFinish();
+            }
+
+        private:
+            struct ShadowTarget {
+                GLuint framebuffer = 0;
+                int size = 0;
+            };
+
+            BufferStorageProc bufferStorage;
+            GLuint vertexArray = 0;
+            bool originArrayEnabled = false;
+            std::unordered_map<FenceId, GLsync> fences;
+            FenceId nextFence = 1;
+            std::unordered_map<TextureId, ShadowTarget> shadowTargets;
+            GLint savedFramebuffer = 0;
+            GLint savedViewport[4] = {};
+        };
+    }
+
+    Device* createGLDevice(ProcLoader loader) {
+        return new GLDevice(loader);
+    }
+}
@@ -0,0 +1,288 @@
+#include "gpumem.h"
+#include "chunk.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <set>
+#include <vector>
+
+static_assert(sizeof(ChunkVertexFormat) == gpumem::VERTEX_BYTES, "arena offsets are computed in whole vertices");
+
+namespace gpumem {
+    namespace {
+        const uint64_t BLOCK_BYTES = static_cast<uint64_t>(BLOCK_VERTICES) * VERTEX_BYTES;
+
+        struct Arena {
+            render::BufferId buffer = render::NO_BUFFER; //NO_BUFFER once released; the slot is reused by the next new arena
+            std::array<std::set<uint32_t>, ARENA_ORDER + 1> freeBlocks; //block offsets, by order
+            uint32_t allocatedBlocks = 0;
+        };
+
+        struct MeshRecord {
+            int arena = -1;
+            uint32_t offset = 0; //in blocks
+            int order = 0;
+            uint32_t vertexCount = 0;
+            uint64_t generation = 0;
+        };
+
+        struct MemoryStats {
+            uint64_t compactionMoves = 0;
+            uint64_t compactionBytes = 0;
+            uint64_t arenasCreated = 0;
+            uint64_t arenasReleased = 0;
+        };
+
+        std::vector<Arena> arenas;
+        std::vector<MeshRecord> meshes = { MeshRecord() }; //index 0 is NO_MESH
+        std::vector<MeshHandle> freeHandles;
+        uint64_t nextGeneration = 1;
+        //live meshes by order, sorted by address so compaction can find the highest ones
+        std::array<std::set<std::pair<uint64_t, MeshHandle>>, ARENA_ORDER + 1> meshesByOrder;
+        MemoryStats stats;
+
+        uint64_t address(int arena, uint32_t offset) {
+            return (static_cast<uint64_t>(arena) << 32) | offset;
+        }
+
+        int orderFor(uint32_t vertexCount) {
+            uint32_t blocks = (vertexCount + BLOCK_VERTICES - 1) / BLOCK_VERTICES;
+            int order = 0;
+            while ((1u << order) < blocks) {
+                order++;
+            }
+            return order;
+        }
+
+        int createArena() {
+            int index = 0;
+            while (index < static_cast<int>(arenas.size()) && arenas[index].buffer != render::NO_BUFFER) {
+                index++;
+            }
+            if (index == static_cast<int>(arenas.size())) {
+                arenas.emplace_back();
+            }
+            Arena& arena = arenas[index];
+            arena.buffer = render::device().createBuffer(static_cast<size_t>(BLOCK_BYTES) << ARENA_ORDER, nullptr);
+            arena.freeBlocks[ARENA_ORDER].insert(0);
+            stats.arenasCreated++;
+            return index;
+        }
+
+        void releaseArena(Arena& arena) {
+            render::device().deleteBuffer(arena.buffer);
+            arena.buffer = render::NO_BUFFER;
+            for (auto& blocks : arena.freeBlocks) {
+                blocks.clear();
+            }
+            stats.arenasReleased++;
+        }
+
+        //allocates the front of a free block, splitting off the halves that aren't needed.
+        void takeFreeBlock(int arenaIndex, uint32_t offset, int freeOrder, int order) {
+            Arena& arena = arenas[arenaIndex];
+            arena.freeBlocks[freeOrder].erase(offset);
+            while (freeOrder > order) {
+                freeOrder--;
+                arena.freeBlocks[freeOrder].insert(offset + (1u << freeOrder));
+            }
+            arena.allocatedBlocks += 1u << order;
+        }
+
+        //takes the lowest free block of the smallest order that fits, over all arenas, and splits it down.
+        void allocateBlock(int order, int& arenaIndex, uint32_t& offset) {
+            arenaIndex = -1;
+            int foundOrder = 0;
+            for (int candidateOrder = order; candidateOrder <= ARENA_ORDER && arenaIndex < 0; candidateOrder++) {
+                for (int i = 0; i < static_cast<int>(arenas.size()); i++) {
+                    if (arenas[i].buffer != render::NO_BUFFER && !arenas[i].freeBlocks[candidateOrder].empty()) {
+                        arenaIndex = i;
+                        foundOrder = candidateOrder;
+                        break;
+                    }
+                }
+            }
+            if (arenaIndex < 0) {
+                arenaIndex = createArena();
+                foundOrder = ARENA_ORDER;
+            }
+            offset = *arenas[arenaIndex].freeBlocks[foundOrder].begin();
+            takeFreeBlock(arenaIndex, offset, foundOrder, order);
+        }
+
+        void freeBlock(int arenaIndex, uint32_t offset, int order) {
+            Arena& arena = arenas[arenaIndex];
+            arena.allocatedBlocks -= 1u << order;
+            while (order < ARENA_ORDER) {
+                uint32_t buddy = offset ^ (1u << order);
+                if (arena.freeBlocks[order].erase(buddy) == 0) {
+                    break;
+                }
+                offset = std::min(offset, buddy);
+                order++;
+            }
+            arena.freeBlocks[order].insert(offset);
+        }
+
+        MeshHandle allocate(uint32_t vertexCount) {
+            if (vertexCount == 0) {
+                return NO_MESH;
+            }
+            MeshHandle handle;
+            if (!freeHandles.empty()) {
+                handle = freeHandles.back();
+                freeHandles.pop_back();
+            }
+            else {
+                handle = static_cast<MeshHandle>(meshes.size());
+                meshes.emplace_back();
+            }
+            MeshRecord& mesh = meshes[handle];
+            mesh.order = orderFor(vertexCount);
+            mesh.vertexCount = vertexCount;
+            mesh.generation = nextGeneration++;
+            allocateBlock(mesh.order, mesh.arena, mesh.offset);
+            meshesByOrder[mesh.order].insert({ address(mesh.arena, mesh.offset), handle });
+            return handle;
+        }
+    }
+
+    MeshHandle store(const void* vertices, uint32_t vertexCount) {
+        MeshHandle handle = allocate(vertexCount);
+        if (handle != NO_MESH) {
+            const MeshRecord& mesh = meshes[handle];
+            render::device().uploadBuffer(arenas[mesh.arena].buffer, static_cast<size_t>(mesh.offset) * BLOCK_BYTES, static_cast<size_t>(vertexCount) * VERTEX_BYTES, vertices);
+        }
+        return handle;
+    }
+
+    MeshHandle storeFromBuffer(render::BufferId sourceBuffer, size_t sourceOffset, uint32_t vertexCount) {
+        MeshHandle handle = allocate(vertexCount);
+        if (handle != NO_MESH) {
+            const MeshRecord& mesh = meshes[handle];
+            render::device().copyBuffer(sourceBuffer, sourceOffset, arenas[mesh.arena].buffer, static_cast<size_t>(mesh.offset) * BLOCK_BYTES, static_cast<size_t>(vertexCount) * VERTEX_BYTES);
+        }
+        return handle;
+    }
+
+    void free(MeshHandle handle) {
+        if (handle == NO_MESH) {
+            return;
+        }
+        MeshRecord& mesh = meshes[handle];
+        meshesByOrder[mesh.order].erase({ address(mesh.arena, mesh.offset), handle });
+        freeBlock(mesh.arena, mesh.offset, mesh.order);
+        mesh = MeshRecord();
+        freeHandles.push_back(handle);
+    }
+
+    MeshLocation location(MeshHandle handle) {
+        const MeshRecord& mesh = meshes[handle];
+        return { arenas[mesh.arena].buffer, mesh.arena, static_cast<int32_t>(mesh.offset * BLOCK_VERTICES), mesh.vertexCount };
+    }
+
+    uint64_t allocatedBytes(MeshHandle handle) {
+        return handle == NO_MESH ? 0 : BLOCK_BYTES << meshes[handle].order;
+    }
+
+    uint64_t generation(MeshHandle handle) {
+        return meshes[handle].generation;
+    }
+
+    void compact(size_t maxBytes) {
+        size_t movedBytes = 0;
+        for (int order = 0; order <= ARENA_ORDER && movedBytes < maxBytes; order++) {
+            auto& live = meshesByOrder[order];
+            while (!live.empty() && movedBytes < maxBytes) {
+                //the lowest free block the mesh fits in. every move lowers an address, so this terminates
+                int targetArena = -1;
+                int targetOrder = 0;
+                uint32_t targetOffset = 0;
+                uint64_t targetAddress = UINT64_MAX;
+                for (int i = 0; i < static_cast<int>(arenas.size()); i++) {
+                    if (arenas[i].buffer == render::NO_BUFFER) {
+                        continue;
+                    }
+                    for (int freeOrder = order; freeOrder <= ARENA_ORDER; freeOrder++) {
+                        auto& freeList = arenas[i].freeBlocks[freeOrder];
+                        if (!freeList.empty() && address(i, *freeList.begin()) < targetAddress) {
+                            targetArena = i;
+                            targetOrder = freeOrder;
+                            targetOffset = *freeList.begin();
+                            targetAddress = address(i, targetOffset);
+                        }
+                    }
+                    if (targetArena >= 0) {
+                        break; //later arenas are all at higher addresses
+                    }
+                }
+                auto highest = std::prev(live.end());
+                if (targetArena < 0 || targetAddress > highest->first) {
+                    break;
+                }
+
+                MeshHandle handle = highest->second;
+                MeshRecord& mesh = meshes[handle];
+                live.erase(highest);
+                takeFreeBlock(targetArena, targetOffset, targetOrder, order);
+
+                size_t bytes = static_cast<size_t>(mesh.vertexCount) * VERTEX_BYTES;
+                render::device().copyBuffer(arenas[mesh.arena].buffer, static_cast<size_t>(mesh.offset) * BLOCK_BYTES,
+                    arenas[targetArena].buffer, static_cast<size_t>(targetOffset) * BLOCK_BYTES, bytes);
+                freeBlock(mesh.arena, mesh.offset, order);
+
+                mesh.arena = targetArena;
+                mesh.offset = targetOffset;
+                live.insert({ address(mesh.arena, mesh.offset), handle });
+                movedBytes += bytes;
+                stats.compactionMoves++;
+                stats.compactionBytes += bytes;
+            }
+        }
+
+        //keep the first live arena around even when empty so the next mesh doesn't have to recreate it
+        bool keptOne = false;
+        for (auto& arena : arenas) {
+            if (arena.buffer == render::NO_BUFFER) {
+                continue;
+            }
+            if (arena.allocatedBlocks == 0 && keptOne) {
+                releaseArena(arena);
+            }
+            keptOne = true;
+        }
+    }
+
+    void printStats() {
+        uint64_t capacityBytes = 0, allocatedBytes = 0, usedBytes = 0, freeBytes = 0, largestFreeBytes = 0;
+        size_t liveArenas = 0, liveMeshes = meshes.size() - 1 - freeHandles.size();
+        for (auto& arena : arenas) {
+            if (arena.buffer == render::NO_BUFFER) {
+                continue;
+            }
+            liveArenas++;
+            capacityBytes += BLOCK_BYTES << ARENA_ORDER;
+            allocatedBytes += arena.allocatedBlocks * BLOCK_BYTES;
+            for (int order = 0; order <= ARENA_ORDER; order++) {
+                uint64_t blockBytes = BLOCK_BYTES << order;
+                freeBytes += arena.freeBlocks[order].size() * blockBytes;
+                if (!arena.freeBlocks[order].empty()) {
+                    largestFreeBytes = std::max(largestFreeBytes, blockBytes);
+                }
+            }
+        }
+        for (size_t handle = 1; handle < meshes.size(); handle++) {
+            usedBytes += static_cast<uint64_t>(meshes[handle].vertexCount) * VERTEX_BYTES;
+        }
+        auto megabytes = [](uint64_t bytes) { return bytes / (1024.0 * 1024.0); };
+        auto percent = [](uint64_t part, uint64_t whole) { return whole == 0 ? 0.0 : 100.0 * part / whole; };
+        printf("gpu memory: %zu meshes in %zu arenas, %.1fMB used / %.1fMB allocated / %.1fMB capacity (%.1f%% occupancy)\n",
+            liveMeshes, liveArenas, megabytes(usedBytes), megabytes(allocatedBytes), megabytes(capacityBytes), percent(usedBytes, capacityBytes));
+        printf("gpu memory: %.1f%% internal fragmentation, %.1f%% external fragmentation (largest free block %.1fMB of %.1fMB free)\n",
+            100.0 - percent(usedBytes, allocatedBytes), freeBytes == 0 ? 0.0 : 100.0 - percent(largestFreeBytes, freeBytes),
+            megabytes(largestFreeBytes), megabytes(freeBytes));
+        printf("gpu memory: compaction moved %llu meshes (%.1fMB), %llu arenas created, %llu released\n",
+            static_cast<unsigned long long>(stats.compactionMoves), megabytes(stats.compactionBytes),
+            static_cast<unsigned long long>(stats.arenasCreated), static_cast<unsigned long long>(stats.arenasReleased));
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "renderdevice.h"
+#include <cstdint>
+#include <cstddef>
+
+//chunk meshes are suballocated from a few large vertex buffers ("arenas") instead of getting a buffer
+//object each. every arena is a buddy allocator over blocks of BLOCK_VERTICES vertices, so a mesh takes
+//the next power of two number of blocks and freed blocks merge back with their buddy. meshes are
+//referred to by handle, which lets compact() move them to lower addresses (and out of arenas that can
+//then be released) without their owners noticing.
+namespace gpumem {
+    const uint32_t VERTEX_BYTES = 12; //sizeof(ChunkVertexFormat)
+    const uint32_t BLOCK_VERTICES = 256;
+    const int ARENA_ORDER = 15; //an arena is one block of this order
+    const uint32_t ARENA_VERTICES = BLOCK_VERTICES << ARENA_ORDER; //96MB
+    const size_t MAX_COMPACTION_BYTES_PER_PASS = 4 << 20;
+
+    typedef uint32_t MeshHandle;
+    const MeshHandle NO_MESH = 0;
+
+    struct MeshLocation {
+        render::BufferId buffer;
+        int arena;
+        int32_t baseVertex;
+        uint32_t vertexCount;
+    };
+
+    //allocates space for the vertices and uploads them. returns NO_MESH for an empty mesh.
+    MeshHandle store(const void* vertices, uint32_t vertexCount);
+    //same, copying the vertices on the GPU from another buffer.
+    MeshHandle storeFromBuffer(render::BufferId sourceBuffer, size_t sourceOffset, uint32_t vertexCount);
+    //NO_MESH is ignored.
+    void free(MeshHandle mesh);
+    MeshLocation location(MeshHandle mesh);
+    //the size of the mesh's block, 0 for NO_MESH.
+    uint64_t allocatedBytes(MeshHandle mesh);
+    //unique to each store, unlike handles which are reused after free. compaction keeps it. 0 for NO_MESH.
+    uint64_t generation(MeshHandle mesh);
+
+    //moves meshes into free blocks at lower addresses, copying at most maxBytes on the GPU, so free
+    //space coalesces into large blocks and arenas that end up empty are released.
+    void compact(size_t maxBytes);
+
+    void printStats();
+}
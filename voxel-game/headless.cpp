@@ -0,0 +1,398 @@
+#include "headless.h"
+#include "chunkio.h"
+#include "clipmap.h"
+#include "draw.h"
+#include "edit.h"
+#include "light.h"
+#include "lod.h"
+#include "physics.h"
+#include "raycast.h"
+#include "residency.h"
+#include "simulation.h"
+#include "viewer.h"
+#include "worldgen.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__) && defined(VOXEL_USE_EGL)
+#include "glad.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+namespace headless {
+    namespace {
+        const float FRAME_SECONDS = 1.f / 60.f; //simulated time per frame, for the viewer's motion prediction and the fixed ticks
+
+        struct Keyframe {
+            vec3 position;
+            vec2 rotation;
+        };
+
+        //a square loop over the terrain around the spawn, turning towards each next corner. 768 blocks, about
+        //the speed of flying in the game over the default 600 frames at 60fps
+        const std::vector<Keyframe> DEFAULT_PATH = {
+            { { 128.f, 200.f, 128.f }, { 1.57f, 0.3f } },
+            { { 320.f, 200.f, 128.f }, { 3.14f, 0.3f } },
+            { { 320.f, 200.f, 320.f }, { 4.71f, 0.3f } },
+            { { 128.f, 200.f, 320.f }, { 6.28f, 0.3f } },
+            { { 128.f, 200.f, 128.f }, { 7.85f, 0.3f } },
+        };
+
+        struct FrameRecord {
+            double frameMilliseconds; //until the device finished the frame
+            double cpuMilliseconds;   //until the frame was submitted
+            DrawStats drawStats;
+        };
+
+        bool loadPath(const std::string& fileName, std::vector<Keyframe>& path) {
+            std::ifstream file(fileName);
+            if (!file.is_open()) {
+                std::cout << "failed to open camera path " << fileName << std::endl;
+                return false;
+            }
+            Keyframe keyframe;
+            while (file >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z >> keyframe.rotation.x >> keyframe.rotation.y) {
+                path.push_back(keyframe);
+            }
+            if (path.empty()) {
+                std::cout << "camera path " << fileName << " has no keyframes" << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        //t from 0 at the first keyframe to 1 at the last, linear in between.
+        Keyframe pathAt(const std::vector<Keyframe>& path, float t) {
+            float segment = glm::clamp(t, 0.f, 1.f) * (path.size() - 1);
+            size_t first = std::min(static_cast<size_t>(segment), path.size() - 1);
+            size_t second = std::min(first + 1, path.size() - 1);
+            float blend = segment - first;
+            return { glm::mix(path[first].position, path[second].position, blend), glm::mix(path[first].rotation, path[second].rotation, blend) };
+        }
+
+        //everything the windowed main loop does in a frame, short of input and presenting. the camera follows the
+        //path rather than a physics body, but bodies and block rules still tick.
+        void stepFrame(int frame) {
+            chunkio::update();
+            worldgen::update();
+            drawFrame();
+            viewer::recordFrame(matrix::projection * matrix::view);
+            residency::update();
+            if (frame % 10 == 0) {
+                gpumem::compact(gpumem::MAX_COMPACTION_BYTES_PER_PASS);
+                setChunksToDraw();
+            }
+            physics::update(FRAME_SECONDS);
+            simulation::update(FRAME_SECONDS);
+        }
+
+        //everything in range has been loaded or generated and meshed.
+        bool isStreamingSettled() {
+            if (chunksThatShouldBeDrawn.empty() || !chunksRequiringBufferUpdates.empty()) {
+                return false;
+            }
+            for (auto& posAndLod : chunksThatShouldBeDrawn) {
+                if (chunkGLBuffers.find(posAndLod) == chunkGLBuffers.end()) {
+                    return false;
+                }
+            }
+            return light::isSettled() && lod::isSettled() && clipmap::isSettled();
+        }
+
+        double percentile(const std::vector<double>& sorted, double fraction) {
+            return sorted[std::min(static_cast<size_t>(fraction * sorted.size()), sorted.size() - 1)];
+        }
+
+        void writeStats(const std::string& fileName, const std::vector<FrameRecord>& records) {
+            std::ofstream file(fileName);
+            if (!file.is_open()) {
+                std::cout << "failed to write frame stats to " << fileName << std::endl;
+                return;
+            }
+            file << "frame,frameMs,cpuMs,chunks,culled,occluded,hidden,panels,backFacingPanels,drawCalls,deviceCalls,shadowCascades,shadowDrawCalls\n";
+            for (size_t i = 0; i < records.size(); i++) {
+                const FrameRecord& record = records[i];
+                const DrawStats& stats = record.drawStats;
+                file << i << ',' << record.frameMilliseconds << ',' << record.cpuMilliseconds << ','
+                    << stats.chunks << ',' << stats.culled << ',' << stats.occluded << ',' << stats.hidden << ','
+                    << stats.panels << ',' << stats.backFacingPanels << ',' << stats.drawCalls << ',' << stats.deviceCalls << ','
+                    << stats.shadowCascades << ',' << stats.shadowDrawCalls << '\n';
+            }
+        }
+
+#if defined(__linux__) && defined(VOXEL_USE_EGL)
+        struct OffscreenContext {
+            EGLDisplay display = EGL_NO_DISPLAY;
+            EGLContext context = EGL_NO_CONTEXT;
+            GLuint framebuffer = 0;
+            GLuint renderbuffers[2] = {}; //color, depth
+        };
+        OffscreenContext offscreen;
+
+        //a GL 4.3 core context without any surface, drawing into its own framebuffer.
+        bool createOffscreenContext(int width, int height) {
+            auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+            if (getPlatformDisplay != nullptr) {
+                offscreen.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+            }
+            if (offscreen.display == EGL_NO_DISPLAY) {
+                offscreen.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            }
+            if (offscreen.display == EGL_NO_DISPLAY || !eglInitialize(offscreen.display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API)) {
+                std::cout << "failed to initialize EGL" << std::endl;
+                return false;
+            }
+            const EGLint contextAttributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 4,
+                EGL_CONTEXT_MINOR_VERSION, 3,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+            };
+            //no config: EGL_KHR_no_config_context, and no surface: EGL_KHR_surfaceless_context
+            offscreen.context = eglCreateContext(offscreen.display, nullptr, EGL_NO_CONTEXT, contextAttributes);
+            if (offscreen.context == EGL_NO_CONTEXT || !eglMakeCurrent(offscreen.display, EGL_NO_SURFACE, EGL_NO_SURFACE, offscreen.context)) {
+                std::cout << "failed to create a surfaceless GL 4.3 context" << std::endl;
+                return false;
+            }
+            if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress))) {
+                std::cout << "Failed to initialize GLAD" << std::endl;
+                return false;
+            }
+
+            glGenFramebuffers(1, &offscreen.framebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, offscreen.framebuffer);
+            glGenRenderbuffers(2, offscreen.renderbuffers);
+            glBindRenderbuffer(GL_RENDERBUFFER, offscreen.renderbuffers[0]);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreen.renderbuffers[0]);
+            glBindRenderbuffer(GL_RENDERBUFFER, offscreen.renderbuffers[1]);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, offscreen.renderbuffers[1]);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cout << "offscreen framebuffer is incomplete" << std::endl;
+                return false;
+            }
+            std::cout << "headless rendering on " << glGetString(GL_RENDERER) << std::endl;
+            return true;
+        }
+
+        void destroyOffscreenContext() {
+            if (offscreen.framebuffer != 0) {
+                glDeleteFramebuffers(1, &offscreen.framebuffer);
+                glDeleteRenderbuffers(2, offscreen.renderbuffers);
+            }
+            if (offscreen.display != EGL_NO_DISPLAY) {
+                eglMakeCurrent(offscreen.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                if (offscreen.context != EGL_NO_CONTEXT) {
+                    eglDestroyContext(offscreen.display, offscreen.context);
+                }
+                eglTerminate(offscreen.display);
+            }
+            offscreen = OffscreenContext();
+        }
+
+        void dumpFrame(const std::string& directory, int frame, int width, int height) {
+            std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            char fileName[32];
+            snprintf(fileName, sizeof(fileName), "frame%05d.ppm", frame);
+            std::ofstream file(std::filesystem::path(directory) / fileName, std::ios::binary);
+            file << "P6 " << width << ' ' << height << " 255\n";
+            //GL rows go bottom up
+            for (int y = height - 1; y >= 0; y--) {
+                for (int x = 0; x < width; x++) {
+                    file.write(reinterpret_cast<const char*>(&pixels[(static_cast<size_t>(y) * width + x) * 4]), 3);
+                }
+            }
+        }
+#endif
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 0; i < argc; i++) {
+            std::string argument = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (argument == "--frames" && hasValue) {
+                options.frames = atoi(argv[++i]);
+            }
+            else if (argument == "--fps" && hasValue) {
+                options.framesPerSecond = atoi(argv[++i]);
+            }
+            else if (argument == "--size" && hasValue) {
+                if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2) {
+                    options.width = 0;
+                }
+            }
+            else if (argument == "--recording-device") {
+                options.recordingDevice = true;
+            }
+            else if (argument == "--world" && hasValue) {
+                options.world = argv[++i];
+            }
+            else if (argument == "--path" && hasValue) {
+                options.pathFile = argv[++i];
+            }
+            else if (argument == "--stats" && hasValue) {
+                options.statsFile = argv[++i];
+            }
+            else if (argument == "--dump" && hasValue) {
+                options.dumpDirectory = argv[++i];
+            }
+            else if (argument == "--dump-interval" && hasValue) {
+                options.dumpInterval = atoi(argv[++i]);
+            }
+            else if (argument == "--gpu-budget" && hasValue) {
+                options.gpuBudgetMegabytes = atoi(argv[++i]);
+            }
+            else if (argument == "--max-warmup" && hasValue) {
+                options.maxWarmupFrames = atoi(argv[++i]);
+            }
+            else {
+                std::cout << "unknown headless option " << argument << std::endl;
+                options.frames = 0;
+                break;
+            }
+        }
+        if (options.frames <= 0 || options.framesPerSecond < 0 || options.width <= 0 || options.height <= 0 || options.dumpInterval <= 0) {
+            std::cout << "usage: --headless [--frames N] [--fps N] [--size WxH] [--recording-device] [--world DIR] [--path FILE]\n"
+                << "                  [--stats FILE.csv] [--dump DIR] [--dump-interval N] [--gpu-budget MB] [--max-warmup N]" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    int run(const Options& options) {
+        std::vector<Keyframe> path = DEFAULT_PATH;
+        if (!options.pathFile.empty()) {
+            path.clear();
+            if (!loadPath(options.pathFile, path)) {
+                return 1;
+            }
+        }
+
+        bool dumpFrames = !options.dumpDirectory.empty();
+        if (options.recordingDevice) {
+            render::setDevice(render::createRecordingDevice());
+            if (dumpFrames) {
+                std::cout << "the recording device draws nothing, not dumping frames" << std::endl;
+                dumpFrames = false;
+            }
+        }
+        else {
+#if defined(__linux__) && defined(VOXEL_USE_EGL)
+            if (!createOffscreenContext(options.width, options.height)) {
+                destroyOffscreenContext();
+                return 1;
+            }
+            render::setDevice(render::createGLDevice(reinterpret_cast<render::ProcLoader>(eglGetProcAddress)));
+#else
+            std::cout << "headless GL rendering needs a linux build with VOXEL_USE_EGL, use --recording-device instead" << std::endl;
+            return 1;
+#endif
+        }
+        if (dumpFrames) {
+            std::filesystem::create_directories(options.dumpDirectory);
+        }
+
+        if (options.gpuBudgetMegabytes > 0) {
+            residency::setBudget(static_cast<uint64_t>(options.gpuBudgetMegabytes) << 20);
+        }
+        uploadring::init();
+        chunkio::init(options.world);
+        render::device().setViewport(options.width, options.height);
+        matrix::projection = perspective(2.1f, static_cast<float>(options.width) / static_cast<float>(options.height), 0.1f, FAR_PLANE);
+        drawSetup();
+
+        //stream in everything around the start of the path first, so runs measure rendering and the
+        //streaming caused by moving rather than how long the initial load happened to take
+        Keyframe start = pathAt(path, 0.f);
+        viewerPosition = start.position;
+        rotation = start.rotation;
+        int warmupFrames = 0;
+        while (warmupFrames < options.maxWarmupFrames && !isStreamingSettled()) {
+            stepFrame(warmupFrames);
+            render::device().finish();
+            viewer::update(viewerPosition, rotation, FRAME_SECONDS);
+            warmupFrames++;
+            //with the recording device frames are nearly free, this leaves the workers time to finish
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+
+        std::vector<FrameRecord> records;
+        records.reserve(options.frames);
+        for (int frame = 0; frame < options.frames; frame++) {
+            Keyframe keyframe = pathAt(path, options.frames > 1 ? static_cast<float>(frame) / (options.frames - 1) : 0.f);
+            viewerPosition = keyframe.position;
+            rotation = keyframe.rotation;
+
+            auto frameStart = std::chrono::steady_clock::now();
+            stepFrame(warmupFrames + frame);
+            auto submitted = std::chrono::steady_clock::now();
+            render::device().finish();
+            auto finished = std::chrono::steady_clock::now();
+            records.push_back({
+                std::chrono::duration<double, std::milli>(finished - frameStart).count(),
+                std::chrono::duration<double, std::milli>(submitted - frameStart).count(),
+                drawStats
+            });
+            viewer::update(viewerPosition, rotation, FRAME_SECONDS);
+
+#if defined(__linux__) && defined(VOXEL_USE_EGL)
+            if (dumpFrames && frame % options.dumpInterval == 0) {
+                dumpFrame(options.dumpDirectory, frame, options.width, options.height);
+            }
+#endif
+            if (options.framesPerSecond > 0) {
+                std::this_thread::sleep_until(frameStart + std::chrono::microseconds(1000000 / options.framesPerSecond));
+            }
+        }
+
+        std::vector<double> frameTimes;
+        double totalFrameMilliseconds = 0.0, totalCpuMilliseconds = 0.0;
+        for (auto& record : records) {
+            frameTimes.push_back(record.frameMilliseconds);
+            totalFrameMilliseconds += record.frameMilliseconds;
+            totalCpuMilliseconds += record.cpuMilliseconds;
+        }
+        std::sort(frameTimes.begin(), frameTimes.end());
+        printf("headless: %d frames at %dx%d on the %s device after %d warmup frames%s\n",
+            options.frames, options.width, options.height, options.recordingDevice ? "recording" : "GL", warmupFrames,
+            warmupFrames == options.maxWarmupFrames ? " (streaming hadn't settled)" : "");
+        printf("headless: frame time mean %.2fms, median %.2fms, 95th %.2fms, 99th %.2fms, max %.2fms; cpu mean %.2fms\n",
+            totalFrameMilliseconds / records.size(), percentile(frameTimes, 0.5), percentile(frameTimes, 0.95),
+            percentile(frameTimes, 0.99), frameTimes.back(), totalCpuMilliseconds / records.size());
+        chunkio::printStats();
+        viewer::printStats();
+        worldgen::printStats();
+        gpumem::printStats();
+        residency::printStats();
+        light::printStats();
+        edit::printStats();
+        raycast::printStats();
+        physics::printStats();
+        simulation::printStats();
+        lod::printStats();
+        clipmap::printStats();
+        uploadring::printStats();
+        render::printStats();
+        if (!options.statsFile.empty()) {
+            writeStats(options.statsFile, records);
+        }
+
+        chunkio::shutdown();
+        uploadring::shutdown();
+        render::setDevice(nullptr);
+#if defined(__linux__) && defined(VOXEL_USE_EGL)
+        destroyOffscreenContext();
+#endif
+        return 0;
+    }
+}
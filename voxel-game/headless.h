@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+
+//renders without a window, for benchmarks on build machines without a GPU or display. frames go to an
+//offscreen framebuffer on an EGL surfaceless context (Mesa llvmpipe is enough) on linux builds with
+//VOXEL_USE_EGL defined, or to the recording device with no GL at all. the camera flies a scripted path
+//for a fixed number of frames after waiting for streaming to settle at its start, so runs are comparable.
+//frame times are measured up to the device finishing the frame, before any pacing.
+namespace headless {
+    struct Options {
+        int frames = 600;
+        int framesPerSecond = 60;   //frames are paced like with vsync so streaming keeps up as in the game. 0 runs them back to back
+        int width = 800;
+        int height = 600;
+        bool recordingDevice = false;
+        std::string world = "world";
+        std::string pathFile;       //"x y z yaw pitch" keyframes, one per line, spread evenly over the run. empty for the built-in path
+        std::string statsFile;      //per-frame times and draw stats as CSV
+        std::string dumpDirectory;  //every dumpInterval-th frame as a PPM image
+        int dumpInterval = 60;
+        int gpuBudgetMegabytes = 0; //for chunk meshes, 0 for residency's default
+        int maxWarmupFrames = 3000;
+    };
+
+    //the arguments after --headless. prints usage and returns false on anything it doesn't know.
+    bool parseOptions(int argc, char** argv, Options& options);
+    //returns the process exit code.
+    int run(const Options& options);
+}
@@ -0,0 +1,64 @@
+#include "heightmap.h"
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <mutex>
+
+#include "glm/gtc/noise.hpp"
+
+namespace heightmap {
+    namespace {
+        std::mutex columnsMutex;
+        std::unordered_map<ivec2, std::unique_ptr<ColumnHeights>> columns;
+
+        std::unique_ptr<ColumnHeights> buildColumn(ivec2 columnKey) {
+            auto heights = std::make_unique<ColumnHeights>();
+            heights->minSurface = INT_MAX;
+            heights->maxSurface = INT_MIN;
+            for (int z = 0; z < BLOCKS_PER_SIDE; z++) {
+                int rowMin = INT_MAX;
+                int rowMax = INT_MIN;
+                for (int x = 0; x < BLOCKS_PER_SIDE; x++) {
+                    vec2 blockPosition = vec2{ columnKey.x * BLOCKS_PER_SIDE + x, columnKey.y * BLOCKS_PER_SIDE + z };
+                    //y < height is solid, so the first air block is the height rounded up
+                    int surface = static_cast<int>(ceilf(terrainHeight(blockPosition)));
+                    heights->surface[x + BLOCKS_PER_SIDE * z] = surface;
+                    rowMin = std::min(rowMin, surface);
+                    rowMax = std::max(rowMax, surface);
+                }
+                heights->rowMinSurface[z] = rowMin;
+                heights->rowMaxSurface[z] = rowMax;
+                heights->minSurface = std::min(heights->minSurface, rowMin);
+                heights->maxSurface = std::max(heights->maxSurface, rowMax);
+            }
+            return heights;
+        }
+    }
+
+    float terrainHeight(vec2 blockPosition) {
+        float noiseSample = glm::perlin(blockPosition * 0.16f) * 0.5f
+            + glm::perlin(blockPosition * 0.04f)
+            + glm::perlin(blockPosition * 0.01f) * 1.5f
+            + glm::perlin(blockPosition * 0.0025f) * 5.0f
+            + glm::perlin(blockPosition * 0.0007f) * 25.0f;
+        return noiseSample * 8.0f + 128.0f;
+    }
+
+    const ColumnHeights& column(ivec2 columnKey) {
+        {
+            std::lock_guard<std::mutex> lock(columnsMutex);
+            auto iter = columns.find(columnKey);
+            if (iter != columns.end()) {
+                return *iter->second;
+            }
+        }
+        //sample outside the lock; if another thread won the race its copy is kept
+        auto heights = buildColumn(columnKey);
+        std::lock_guard<std::mutex> lock(columnsMutex);
+        auto& entry = columns[columnKey];
+        if (!entry) {
+            entry = std::move(heights);
+        }
+        return *entry;
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "chunk.h"
+
+//terrain surface heights for one 16x16 column of blocks. built once per column and shared by every
+//chunk stacked in it, so generation and visibility never re-sample the 2D noise for a column.
+struct ColumnHeights {
+    std::array<int, BLOCKS_PER_SIDE * BLOCKS_PER_SIDE> surface; //first air block y, indexed x + BLOCKS_PER_SIDE * z
+    std::array<int, BLOCKS_PER_SIDE> rowMinSurface; //per z
+    std::array<int, BLOCKS_PER_SIDE> rowMaxSurface;
+    int minSurface;
+    int maxSurface;
+};
+
+namespace heightmap {
+    float terrainHeight(vec2 blockPosition);
+
+    //safe to call from any thread. references stay valid for the lifetime of the program.
+    const ColumnHeights& column(ivec2 columnKey);
+}
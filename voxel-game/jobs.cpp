@@ -0,0 +1,101 @@
+#include "jobs.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    workers.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; i++) {
+        workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.push_back(std::move(job));
+    }
+    queueCondition.notify_one();
+}
+
+void ThreadPool::waitIdle() {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    idleCondition.wait(lock, [this]() { return queue.empty() && runningJobs == 0; });
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return; //stopping and drained
+            }
+            job = std::move(queue.front());
+            queue.pop_front();
+            runningJobs++;
+        }
+        job();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            runningJobs--;
+            if (queue.empty() && runningJobs == 0) {
+                idleCondition.notify_all();
+            }
+        }
+    }
+}
+
+ThreadPool& workerPool() {
+    static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    return pool;
+}
+
+void parallelRanges(size_t count, size_t rangeSize, const std::function<void(size_t, size_t)>& visit) {
+    struct Ranges {
+        std::atomic<size_t> next{ 0 };
+        size_t finished = 0;
+        std::mutex mutex;
+        std::condition_variable allFinished;
+    };
+    size_t rangeCount = (count + rangeSize - 1) / rangeSize;
+    auto ranges = std::make_shared<Ranges>();
+    //a helper that starts after everything is claimed returns without touching visit, which may be gone by then
+    const std::function<void(size_t, size_t)>* target = &visit;
+    auto drain = [ranges, rangeCount, count, rangeSize, target]() {
+        size_t done = 0;
+        for (size_t range = ranges->next++; range < rangeCount; range = ranges->next++) {
+            (*target)(range * rangeSize, std::min(count, (range + 1) * rangeSize));
+            done++;
+        }
+        if (done > 0) {
+            std::lock_guard<std::mutex> lock(ranges->mutex);
+            ranges->finished += done;
+            if (ranges->finished == rangeCount) {
+                ranges->allFinished.notify_all();
+            }
+        }
+    };
+    size_t helpers = std::min<size_t>(rangeCount > 0 ? rangeCount - 1 : 0, workerPool().size());
+    for (size_t i = 0; i < helpers; i++) {
+        workerPool().submit(drain);
+    }
+    drain();
+    std::unique_lock<std::mutex> lock(ranges->mutex);
+    ranges->allFinished.wait(lock, [&]() { return ranges->finished == rangeCount; });
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+//fixed-size pool of worker threads pulling jobs off a shared FIFO queue.
+class ThreadPool {
+public:
+    ThreadPool(unsigned int threadCount);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> job);
+    //blocks until the queue is empty and no worker is running a job.
+    void waitIdle();
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::condition_variable idleCondition;
+    unsigned int runningJobs = 0;
+    bool stopping = false;
+};
+
+//shared pool for cpu-bound work such as meshing. one thread is left for the render loop.
+ThreadPool& workerPool();
+
+//runs visit(first, last) over ranges of rangeSize covering [0, count) on the calling thread and on spare workers,
+//and returns when all are done. ranges are claimed through a shared index the caller drains too, so it finishes
+//whatever no worker has picked up instead of waiting behind jobs queued ahead of the helpers.
+void parallelRanges(size_t count, size_t rangeSize, const std::function<void(size_t, size_t)>& visit);
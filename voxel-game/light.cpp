@@ -0,0 +1,461 @@
+#include <future>
+#include <chrono>
+#include <list>
+#include <algorithm>
+#include <climits>
+#include "light.h"
+#include "jobs.h"
+#include "lod.h"
+#include "viewer.h"
+#include "worldgen.h"
+
+namespace light {
+    namespace {
+        enum Channel { SKY, BLOCK };
+        const int DOWN = 2; //face numbers as in ADJACENT_CHUNK_OFFSETS
+        const int FACE_CELLS = BLOCKS_PER_SIDE * BLOCKS_PER_SIDE;
+        const std::array<int, 3> AXIS_STRIDES = { 1, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE * BLOCKS_PER_SIDE };
+
+        typedef std::array<std::array<uint8_t, FACE_CELLS>, 6> BorderLevels;
+
+        //a chunk's blocks and what its neighbors shine into it, copied for the job.
+        struct JobInput {
+            BlockList blocks;
+            BorderLevels skyIn; //levels of the neighbors' cells facing the chunk, by face and borderIndex slot
+            BorderLevels blockIn;
+        };
+        struct JobResult {
+            NibbleList skyLight;
+            NibbleList blockLight;
+            uint64_t steps = 0;
+        };
+        struct PendingJob {
+            ChunkKey key;
+            std::future<JobResult> result;
+        };
+
+        struct Cell {
+            ChunkKey key;
+            PerChunkState* chunk;
+            int index;
+        };
+        struct Removed {
+            Cell cell;
+            uint8_t level;
+        };
+
+        struct LightStats {
+            uint64_t jobs = 0;
+            uint64_t jobSteps = 0;
+            uint64_t staleJobs = 0;
+            uint64_t floodSteps = 0; //on the main thread
+            uint64_t removalSteps = 0;
+            uint64_t blockChanges = 0;
+            uint64_t remeshes = 0;
+            double mainThreadMs = 0.0;
+        };
+
+        std::vector<ChunkKey> queued; //inserted and waiting for a job slot
+        std::list<PendingJob> jobs;
+        std::unordered_set<ChunkKey> pending; //queued or in a job, so their light isn't there yet
+        std::unordered_set<ChunkKey> stale; //changed while their job ran, so its result is thrown away
+        std::unordered_set<ChunkKey> relit;
+        ChunkKey lastRelit = ChunkKey{ INT_MIN };
+        std::array<std::vector<Cell>, 2> floodQueues;
+        LightStats stats;
+
+        NibbleList& levelsOf(PerChunkState& chunk, Channel channel) {
+            return channel == SKY ? chunk.skyLight : chunk.blockLight;
+        }
+
+        //the level light at level has in the next cell across face. sky light at full strength doesn't fade going down.
+        uint8_t spread(Channel channel, uint8_t level, int face) {
+            if (channel == SKY && face == DOWN && level == MAX_LIGHT) {
+                return MAX_LIGHT;
+            }
+            return level > 0 ? level - 1 : 0;
+        }
+
+        //the cell at slot i + BLOCKS_PER_SIDE * j of the chunk's side facing ADJACENT_CHUNK_OFFSETS[face]. the
+        //cell it touches in the neighbor is borderIndex(face ^ 1, i, j).
+        int borderIndex(int face, int i, int j) {
+            int axis = face / 2;
+            ivec3 coords;
+            coords[axis] = face & 1 ? BLOCKS_PER_SIDE - 1 : 0;
+            coords[(axis + 1) % 3] = i;
+            coords[(axis + 2) % 3] = j;
+            return getChunkIndex(coords);
+        }
+
+        //false if index is on the chunk's side facing face.
+        bool stepInside(int index, int face, int& next) {
+            int axis = face / 2;
+            int coord = index / AXIS_STRIDES[axis] % BLOCKS_PER_SIDE;
+            if (face & 1 ? coord == BLOCKS_PER_SIDE - 1 : coord == 0) {
+                return false;
+            }
+            next = index + (face & 1 ? AXIS_STRIDES[axis] : -AXIS_STRIDES[axis]);
+            return true;
+        }
+
+        //a job running on what the chunk or its neighbors were before is thrown away and redone.
+        void restartIfRunning(ChunkKey key) {
+            for (auto& job : jobs) {
+                if (job.key == key) {
+                    stale.insert(key);
+                }
+            }
+        }
+
+        bool isOpenSky(ChunkKey key) {
+            return perChunkState.find(key) == perChunkState.end() && worldgen::isEmptySky(key);
+        }
+
+        //a resident chunk whose light is there to be read and changed.
+        PerChunkState* litChunk(ChunkKey key) {
+            if (pending.count(key) != 0) {
+                return nullptr;
+            }
+            auto iter = perChunkState.find(key);
+            return iter == perChunkState.end() ? nullptr : &iter->second;
+        }
+
+        //false if the cell across face is in a chunk that can't be lit now.
+        bool step(const Cell& cell, int face, Cell& next) {
+            if (stepInside(cell.index, face, next.index)) {
+                next.key = cell.key;
+                next.chunk = cell.chunk;
+                return true;
+            }
+            next.key = cell.key + ADJACENT_CHUNK_OFFSETS[face];
+            next.chunk = litChunk(next.key);
+            next.index = cell.index - (face & 1 ? AXIS_STRIDES[face / 2] : -AXIS_STRIDES[face / 2]) * (BLOCKS_PER_SIDE - 1);
+            return next.chunk != nullptr;
+        }
+
+        //the meshes of the cell's chunk and of whichever neighbor it borders can show its light.
+        void touched(const Cell& cell) {
+            if (cell.key != lastRelit) {
+                relit.insert(cell.key);
+                lastRelit = cell.key;
+            }
+            for (int face = 0; face < 6; face++) {
+                int next;
+                if (!stepInside(cell.index, face, next)) {
+                    relit.insert(cell.key + ADJACENT_CHUNK_OFFSETS[face]);
+                }
+            }
+        }
+
+        //light at level, arriving across face, brightens the cell if it is air.
+        void reach(Channel channel, uint8_t level, int face, const Cell& cell, std::vector<Cell>& queue) {
+            if (cell.chunk->blocks[cell.index] != AIR) {
+                return;
+            }
+            NibbleList& levels = levelsOf(*cell.chunk, channel);
+            uint8_t reached = spread(channel, level, face);
+            if (reached > getNibble(levels, cell.index)) {
+                setNibble(levels, cell.index, reached);
+                touched(cell);
+                queue.push_back(cell);
+            }
+        }
+
+        //spreads the light of the queued cells as far as it goes, across chunks.
+        void flood(Channel channel, std::vector<Cell>& queue) {
+            for (size_t i = 0; i < queue.size(); i++) {
+                Cell cell = queue[i];
+                uint8_t level = getNibble(levelsOf(*cell.chunk, channel), cell.index);
+                for (int face = 0; face < 6; face++) {
+                    Cell next;
+                    if (step(cell, face, next)) {
+                        reach(channel, level, face, next, queue);
+                    }
+                }
+            }
+            stats.floodSteps += queue.size();
+            queue.clear();
+        }
+
+        //darkens everything that was lit through the removed cells, which are already dark, and queues the lit
+        //cells around the darkened area to flood back into it.
+        void unflood(Channel channel, std::vector<Removed>& removals, std::vector<Cell>& refill) {
+            for (size_t i = 0; i < removals.size(); i++) {
+                Removed removed = removals[i];
+                for (int face = 0; face < 6; face++) {
+                    Cell next;
+                    if (!step(removed.cell, face, next)) {
+                        restartIfRunning(removed.cell.key + ADJACENT_CHUNK_OFFSETS[face]);
+                        //open sky shines back in at the borders
+                        if (channel == SKY && removed.cell.chunk->blocks[removed.cell.index] == AIR
+                            && isOpenSky(removed.cell.key + ADJACENT_CHUNK_OFFSETS[face])) {
+                            reach(SKY, MAX_LIGHT, face ^ 1, removed.cell, refill);
+                        }
+                        continue;
+                    }
+                    NibbleList& levels = levelsOf(*next.chunk, channel);
+                    uint8_t level = getNibble(levels, next.index);
+                    if (level == 0) {
+                        continue;
+                    }
+                    bool litThrough = level < removed.level || (channel == SKY && face == DOWN && level == MAX_LIGHT && removed.level == MAX_LIGHT);
+                    if (!litThrough) {
+                        refill.push_back(next);
+                        continue;
+                    }
+                    setNibble(levels, next.index, 0);
+                    touched(next);
+                    removals.push_back({ next, level });
+                    uint8_t emitted = channel == BLOCK ? emission(next.chunk->blocks[next.index]) : 0;
+                    if (emitted > 0) {
+                        setNibble(levels, next.index, emitted);
+                        refill.push_back(next);
+                    }
+                }
+            }
+            stats.removalSteps += removals.size();
+            removals.clear();
+        }
+
+        JobResult computeLight(std::shared_ptr<const JobInput> input) {
+            JobResult result;
+            result.skyLight.fill(0);
+            result.blockLight.fill(0);
+            std::vector<uint16_t> queue;
+            queue.reserve(VOLUME);
+            for (Channel channel : { SKY, BLOCK }) {
+                NibbleList& levels = channel == SKY ? result.skyLight : result.blockLight;
+                const BorderLevels& in = channel == SKY ? input->skyIn : input->blockIn;
+                auto reachInside = [&](uint8_t level, int face, int index) {
+                    if (input->blocks[index] != AIR) {
+                        return;
+                    }
+                    uint8_t reached = spread(channel, level, face);
+                    if (reached > getNibble(levels, index)) {
+                        setNibble(levels, index, reached);
+                        queue.push_back(static_cast<uint16_t>(index));
+                    }
+                };
+                for (int face = 0; face < 6; face++) {
+                    for (int j = 0; j < BLOCKS_PER_SIDE; j++) {
+                        for (int i = 0; i < BLOCKS_PER_SIDE; i++) {
+                            //light from the neighbor travels the other way
+                            reachInside(in[face][i + BLOCKS_PER_SIDE * j], face ^ 1, borderIndex(face, i, j));
+                        }
+                    }
+                }
+                if (channel == BLOCK) {
+                    for (int index = 0; index < VOLUME; index++) {
+                        uint8_t emitted = emission(input->blocks[index]);
+                        if (emitted > 0) {
+                            setNibble(levels, index, emitted);
+                            queue.push_back(static_cast<uint16_t>(index));
+                        }
+                    }
+                }
+                for (size_t i = 0; i < queue.size(); i++) {
+                    int index = queue[i];
+                    uint8_t level = getNibble(levels, index);
+                    for (int face = 0; face < 6; face++) {
+                        int next;
+                        if (stepInside(index, face, next)) {
+                            reachInside(level, face, next);
+                        }
+                    }
+                }
+                result.steps += queue.size();
+                queue.clear();
+            }
+            return result;
+        }
+
+        void submitJob(ChunkKey key) {
+            auto input = std::make_shared<JobInput>();
+            input->blocks = perChunkState[key].blocks;
+            for (int face = 0; face < 6; face++) {
+                ChunkKey neighborKey = key + ADJACENT_CHUNK_OFFSETS[face];
+                PerChunkState* neighbor = litChunk(neighborKey);
+                bool sky = neighbor == nullptr && isOpenSky(neighborKey);
+                for (int j = 0; j < BLOCKS_PER_SIDE; j++) {
+                    for (int i = 0; i < BLOCKS_PER_SIDE; i++) {
+                        int slot = i + BLOCKS_PER_SIDE * j;
+                        int facing = borderIndex(face ^ 1, i, j);
+                        input->skyIn[face][slot] = neighbor ? getNibble(neighbor->skyLight, facing) : sky ? MAX_LIGHT : 0;
+                        input->blockIn[face][slot] = neighbor ? getNibble(neighbor->blockLight, facing) : 0;
+                    }
+                }
+            }
+            auto job = std::make_shared<std::packaged_task<JobResult()>>(std::bind(&computeLight, input));
+            jobs.push_back({ key, job->get_future() });
+            workerPool().submit([job]() { (*job)(); });
+            stats.jobs++;
+        }
+
+        //stores a finished job and floods across the chunk's sides both ways, so light that reached either side
+        //while the job ran isn't lost.
+        void storeJob(ChunkKey key, JobResult& result) {
+            pending.erase(key);
+            PerChunkState& chunk = perChunkState[key];
+            chunk.skyLight = result.skyLight;
+            chunk.blockLight = result.blockLight;
+            relit.insert(key);
+            for (int face = 0; face < 6; face++) {
+                ChunkKey neighborKey = key + ADJACENT_CHUNK_OFFSETS[face];
+                PerChunkState* neighbor = litChunk(neighborKey);
+                if (neighbor == nullptr) {
+                    continue;
+                }
+                for (int j = 0; j < BLOCKS_PER_SIDE; j++) {
+                    for (int i = 0; i < BLOCKS_PER_SIDE; i++) {
+                        Cell inner = { key, &chunk, borderIndex(face, i, j) };
+                        Cell outer = { neighborKey, neighbor, borderIndex(face ^ 1, i, j) };
+                        for (Channel channel : { SKY, BLOCK }) {
+                            reach(channel, getNibble(levelsOf(chunk, channel), inner.index), face, outer, floodQueues[channel]);
+                            reach(channel, getNibble(levelsOf(*neighbor, channel), outer.index), face ^ 1, inner, floodQueues[channel]);
+                        }
+                    }
+                }
+            }
+            flood(SKY, floodQueues[SKY]);
+            flood(BLOCK, floodQueues[BLOCK]);
+        }
+    }
+
+    uint8_t emission(Block block) {
+        return block == LAMP ? 14 : 0;
+    }
+
+    void chunkInserted(ChunkKey key) {
+        if (pending.insert(key).second) {
+            queued.push_back(key);
+        }
+        restartIfRunning(key);
+    }
+
+    void blockChanged(ivec3 position) {
+        blocksChanged({ position });
+    }
+
+    void blocksChanged(const std::vector<ivec3>& positions) {
+        auto begin = std::chrono::steady_clock::now();
+        stats.blockChanges += positions.size();
+        std::vector<Cell> cells;
+        cells.reserve(positions.size());
+        for (ivec3 position : positions) {
+            ChunkKey key = ChunkKey{ glm::floor(vec3{ position } / static_cast<float>(BLOCKS_PER_SIDE)) };
+            if (pending.count(key) != 0) {
+                restartIfRunning(key); //lit from the new blocks by its job
+                continue;
+            }
+            cells.push_back({ key, &perChunkState[key], getChunkIndex(position - key * BLOCKS_PER_SIDE) });
+        }
+        //everything lit through any of the cells goes dark in one pass, then floods back in from what is left
+        std::vector<Removed> removals;
+        for (Channel channel : { SKY, BLOCK }) {
+            std::vector<Cell>& queue = floodQueues[channel];
+            for (const Cell& cell : cells) {
+                NibbleList& levels = levelsOf(*cell.chunk, channel);
+                uint8_t level = getNibble(levels, cell.index);
+                if (level > 0) {
+                    setNibble(levels, cell.index, 0);
+                    touched(cell);
+                    removals.push_back({ cell, level });
+                }
+            }
+            unflood(channel, removals, queue);
+            for (const Cell& cell : cells) {
+                Block block = cell.chunk->blocks[cell.index];
+                uint8_t emitted = channel == BLOCK ? emission(block) : 0;
+                if (emitted > 0) {
+                    setNibble(levelsOf(*cell.chunk, channel), cell.index, emitted);
+                    touched(cell);
+                    queue.push_back(cell);
+                }
+                if (block == AIR) {
+                    for (int face = 0; face < 6; face++) {
+                        Cell next;
+                        if (step(cell, face, next)) {
+                            queue.push_back(next);
+                        }
+                        else if (channel == SKY && isOpenSky(cell.key + ADJACENT_CHUNK_OFFSETS[face])) {
+                            reach(SKY, MAX_LIGHT, face ^ 1, cell, queue);
+                        }
+                    }
+                }
+            }
+            flood(channel, queue);
+        }
+        stats.mainThreadMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    void update() {
+        auto begin = std::chrono::steady_clock::now();
+        for (auto& job : jobs) {
+            if (job.result.wait_for(std::chrono::nanoseconds(1)) != std::future_status::ready) {
+                continue;
+            }
+            JobResult result = job.result.get();
+            stats.jobSteps += result.steps;
+            if (stale.erase(job.key) != 0) {
+                stats.staleJobs++;
+                queued.push_back(job.key); //still pending
+                continue;
+            }
+            storeJob(job.key, result);
+        }
+        jobs.remove_if([](auto& job) -> bool {
+            return !job.result.valid();
+        });
+
+        size_t slots = MAX_LIGHT_JOBS_PER_WORKER * workerPool().size();
+        if (jobs.size() < slots && !queued.empty()) {
+            //meshing waits for light, so the chunks it needs first are lit first
+            std::sort(queued.begin(), queued.end(), [](auto a, auto b) {
+                return viewer::chunkPriority(a) > viewer::chunkPriority(b);
+            });
+            while (jobs.size() < slots && !queued.empty()) {
+                submitJob(queued.back());
+                queued.pop_back();
+            }
+        }
+
+        std::vector<ChunkKey> remeshed;
+        for (auto& key : relit) {
+            if (perChunkState.find(key) != perChunkState.end() && pending.count(key) == 0) {
+                queueRemesh(key);
+                remeshed.push_back(key);
+                stats.remeshes++;
+            }
+        }
+        //the coarser levels merge the light too. neighbors relit together mostly share their ancestors
+        lod::chunksChanged(remeshed);
+        relit.clear();
+        lastRelit = ChunkKey{ INT_MIN };
+        stats.mainThreadMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    bool isPending(ChunkKey key) {
+        if (pending.count(key) != 0) {
+            return true;
+        }
+        for (auto& offset : ADJACENT_CHUNK_OFFSETS) {
+            if (pending.count(key + offset) != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool isSettled() {
+        return pending.empty();
+    }
+
+    void printStats() {
+        printf("light: %zu pending, %llu jobs (%llu redone), %.1f cells per job, %llu flooded and %llu darkened on the main thread in %.1fms\n",
+            pending.size(), static_cast<unsigned long long>(stats.jobs), static_cast<unsigned long long>(stats.staleJobs),
+            stats.jobs > 0 ? static_cast<double>(stats.jobSteps) / stats.jobs : 0.0,
+            static_cast<unsigned long long>(stats.floodSteps), static_cast<unsigned long long>(stats.removalSteps), stats.mainThreadMs);
+        printf("light: %llu block changes, %llu remeshes queued\n",
+            static_cast<unsigned long long>(stats.blockChanges), static_cast<unsigned long long>(stats.remeshes));
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "chunk.h"
+
+//voxel light, baked into the chunk meshes. every block has a sky light and a block light level from 0 to
+//MAX_LIGHT in its chunk's skyLight and blockLight. sky light comes in at MAX_LIGHT from unallocated sky and
+//keeps it straight down open columns; block light spreads from emitting materials. both lose a level per
+//step in every other direction and stop at solid blocks.
+//a chunk's light is computed on a worker when it arrives, from its blocks and the light its resident
+//neighbors shine into it. the main thread then floods from its borders into the neighbors and back, so the
+//result doesn't depend on the order chunks arrive in. a changed block is relit on the main thread by
+//removing everything that could have come through it before flooding back in from what is left.
+//chunks whose light changed are remeshed. a chunk isn't meshed while it or a neighbor waits for its job.
+namespace light {
+    const size_t MAX_LIGHT_JOBS_PER_WORKER = 4;
+
+    //block light a material gives off.
+    uint8_t emission(Block block);
+
+    //the chunk was just inserted into perChunkState with no light.
+    void chunkInserted(ChunkKey key);
+    //the block at position, in a resident chunk, was just changed.
+    void blockChanged(ivec3 position);
+    //same for many blocks at once, e.g. a bulk edit, relit in one pass instead of one per block.
+    void blocksChanged(const std::vector<ivec3>& positions);
+
+    //once per frame before updateChunkGLBuffers: stores finished jobs, floods across borders and queues
+    //remeshes for what changed.
+    void update();
+    //the chunk's mesh would come out different once a pending job for it or a neighbor is stored.
+    bool isPending(ChunkKey key);
+    bool isSettled();
+
+    void printStats();
+}
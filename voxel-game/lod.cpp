@@ -0,0 +1,542 @@
+#include "lod.h"
+#include "chunkio.h"
+#include "density.h"
+#include "heightmap.h"
+#include "jobs.h"
+#include "worldgen.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <list>
+
+namespace lod {
+    namespace {
+        enum Fill { SKY, BURIED, MIXED };
+
+        struct LodMesh {
+            BufferAndPanelCount state;
+            uint8_t airFaces = 0; //neighbors that were meshed as air because they weren't drawn at this level
+            bool stale = false; //the blocks changed since
+        };
+
+        struct PendingMesh {
+            LodKey key;
+            uint8_t airFaces;
+            std::future<ChunkMesh> mesh;
+            bool outdated = false; //the blocks changed after the job was submitted
+        };
+
+        struct LodStats {
+            uint64_t merges = 0;
+            uint64_t meshesStored = 0;
+            uint64_t meshesDiscarded = 0; //finished after their chunk left its level
+            uint64_t selections = 0;
+        };
+
+        //chunks this far under the lowest surface of their columns can only be stone, caves aside
+        const int BURIED_DEPTH = static_cast<int>(ceilf(density::OVERHANG_AMPLITUDE)) + BLOCKS_PER_SIDE;
+
+        std::array<ivec3, MAX_LEVEL + 1> centers; //the viewer's chunk at each level
+        std::array<Region, MAX_LEVEL + 1> regions;
+        bool hasViewer = false;
+        bool selectionStale = true;
+        uint64_t selectedVersion = 0;
+
+        std::unordered_map<LodKey, Fill> fills;
+        std::unordered_map<LodKey, PerChunkState> mergedBlocks; //of level 1 and up, only while needed
+        std::vector<LodKey> unmerged; //needed but not merged yet, finer levels first
+        std::vector<LodKey> wanted; //drawn at their level and not all sky or stone, nearest first
+        std::unordered_map<LodKey, LodMesh> meshes;
+        std::list<PendingMesh> pendingMeshes;
+        std::unordered_set<LodKey> expanded; //drawn as their children
+        std::vector<std::pair<LodKey, const BufferAndPanelCount*>> drawn;
+        LodStats stats;
+
+        PerChunkState airChunk = [] {
+            PerChunkState chunk = {};
+            chunk.skyLight.fill(0xFF); //MAX_LIGHT in both nibbles
+            return chunk;
+        }();
+        PerChunkState stoneChunk = [] {
+            PerChunkState chunk = {};
+            chunk.blocks.fill(STONE);
+            return chunk;
+        }();
+
+        LodKey parentOf(LodKey key) {
+            return LodKey{ key.xyz() >> 1, key.w + 1 }; //arithmetic shift, so this rounds down for negative keys too
+        }
+
+        //drops what was merged and meshed from the coarser chunk's old blocks.
+        void descendantChanged(LodKey ancestor) {
+            //the chunk may be sky that an edit has just claimed
+            auto fill = fills.find(ancestor);
+            if (fill != fills.end() && fill->second == SKY) {
+                fills.erase(fill);
+            }
+            if (mergedBlocks.erase(ancestor) != 0) {
+                unmerged.push_back(ancestor);
+            }
+            auto lodMesh = meshes.find(ancestor);
+            if (lodMesh != meshes.end()) {
+                lodMesh->second.stale = true;
+            }
+            //a mesh already being made from the old blocks is stored stale, so it's made again
+            for (auto& pending : pendingMeshes) {
+                if (pending.key == ancestor) {
+                    pending.outdated = true;
+                }
+            }
+        }
+
+        //children are numbered x + 2 * (y + 2 * z), like lodNoiseIndexOffsets
+        LodKey childOf(LodKey key, int child) {
+            return LodKey{ key.xyz() * 2 + ivec3{ child & 1, (child >> 1) & 1, child >> 2 }, key.w - 1 };
+        }
+
+        LodKey neighborOf(LodKey key, int face) {
+            return key + LodKey{ ADJACENT_CHUNK_OFFSETS[face], 0 };
+        }
+
+        template <typename Callback>
+        void forEachIn(const Region& region, Callback&& callback) {
+            ivec3 position;
+            for (position.z = region.min.z; position.z <= region.max.z; position.z++) {
+                for (position.y = region.min.y; position.y <= region.max.y; position.y++) {
+                    for (position.x = region.min.x; position.x <= region.max.x; position.x++) {
+                        callback(position);
+                    }
+                }
+            }
+        }
+
+        bool isInRegion(LodKey key) {
+            const Region& region = regions[key.w];
+            return hasViewer && glm::all(glm::greaterThanEqual(key.xyz(), region.min)) && glm::all(glm::lessThanEqual(key.xyz(), region.max));
+        }
+
+        //close enough to the viewer to be drawn as its children
+        bool isRefined(LodKey key) {
+            return hasViewer && key.w > 0 && glm::all(glm::lessThanEqual(glm::abs(key.xyz() - centers[key.w]), renderDistance / 2));
+        }
+
+        bool isDrawnAtLevel(LodKey key) {
+            return key.w <= MAX_LEVEL && isInRegion(key) && !isRefined(key);
+        }
+
+        float distanceToViewer(LodKey key) {
+            vec4 origin = chunkOrigin(key);
+            return glm::distance(origin.xyz() + origin.w * (BLOCKS_PER_SIDE * 0.5f), viewerPosition);
+        }
+
+        bool isBuried(ChunkKey key) {
+            return (key.y + 1) * BLOCKS_PER_SIDE <= heightmap::column({ key.x, key.z }).minSurface - BURIED_DEPTH;
+        }
+
+        Fill fillOf(LodKey key) {
+            auto iter = fills.find(key);
+            if (iter != fills.end()) {
+                return iter->second;
+            }
+            int size = 1 << key.w;
+            ivec3 first = key.xyz() * size;
+            bool sky = true;
+            bool buried = true;
+            for (int z = 0; z < size && (sky || buried); z++) {
+                for (int x = 0; x < size && (sky || buried); x++) {
+                    sky = sky && worldgen::isEmptySky({ first.x + x, first.y, first.z + z });
+                    buried = buried && isBuried({ first.x + x, first.y + size - 1, first.z + z });
+                }
+            }
+            sky = sky && !worldgen::hasClaimedSky(first, first + (size - 1));
+            Fill fill = sky ? SKY : buried ? BURIED : MIXED;
+            fills.insert({ key, fill });
+            return fill;
+        }
+
+        //nullptr until the chunk is loaded or merged. all sky and buried chunks stand in as air and stone
+        //unless they happen to be loaded.
+        const PerChunkState* blocksOf(LodKey key) {
+            if (key.w == 0) {
+                auto iter = perChunkState.find(key.xyz());
+                if (iter != perChunkState.end()) {
+                    return &iter->second;
+                }
+            }
+            else {
+                auto iter = mergedBlocks.find(key);
+                if (iter != mergedBlocks.end()) {
+                    return &iter->second;
+                }
+            }
+            switch (fillOf(key)) {
+            case SKY:
+                return &airChunk;
+            case BURIED:
+                return &stoneChunk;
+            default:
+                return nullptr;
+            }
+        }
+
+        void addNeeded(LodKey key, std::unordered_set<LodKey>& needed) {
+            if (fillOf(key) != MIXED || !needed.insert(key).second || key.w == 1) {
+                return;
+            }
+            for (int child = 0; child < 8; child++) {
+                addNeeded(childOf(key, child), needed);
+            }
+        }
+
+        bool tryMerge(LodKey key) {
+            std::array<const PerChunkState*, 8> children;
+            bool ready = true;
+            for (int child = 0; child < 8; child++) {
+                LodKey childKey = childOf(key, child);
+                children[child] = blocksOf(childKey);
+                if (children[child] == nullptr) {
+                    ready = false;
+                    if (childKey.w == 0) {
+                        chunkio::requestLoad(childKey.xyz());
+                    }
+                }
+            }
+            if (!ready) {
+                return false;
+            }
+            //merged aside, as inserting could move the children it reads from
+            PerChunkState merged = {};
+            mergeChunksIntoHigherLOD(children, merged);
+            mergedBlocks[key] = merged;
+            stats.merges++;
+            return true;
+        }
+
+        void mergeReadyChunks() {
+            int merges = 0;
+            std::vector<LodKey> stillUnmerged;
+            for (auto& key : unmerged) {
+                if (merges < MAX_MERGES_PER_FRAME && tryMerge(key)) {
+                    merges++;
+                }
+                else {
+                    stillUnmerged.push_back(key);
+                }
+            }
+            unmerged.swap(stillUnmerged);
+        }
+
+        uint8_t airFacesOf(LodKey key) {
+            uint8_t airFaces = 0;
+            for (int face = 0; face < 6; face++) {
+                if (!isDrawnAtLevel(neighborOf(key, face))) {
+                    airFaces |= 1 << face;
+                }
+            }
+            return airFaces;
+        }
+
+        bool storeFinishedMeshes() {
+            std::vector<PendingMesh*> ready;
+            for (auto& pending : pendingMeshes) {
+                if (pending.mesh.wait_for(std::chrono::nanoseconds(1)) == std::future_status::ready) {
+                    ready.push_back(&pending);
+                }
+            }
+            std::sort(ready.begin(), ready.end(), [](auto a, auto b) {
+                return distanceToViewer(a->key) < distanceToViewer(b->key);
+            });
+            if (ready.size() > MAX_LOD_UPLOADS_PER_FRAME) {
+                ready.resize(MAX_LOD_UPLOADS_PER_FRAME);
+            }
+            bool stored = false;
+            for (auto pending : ready) {
+                ChunkMesh mesh = pending->mesh.get();
+                if (!isInRegion(pending->key) || expanded.count(pending->key) != 0) {
+                    if (mesh.staged.bytes > 0) {
+                        uploadring::consumed(mesh.staged);
+                    }
+                    stats.meshesDiscarded++;
+                    continue;
+                }
+                LodMesh& lodMesh = meshes[pending->key];
+                storeChunkMesh(mesh, lodMesh.state);
+                lodMesh.airFaces = pending->airFaces;
+                lodMesh.stale = pending->outdated;
+                stats.meshesStored++;
+                stored = true;
+            }
+            pendingMeshes.remove_if([](auto& pending) -> bool {
+                return !pending.mesh.valid();
+            });
+            //the draw list holds the replaced meshes' handles and ranges
+            if (stored) {
+                drawableChunksVersion++;
+            }
+            return stored;
+        }
+
+        void submitMeshing() {
+            size_t slots = MAX_LOD_MESHING_JOBS_PER_WORKER * workerPool().size();
+            if (pendingMeshes.size() >= slots) {
+                return;
+            }
+            std::unordered_set<LodKey> beingMeshed;
+            for (auto& pending : pendingMeshes) {
+                beingMeshed.insert(pending.key);
+            }
+            for (auto& key : wanted) {
+                if (pendingMeshes.size() >= slots) {
+                    break;
+                }
+                uint8_t airFaces = airFacesOf(key);
+                auto lodMesh = meshes.find(key);
+                if (beingMeshed.count(key) != 0 || (lodMesh != meshes.end() && !lodMesh->second.stale && lodMesh->second.airFaces == airFaces)) {
+                    continue;
+                }
+                const PerChunkState* blocks = blocksOf(key);
+                std::array<const PerChunkState*, 6> neighbors;
+                bool ready = blocks != nullptr;
+                for (int face = 0; face < 6 && ready; face++) {
+                    neighbors[face] = airFaces & (1 << face) ? &airChunk : blocksOf(neighborOf(key, face));
+                    ready = neighbors[face] != nullptr;
+                }
+                if (!ready) {
+                    continue;
+                }
+
+                //the neighbors are copied for the job, keyed by their offset
+                TemporaryChunksSnapshot* tcs = new TemporaryChunksSnapshot();
+                tcs->users = 1;
+                std::array<bool, 6> doAdjacentsExist = { true, true, true, true, true, true };
+                std::array<PerChunkState*, 6> adjacentChunks;
+                for (int face = 0; face < 6; face++) {
+                    adjacentChunks[face] = &(tcs->chunks[ADJACENT_CHUNK_OFFSETS[face]] = *neighbors[face]);
+                }
+                auto meshing = std::make_shared<std::packaged_task<ChunkMesh()>>(
+                    std::bind(&getChunkGLBuffer, *blocks, doAdjacentsExist, adjacentChunks, OccupancyRows{}, tcs)
+                );
+                pendingMeshes.push_back({ key, airFaces, meshing->get_future(), false });
+                workerPool().submit([meshing]() { (*meshing)(); });
+            }
+        }
+
+        bool isReady(LodKey key);
+
+        bool areChildrenReady(LodKey key) {
+            for (int child = 0; child < 8; child++) {
+                if (!isReady(childOf(key, child))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        //can be drawn in place of its share of its parent: meshed, with nothing to draw, or refined
+        //into children that are all ready themselves
+        bool isReady(LodKey key) {
+            if (key.w == 0) {
+                ChunkKey chunkKey = key.xyz();
+                return chunkGLBuffers.count(chunkKey) != 0 || (perChunkState.count(chunkKey) == 0 && worldgen::isEmptySky(chunkKey));
+            }
+            if (fillOf(key) != MIXED || meshes.count(key) != 0) {
+                return true;
+            }
+            return isRefined(key) && areChildrenReady(key);
+        }
+
+        void selectFrom(LodKey key, std::unordered_set<LodKey>& expandedNow, std::vector<std::pair<LodKey, const BufferAndPanelCount*>>& drawnNow) {
+            //a refined chunk whose children aren't ready yet keeps its old mesh until they are, if it has one
+            auto lodMesh = meshes.find(key);
+            if (isRefined(key) && (lodMesh == meshes.end() || areChildrenReady(key))) {
+                expandedNow.insert(key);
+                if (key.w > 1) {
+                    for (int child = 0; child < 8; child++) {
+                        selectFrom(childOf(key, child), expandedNow, drawnNow);
+                    }
+                }
+                return;
+            }
+            if (lodMesh != meshes.end() && lodMesh->second.state.mesh != gpumem::NO_MESH) {
+                drawnNow.push_back({ key, &lodMesh->second.state });
+            }
+        }
+
+        void select() {
+            std::unordered_set<LodKey> expandedNow;
+            std::vector<std::pair<LodKey, const BufferAndPanelCount*>> drawnNow;
+            forEachIn(regions[MAX_LEVEL], [&](ivec3 position) {
+                selectFrom(LodKey{ position, MAX_LEVEL }, expandedNow, drawnNow);
+            });
+            for (auto iter = meshes.begin(); iter != meshes.end();) {
+                if (expandedNow.count(iter->first) != 0 || !isInRegion(iter->first)) {
+                    gpumem::free(iter->second.state.mesh);
+                    iter = meshes.erase(iter);
+                }
+                else {
+                    ++iter;
+                }
+            }
+            if (expandedNow != expanded || drawnNow != drawn) {
+                drawableChunksVersion++;
+            }
+            expanded.swap(expandedNow);
+            drawn.swap(drawnNow);
+            selectedVersion = drawableChunksVersion;
+            selectionStale = false;
+            stats.selections++;
+        }
+    }
+
+    void setViewerChunk(ChunkKey viewerChunk) {
+        std::array<ivec3, MAX_LEVEL + 1> newCenters;
+        for (int level = 0; level <= MAX_LEVEL; level++) {
+            newCenters[level] = viewerChunk >> level;
+        }
+        if (hasViewer && newCenters == centers) {
+            return;
+        }
+        centers = newCenters;
+        hasViewer = true;
+        selectionStale = true;
+
+        ivec3 refineRadius = renderDistance / 2;
+        regions[MAX_LEVEL] = { centers[MAX_LEVEL] - renderDistance, centers[MAX_LEVEL] + renderDistance };
+        for (int level = 0; level < MAX_LEVEL; level++) {
+            regions[level] = { (centers[level + 1] - refineRadius) * 2, (centers[level + 1] + refineRadius) * 2 + 1 };
+        }
+
+        //forget what is out of reach, so the caches don't grow with the distance travelled
+        int keepDistance = 2 * reach();
+        for (auto iter = fills.begin(); iter != fills.end();) {
+            ivec3 offset = glm::abs(iter->first.xyz() * (1 << iter->first.w) - viewerChunk);
+            if (std::max(offset.x, std::max(offset.y, offset.z)) > keepDistance) {
+                iter = fills.erase(iter);
+            }
+            else {
+                ++iter;
+            }
+        }
+
+        wanted.clear();
+        std::unordered_set<LodKey> needed;
+        for (int level = 1; level <= MAX_LEVEL; level++) {
+            forEachIn(regions[level], [&](ivec3 position) {
+                LodKey key{ position, level };
+                if (!isRefined(key) && fillOf(key) == MIXED) {
+                    wanted.push_back(key);
+                    addNeeded(key, needed);
+                }
+            });
+        }
+        std::sort(wanted.begin(), wanted.end(), [](LodKey a, LodKey b) {
+            return distanceToViewer(a) < distanceToViewer(b);
+        });
+
+        for (auto iter = mergedBlocks.begin(); iter != mergedBlocks.end();) {
+            if (needed.count(iter->first) == 0) {
+                iter = mergedBlocks.erase(iter);
+            }
+            else {
+                ++iter;
+            }
+        }
+        unmerged.clear();
+        for (auto& key : needed) {
+            if (mergedBlocks.count(key) == 0) {
+                unmerged.push_back(key);
+            }
+        }
+        //a chunk can only be merged after its children
+        std::sort(unmerged.begin(), unmerged.end(), [](LodKey a, LodKey b) {
+            return a.w != b.w ? a.w < b.w : distanceToViewer(a) < distanceToViewer(b);
+        });
+    }
+
+    Region region(int level) {
+        return regions[level];
+    }
+
+    int reach() {
+        int distance = std::max(renderDistance.x, std::max(renderDistance.y, renderDistance.z));
+        return (distance + 1) << MAX_LEVEL;
+    }
+
+    void chunkChanged(ChunkKey key) {
+        LodKey ancestor{ key, 0 };
+        for (int level = 1; level <= MAX_LEVEL; level++) {
+            ancestor = parentOf(ancestor);
+            descendantChanged(ancestor);
+        }
+    }
+
+    void chunksChanged(const std::vector<ChunkKey>& keys) {
+        std::unordered_set<LodKey> ancestors;
+        for (ChunkKey key : keys) {
+            LodKey ancestor{ key, 0 };
+            for (int level = 1; level <= MAX_LEVEL; level++) {
+                ancestor = parentOf(ancestor);
+                //its own ancestors are in already
+                if (!ancestors.insert(ancestor).second) {
+                    break;
+                }
+            }
+        }
+        for (LodKey ancestor : ancestors) {
+            descendantChanged(ancestor);
+        }
+    }
+
+    void update() {
+        if (!hasViewer) {
+            return;
+        }
+        bool stored = storeFinishedMeshes();
+        mergeReadyChunks();
+        submitMeshing();
+        if (stored || selectionStale || selectedVersion != drawableChunksVersion) {
+            select();
+        }
+    }
+
+    bool isSettled() {
+        return unmerged.empty() && pendingMeshes.empty() && std::all_of(wanted.begin(), wanted.end(), [](LodKey key) {
+            auto lodMesh = meshes.find(key);
+            return lodMesh != meshes.end() && !lodMesh->second.stale && lodMesh->second.airFaces == airFacesOf(key);
+        });
+    }
+
+    bool isDrawnAtFinestLevel(ChunkKey key) {
+        return !hasViewer || expanded.count(parentOf(LodKey{ key, 0 })) != 0;
+    }
+
+    const std::vector<std::pair<LodKey, const BufferAndPanelCount*>>& drawnChunks() {
+        return drawn;
+    }
+
+    vec4 chunkOrigin(LodKey key) {
+        float scale = static_cast<float>(1 << key.w);
+        return vec4{ vec3{ key.xyz() } * (BLOCKS_PER_SIDE * scale), scale };
+    }
+
+    void printStats() {
+        std::array<size_t, MAX_LEVEL + 1> drawnPerLevel = {};
+        for (auto& keyAndMesh : drawn) {
+            drawnPerLevel[keyAndMesh.first.w]++;
+        }
+        uint64_t meshBytes = 0;
+        for (auto& keyAndMesh : meshes) {
+            meshBytes += gpumem::allocatedBytes(keyAndMesh.second.state.mesh);
+        }
+        printf("lod: drawing");
+        for (int level = 1; level <= MAX_LEVEL; level++) {
+            printf(" %zu level %d", drawnPerLevel[level], level);
+        }
+        printf(" chunks, reach %d chunks. %zu meshes (%.1fMB), %zu merged, %zu waiting to merge, %zu meshing\n",
+            reach(), meshes.size(), meshBytes / (1024.0 * 1024.0), mergedBlocks.size(), unmerged.size(), pendingMeshes.size());
+        printf("lod: %llu merges, %llu meshes stored, %llu discarded, %llu selections\n",
+            static_cast<unsigned long long>(stats.merges), static_cast<unsigned long long>(stats.meshesStored),
+            static_cast<unsigned long long>(stats.meshesDiscarded), static_cast<unsigned long long>(stats.selections));
+    }
+}
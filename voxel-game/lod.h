@@ -0,0 +1,51 @@
+#pragma once
+#include "chunk.h"
+
+//level of detail rings. a level N chunk covers 2^N x 2^N x 2^N chunks of blocks at 2^N blocks per
+//block, downsampled from its 8 children by mergeChunksIntoHigherLOD, and is drawn scaled up by 2^N.
+//around the viewer each level covers the ring the next finer level leaves out: the finest chunks fill the
+//level 1 chunks within REFINE_RADIUS of the viewer's level 1 chunk, and so on, so every level is aligned
+//to the one above it and view distance doubles per level at the same chunk count.
+//a coarse chunk is only replaced by its children once all of them are meshed, and it meshes the faces
+//against neighbors that aren't drawn at its level as if they were air, which closes the cracks where the
+//surface of a coarse chunk doesn't meet the finer surface next to it.
+//chunks entirely above the terrain or far enough under it are never generated; they merge as air or stone.
+namespace lod {
+    const int MAX_LEVEL = 2;
+    const int MAX_MERGES_PER_FRAME = 32;
+    const size_t MAX_LOD_UPLOADS_PER_FRAME = 16;
+    const size_t MAX_LOD_MESHING_JOBS_PER_WORKER = 2;
+
+    typedef glm::ivec4 LodKey; //chunk coordinates in chunks of its level, level in w
+
+    //inclusive, in chunks of the level
+    struct Region {
+        ivec3 min;
+        ivec3 max;
+    };
+
+    //recenters every level on the viewer's chunk. called from setChunksToDraw before it walks region(0).
+    void setViewerChunk(ChunkKey viewerChunk);
+    Region region(int level);
+    //how far, in chunks, the coarsest level can reach from the viewer. generation keeps requests this far out.
+    int reach();
+
+    //the blocks of a finest level chunk changed, so its coarser ancestors have to be merged again.
+    void chunkChanged(ChunkKey key);
+    //chunkChanged for a batch, visiting each ancestor they share once.
+    void chunksChanged(const std::vector<ChunkKey>& keys);
+
+    //once per frame after updateChunkGLBuffers: merges, meshes and uploads, and reselects what is drawn.
+    void update();
+    //every chunk drawn at its level is merged and meshed.
+    bool isSettled();
+
+    //false while a coarser chunk is drawn in place of this finest level chunk.
+    bool isDrawnAtFinestLevel(ChunkKey key);
+    //the coarser chunks to draw, with their meshes.
+    const std::vector<std::pair<LodKey, const BufferAndPanelCount*>>& drawnChunks();
+    //world space position of the chunk's first block, and its size in blocks per block in w.
+    vec4 chunkOrigin(LodKey key);
+
+    void printStats();
+}
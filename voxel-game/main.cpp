@@ -1,6 +1,19 @@
 
 #define GLM_FORCE_RADIANS
 #include "draw.h"
+#include "chunkio.h"
+#include "clipmap.h"
+#include "density.h"
+#include "edit.h"
+#include "headless.h"
+#include "light.h"
+#include "lod.h"
+#include "physics.h"
+#include "raycast.h"
+#include "residency.h"
+#include "simulation.h"
+#include "viewer.h"
+#include "worldgen.h"
 #include "glad.h"
 #include <GLFW/glfw3.h>
 #include <iostream>
@@ -10,7 +23,6 @@
 
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtc/matrix_transform.hpp"
-#include "glm/gtc/noise.hpp"
 
 namespace input {
     bool FORWARD;
@@ -38,15 +50,10 @@ using namespace glm;
 
 const int WINDOW_WIDTH = 800;
 const int WINDOW_HEIGHT = 600;
-
-const std::array<vec3, 6> FULLSCREEN_QUAD = std::array<vec3, 6>{
-    vec3{ -1.0f, -1.0f, 0.5f},
-    vec3{ 1.0f, -1.0f, 0.5f},
-    vec3{ -1.0f, 1.0f, 0.5f},
-    vec3{ 1.0f, -1.0f, 0.5f},
-    vec3{ 1.0f, 1.0f, 0.5f},
-    vec3{ -1.0f, 1.0f, 0.5f}
-};
+//what the free camera used to move per frame at 60fps
+const float PLAYER_SPEED = 72.f;
+const vec3 PLAYER_HALF_EXTENTS = { 0.3f, 0.9f, 0.3f };
+const vec3 PLAYER_EYE_OFFSET = { 0.f, 0.7f, 0.f }; //from the center of the player's box
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
     auto keyMapping = input::keyBindings.find(key);
@@ -63,16 +70,42 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 }
 
 void windowSizeCallback(GLFWwindow* window, int width, int height) {
-    glViewport(0, 0, width, height);
-    matrix::projection = perspective(2.1f, glm::max(static_cast<float>(width), 1.f) / glm::max(static_cast<float>(height), 1.f), 0.1f, 300.f);
+    render::device().setViewport(width, height);
+    matrix::projection = perspective(2.1f, glm::max(static_cast<float>(width), 1.f) / glm::max(static_cast<float>(height), 1.f), 0.1f, FAR_PLANE);
 }
 
-int main() {
-    viewerPosition = glm::vec3{ 128.f, 128.f, 128.f };
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--bench-density") {
+        density::benchmark(1024);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-physics") {
+        physics::benchmark(4096);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-simulation") {
+        simulation::benchmark(8);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--headless") {
+        headless::Options options;
+        if (!headless::parseOptions(argc - 2, argv + 2, options)) {
+            return 1;
+        }
+        return headless::run(options);
+    }
+
+    //above the terrain, as the player can't move through it
+    viewerPosition = glm::vec3{ 128.f, 200.f, 128.f };
+    physics::Body playerBody;
+    playerBody.position = viewerPosition - PLAYER_EYE_OFFSET;
+    playerBody.halfExtents = PLAYER_HALF_EXTENTS;
+    playerBody.gravityScale = 0.f; //flies
+    physics::BodyId player = physics::addBody(playerBody);
 
     std::cout << "Waiting for RenderDoc... (press Enter to continue)" << std::endl;
     std::cin.get();
-    matrix::projection = perspective(2.1f, glm::max(static_cast<float>(WINDOW_WIDTH), 1.f) / glm::max(static_cast<float>(WINDOW_HEIGHT), 1.f), 0.1f, 300.f);
+    matrix::projection = perspective(2.1f, glm::max(static_cast<float>(WINDOW_WIDTH), 1.f) / glm::max(static_cast<float>(WINDOW_HEIGHT), 1.f), 0.1f, FAR_PLANE);
     matrix::view = glm::translate(glm::mat4(1.0f), { -8.0f, -8.0f, -60.0f });
 
     glfwInit();
@@ -98,54 +131,28 @@ int main() {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    render::setDevice(render::createGLDevice(reinterpret_cast<render::ProcLoader>(glfwGetProcAddress)));
+    uploadring::init();
 
-    std::array<std::array<float, 48 * BLOCKS_PER_SIDE>, 48 * BLOCKS_PER_SIDE>* perlins = new std::array<std::array<float, 48 * BLOCKS_PER_SIDE>, 48 * BLOCKS_PER_SIDE>();
-    for (int z = 0; z < 48 * BLOCKS_PER_SIDE; z++) {
-        for (int x = 0; x < 48 * BLOCKS_PER_SIDE; x++) {
-            (*perlins)[z][x] = glm::perlin((vec2{ x, z }) * 0.16f) * 0.5f
-                + glm::perlin((vec2{ x, z }) * 0.04f)
-                + glm::perlin((vec2{ x, z }) * 0.01f) * 1.5f
-                + glm::perlin((vec2{ x, z }) * 0.0025f) * 5.0f
-                + glm::perlin((vec2{ x, z }) * 0.0007f) * 25.0f;
-        }
-    }
-
-    static3DLoop<0, 0, 0, 32, BLOCKS_PER_SIDE, 32>([&](auto chunkCoords) {
-        //uint32_t x = 3;
-        addChunkAt({ chunkCoords.xyz });
-        auto& blocks = perChunkState[{ chunkCoords.xyz }].blocks;
-        static3DLoop<0, 0, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE>([&](auto coords) {
-            float noiseSample = (*perlins)[coords.z + BLOCKS_PER_SIDE * chunkCoords.z][coords.x + BLOCKS_PER_SIDE * chunkCoords.x];
-            blocks[getChunkIndex(coords)] = (coords.y + BLOCKS_PER_SIDE * chunkCoords.y) < (noiseSample * 8.0f + 128.0f);
-        });
-    });
-
-    delete perlins;
-
-    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-    glClearColor(0.0, 0.0, 0.0, 1.0);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    //chunks are streamed in by setChunksToDraw, loaded from disk or generated on demand
+    chunkio::init("world");
 
+    render::device().setViewport(WINDOW_WIDTH, WINDOW_HEIGHT);
 
     drawSetup();
 
-    GLuint chunkShaderProgram = program::chunk;
-    glUseProgram(chunkShaderProgram);
-
-    GLuint fullscreenQuadBuffer;
-    glGenBuffers(1, &fullscreenQuadBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, fullscreenQuadBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(FULLSCREEN_QUAD), FULLSCREEN_QUAD.data(), GL_STATIC_DRAW);
-
     double prevTime = glfwGetTime();
+    double lastFrameTime = prevTime;
 
     int framesRendered = 0;
     while (!glfwWindowShouldClose(window)) {
+        chunkio::update();
+        worldgen::update();
         drawFrame();
+        viewer::recordFrame(matrix::projection * matrix::view);
+        residency::update();
         if (framesRendered % 10 == 0) {
-            freeFarawayDrawChunksFromGPU(512 * 31);
+            gpumem::compact(gpumem::MAX_COMPACTION_BYTES_PER_PASS);
             setChunksToDraw();
         }
         //for (int i = 0; i < 10; i++)
@@ -155,6 +162,25 @@ int main() {
         double currentTime = glfwGetTime();
         if (framesRendered % 60 == 0) {
             printf("FPS: %f\n", static_cast<double>(framesRendered) / (currentTime - prevTime));
+            printf("%u chunks (%u outside frustum, %u occluded, %u hidden), %u panels (%u back-facing skipped) in %u draw calls, %u device calls, %u shadow cascades rendered in %u draw calls\n",
+                drawStats.chunks, drawStats.culled, drawStats.occluded, drawStats.hidden, drawStats.panels, drawStats.backFacingPanels, drawStats.drawCalls, drawStats.deviceCalls,
+                drawStats.shadowCascades, drawStats.shadowDrawCalls);
+        }
+        if (framesRendered % 600 == 0) {
+            chunkio::printStats();
+            viewer::printStats();
+            worldgen::printStats();
+            gpumem::printStats();
+            residency::printStats();
+            light::printStats();
+            edit::printStats();
+            raycast::printStats();
+            physics::printStats();
+            simulation::printStats();
+            lod::printStats();
+            clipmap::printStats();
+            uploadring::printStats();
+            render::printStats();
         }
 
         double mousePosX;
@@ -168,38 +194,49 @@ int main() {
 
         rotation.y = glm::clamp(rotation.y, -glm::pi<float>() / 2.0f, glm::pi<float>() / 2.0f);
 
+        vec3 walk(0.f);
         if (input::FORWARD) {
-            viewerPosition.z -= 1.2 * cosf(rotation.x);
-            viewerPosition.x -= 1.2 * -sinf(rotation.x);
+            walk.z -= cosf(rotation.x);
+            walk.x -= -sinf(rotation.x);
         }
         if (input::BACKWARD) {
-            viewerPosition.z += 1.2 * cosf(rotation.x);
-            viewerPosition.x += 1.2 * -sinf(rotation.x);
+            walk.z += cosf(rotation.x);
+            walk.x += -sinf(rotation.x);
         }
         if (input::LEFT) {
-            viewerPosition.z -= 1.2 * sinf(rotation.x);
-            viewerPosition.x -= 1.2 * cosf(rotation.x);
+            walk.z -= sinf(rotation.x);
+            walk.x -= cosf(rotation.x);
         }
         if (input::RIGHT) {
-            viewerPosition.z += 1.2 * sinf(rotation.x);
-            viewerPosition.x += 1.2 * cosf(rotation.x);
+            walk.z += sinf(rotation.x);
+            walk.x += cosf(rotation.x);
         }
         if (input::UP) {
-            viewerPosition.y += 1.2;
+            walk.y += 1.f;
         }
         if (input::DOWN) {
-            viewerPosition.y -= 1.2;
+            walk.y -= 1.f;
         }
+        physics::body(player).velocity = walk * PLAYER_SPEED;
+        physics::update(static_cast<float>(currentTime - lastFrameTime));
+        viewerPosition = physics::body(player).position + PLAYER_EYE_OFFSET;
+        simulation::update(static_cast<float>(currentTime - lastFrameTime));
         if (input::TOGGLE_CURSOR_MODE) {
             input::TOGGLE_CURSOR_MODE = false;
             input::isCursorLocked = !input::isCursorLocked;
             glfwSetInputMode(window, GLFW_CURSOR, input::isCursorLocked ? GLFW_CURSOR_DISABLED : GLFW_CURSOR_NORMAL);
         }
 
+        viewer::update(viewerPosition, rotation, static_cast<float>(currentTime - lastFrameTime));
+        lastFrameTime = currentTime;
+
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    chunkio::shutdown();
+    uploadring::shutdown();
+    render::setDevice(nullptr);
     glfwTerminate();
 
     return 0;
@@ -0,0 +1,316 @@
+#include "occlusion.h"
+#include "jobs.h"
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OCCLUSION_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace occlusion {
+    namespace {
+        //edge functions are A * x + B * y + C, non-negative inside. depth is z = zA * x + zB * y + zC.
+        struct ScreenTriangle {
+            vec3 edgeA, edgeB, edgeC;
+            float zA, zB, zC;
+            int minX, minY, maxX, maxY;
+        };
+
+        mat4 frameViewProjection;
+        std::vector<ScreenTriangle> triangles;
+        std::vector<std::vector<float>> depthLevels; //level 0 is the depth buffer, each next level the max of 2x2
+        std::vector<ivec2> levelSizes;
+
+        ThreadPool& rasterPool() {
+            static ThreadPool pool(RASTER_THREADS);
+            return pool;
+        }
+
+        //largest all-solid rectangle of a 16x16 layer, as [u0, u1) x [v0, v1). returns its area.
+        int largestRectangle(const std::array<bool, BLOCKS_PER_SIDE * BLOCKS_PER_SIDE>& solid, OccluderQuad& quad) {
+            int bestArea = 0;
+            std::array<int, BLOCKS_PER_SIDE> heights = {};
+            for (int v = 0; v < BLOCKS_PER_SIDE; v++) {
+                //heights[u] is how many solid cells end at row v in column u
+                for (int u = 0; u < BLOCKS_PER_SIDE; u++) {
+                    heights[u] = solid[u + v * BLOCKS_PER_SIDE] ? heights[u] + 1 : 0;
+                }
+                for (int u0 = 0; u0 < BLOCKS_PER_SIDE; u0++) {
+                    int height = BLOCKS_PER_SIDE;
+                    for (int u1 = u0; u1 < BLOCKS_PER_SIDE && heights[u1] > 0; u1++) {
+                        height = std::min(height, heights[u1]);
+                        int area = height * (u1 - u0 + 1);
+                        if (area > bestArea) {
+                            bestArea = area;
+                            quad.u0 = static_cast<uint8_t>(u0);
+                            quad.u1 = static_cast<uint8_t>(u1 + 1);
+                            quad.v0 = static_cast<uint8_t>(v + 1 - height);
+                            quad.v1 = static_cast<uint8_t>(v + 1);
+                        }
+                    }
+                }
+            }
+            return bestArea;
+        }
+
+        //clips a polygon in clip space to the near plane (z >= -w) and adds it as a fan of screen triangles.
+        void addPolygon(const std::array<vec4, 4>& corners) {
+            std::array<vec4, 8> clipped;
+            int count = 0;
+            for (int i = 0; i < 4; i++) {
+                const vec4& a = corners[i];
+                const vec4& b = corners[(i + 1) % 4];
+                float distanceA = a.z + a.w;
+                float distanceB = b.z + b.w;
+                if (distanceA >= 0.f) {
+                    clipped[count++] = a;
+                }
+                if ((distanceA >= 0.f) != (distanceB >= 0.f)) {
+                    clipped[count++] = glm::mix(a, b, distanceA / (distanceA - distanceB));
+                }
+            }
+            if (count < 3) {
+                return;
+            }
+            std::array<vec3, 8> screen;
+            for (int i = 0; i < count; i++) {
+                float w = std::max(clipped[i].w, 1e-6f);
+                screen[i] = {
+                    (clipped[i].x / w * 0.5f + 0.5f) * DEPTH_WIDTH,
+                    (clipped[i].y / w * 0.5f + 0.5f) * DEPTH_HEIGHT,
+                    clipped[i].z / w
+                };
+            }
+            for (int i = 1; i + 1 < count; i++) {
+                vec3 v0 = screen[0];
+                vec3 v1 = screen[i];
+                vec3 v2 = screen[i + 1];
+                float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+                if (fabsf(area) < 1e-6f) {
+                    continue;
+                }
+                if (area < 0.f) {
+                    std::swap(v1, v2);
+                    area = -area;
+                }
+                ScreenTriangle triangle;
+                std::array<vec3, 3> vertices = { v0, v1, v2 };
+                vec3 edgeA, edgeB, edgeC;
+                for (int edge = 0; edge < 3; edge++) {
+                    vec3 a = vertices[edge];
+                    vec3 b = vertices[(edge + 1) % 3];
+                    edgeA[edge] = a.y - b.y;
+                    edgeB[edge] = b.x - a.x;
+                    edgeC[edge] = -(edgeA[edge] * a.x + edgeB[edge] * a.y);
+                }
+                triangle.edgeA = edgeA;
+                triangle.edgeB = edgeB;
+                triangle.edgeC = edgeC;
+                triangle.zA = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+                triangle.zB = ((v1.x - v0.x) * (v2.z - v0.z) - (v2.x - v0.x) * (v1.z - v0.z)) / area;
+                triangle.zC = v0.z - triangle.zA * v0.x - triangle.zB * v0.y;
+                triangle.minX = std::max(0, static_cast<int>(floorf(std::min({ v0.x, v1.x, v2.x }))));
+                triangle.minY = std::max(0, static_cast<int>(floorf(std::min({ v0.y, v1.y, v2.y }))));
+                triangle.maxX = std::min(DEPTH_WIDTH - 1, static_cast<int>(ceilf(std::max({ v0.x, v1.x, v2.x }))));
+                triangle.maxY = std::min(DEPTH_HEIGHT - 1, static_cast<int>(ceilf(std::max({ v0.y, v1.y, v2.y }))));
+                if (triangle.minX <= triangle.maxX && triangle.minY <= triangle.maxY) {
+                    triangles.push_back(triangle);
+                }
+            }
+        }
+
+        //rasterizes every triangle into rows [firstRow, endRow), keeping the nearest depth per pixel center.
+        void rasterizeBand(int firstRow, int endRow) {
+            float* depth = depthLevels[0].data();
+            for (auto& triangle : triangles) {
+                int rowBegin = std::max(firstRow, triangle.minY);
+                int rowEnd = std::min(endRow, triangle.maxY + 1);
+                for (int y = rowBegin; y < rowEnd; y++) {
+                    float centerY = y + 0.5f;
+                    vec3 rowEdges = triangle.edgeB * centerY + triangle.edgeC;
+                    float rowDepth = triangle.zB * centerY + triangle.zC;
+                    float* row = depth + y * DEPTH_WIDTH;
+                    int x = triangle.minX;
+#ifdef OCCLUSION_USE_SSE
+                    x &= ~3;
+                    const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+                    const __m128 zero = _mm_setzero_ps();
+                    for (; x <= triangle.maxX; x += 4) {
+                        __m128 centerX = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets);
+                        __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA.x), centerX), _mm_set1_ps(rowEdges.x)), zero);
+                        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA.y), centerX), _mm_set1_ps(rowEdges.y)), zero));
+                        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA.z), centerX), _mm_set1_ps(rowEdges.z)), zero));
+                        if (_mm_movemask_ps(inside) == 0) {
+                            continue;
+                        }
+                        __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.zA), centerX), _mm_set1_ps(rowDepth));
+                        __m128 current = _mm_loadu_ps(row + x);
+                        __m128 nearest = _mm_min_ps(current, z);
+                        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+                    }
+#else
+                    for (; x <= triangle.maxX; x++) {
+                        float centerX = x + 0.5f;
+                        vec3 edges = triangle.edgeA * centerX + rowEdges;
+                        if (edges.x >= 0.f && edges.y >= 0.f && edges.z >= 0.f) {
+                            row[x] = std::min(row[x], triangle.zA * centerX + rowDepth);
+                        }
+                    }
+#endif
+                }
+            }
+        }
+    }
+
+    std::vector<OccluderQuad> findOccluders(const BlockList& blocks) {
+        std::vector<OccluderQuad> occluders;
+        if (std::none_of(blocks.begin(), blocks.end(), [](Block block) { return block == AIR; })) {
+            for (uint8_t axis = 0; axis < 3; axis++) {
+                occluders.push_back({ axis, 0, 0, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE });
+                occluders.push_back({ axis, 2 * BLOCKS_PER_SIDE, 0, 0, BLOCKS_PER_SIDE, BLOCKS_PER_SIDE });
+            }
+            return occluders;
+        }
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            int uAxis = (axis + 1) % 3;
+            int vAxis = (axis + 2) % 3;
+            OccluderQuad best = {};
+            int bestArea = 0;
+            std::array<bool, BLOCKS_PER_SIDE * BLOCKS_PER_SIDE> solid;
+            for (int layer = 0; layer < BLOCKS_PER_SIDE; layer++) {
+                ivec3 coords;
+                coords[axis] = layer;
+                for (coords[vAxis] = 0; coords[vAxis] < BLOCKS_PER_SIDE; coords[vAxis]++) {
+                    for (coords[uAxis] = 0; coords[uAxis] < BLOCKS_PER_SIDE; coords[uAxis]++) {
+                        solid[coords[uAxis] + coords[vAxis] * BLOCKS_PER_SIDE] = blocks[getChunkIndex(coords)] != AIR;
+                    }
+                }
+                OccluderQuad quad;
+                int area = largestRectangle(solid, quad);
+                if (area > bestArea) {
+                    bestArea = area;
+                    best = quad;
+                    best.axis = axis;
+                    best.plane = static_cast<uint8_t>(2 * layer + 1);
+                }
+            }
+            if (bestArea >= MIN_OCCLUDER_AREA) {
+                occluders.push_back(best);
+            }
+        }
+        return occluders;
+    }
+
+    void beginFrame(const mat4& viewProjection) {
+        frameViewProjection = viewProjection;
+        triangles.clear();
+        if (depthLevels.empty()) {
+            ivec2 size = { DEPTH_WIDTH, DEPTH_HEIGHT };
+            while (true) {
+                levelSizes.push_back(size);
+                depthLevels.emplace_back(size.x * size.y);
+                if (size.x == 1 && size.y == 1) {
+                    break;
+                }
+                size = glm::max(size / 2, ivec2{ 1 });
+            }
+        }
+        std::fill(depthLevels[0].begin(), depthLevels[0].end(), 1.f);
+    }
+
+    void addOccluders(vec3 chunkOrigin, const std::vector<OccluderQuad>& occluders) {
+        for (auto& quad : occluders) {
+            int uAxis = (quad.axis + 1) % 3;
+            int vAxis = (quad.axis + 2) % 3;
+            std::array<vec4, 4> corners;
+            std::array<ivec2, 4> uvs = { ivec2{ quad.u0, quad.v0 }, { quad.u1, quad.v0 }, { quad.u1, quad.v1 }, { quad.u0, quad.v1 } };
+            for (int i = 0; i < 4; i++) {
+                vec3 position = chunkOrigin;
+                position[quad.axis] += quad.plane * 0.5f;
+                position[uAxis] += uvs[i].x;
+                position[vAxis] += uvs[i].y;
+                corners[i] = frameViewProjection * vec4{ position, 1.f };
+            }
+            addPolygon(corners);
+        }
+    }
+
+    void finishOccluders() {
+        //horizontal bands, one per thread
+        int bands = RASTER_THREADS + 1;
+        int rowsPerBand = (DEPTH_HEIGHT + bands - 1) / bands;
+        for (int band = 1; band < bands; band++) {
+            rasterPool().submit([band, rowsPerBand]() {
+                rasterizeBand(band * rowsPerBand, std::min(DEPTH_HEIGHT, (band + 1) * rowsPerBand));
+            });
+        }
+        rasterizeBand(0, std::min(DEPTH_HEIGHT, rowsPerBand));
+        rasterPool().waitIdle();
+
+        for (size_t level = 1; level < depthLevels.size(); level++) {
+            ivec2 size = levelSizes[level];
+            ivec2 finer = levelSizes[level - 1];
+            const std::vector<float>& source = depthLevels[level - 1];
+            std::vector<float>& target = depthLevels[level];
+            for (int y = 0; y < size.y; y++) {
+                for (int x = 0; x < size.x; x++) {
+                    int x0 = std::min(2 * x, finer.x - 1);
+                    int x1 = std::min(2 * x + 1, finer.x - 1);
+                    int y0 = std::min(2 * y, finer.y - 1);
+                    int y1 = std::min(2 * y + 1, finer.y - 1);
+                    target[x + y * size.x] = std::max(
+                        std::max(source[x0 + y0 * finer.x], source[x1 + y0 * finer.x]),
+                        std::max(source[x0 + y1 * finer.x], source[x1 + y1 * finer.x]));
+                }
+            }
+        }
+    }
+
+    bool isBoxVisible(vec3 boxMin, vec3 boxMax) {
+        vec2 screenMin = vec2{ static_cast<float>(DEPTH_WIDTH), static_cast<float>(DEPTH_HEIGHT) };
+        vec2 screenMax = vec2{ 0.f };
+        float nearestDepth = 1.f;
+        for (int corner = 0; corner < 8; corner++) {
+            vec3 position = {
+                corner & 1 ? boxMax.x : boxMin.x,
+                corner & 2 ? boxMax.y : boxMin.y,
+                corner & 4 ? boxMax.z : boxMin.z
+            };
+            vec4 clip = frameViewProjection * vec4{ position, 1.f };
+            if (clip.z < -clip.w) {
+                return true; //reaches in front of the near plane
+            }
+            vec3 ndc = vec3{ clip.x, clip.y, clip.z } / clip.w;
+            vec2 screen = { (ndc.x * 0.5f + 0.5f) * DEPTH_WIDTH, (ndc.y * 0.5f + 0.5f) * DEPTH_HEIGHT };
+            screenMin = glm::min(screenMin, screen);
+            screenMax = glm::max(screenMax, screen);
+            nearestDepth = std::min(nearestDepth, ndc.z);
+        }
+        //a pixel of margin, since occluders are only rasterized where they cover pixel centers
+        ivec2 pixelMin = glm::max(ivec2{ glm::floor(screenMin) } - 1, ivec2{ 0 });
+        ivec2 pixelMax = glm::min(ivec2{ glm::floor(screenMax) } + 1, ivec2{ DEPTH_WIDTH - 1, DEPTH_HEIGHT - 1 });
+        if (pixelMin.x > pixelMax.x || pixelMin.y > pixelMax.y) {
+            return true; //off screen, which is for frustum culling to decide
+        }
+        //the finest level where the box covers at most 4x4 texels
+        size_t level = 0;
+        while (level + 1 < depthLevels.size() && glm::any(glm::greaterThanEqual((pixelMax >> static_cast<int>(level)) - (pixelMin >> static_cast<int>(level)), ivec2{ 4 }))) {
+            level++;
+        }
+        ivec2 size = levelSizes[level];
+        ivec2 texelMin = pixelMin >> static_cast<int>(level);
+        ivec2 texelMax = pixelMax >> static_cast<int>(level);
+        for (int y = texelMin.y; y <= texelMax.y; y++) {
+            for (int x = texelMin.x; x <= texelMax.x; x++) {
+                if (nearestDepth <= depthLevels[level][x + y * size.x]) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    size_t triangleCount() {
+        return triangles.size();
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "chunk.h"
+
+//software occlusion culling. large solid rectangles found at mesh time are rasterized on the CPU into a
+//small depth buffer every frame, and chunk bounds are tested against a max-depth pyramid of it before
+//draws are submitted. occluders only ever lie inside solid blocks and a box counts as visible if any pixel
+//around it could show it, so this only drops chunks that solid terrain really covers.
+namespace occlusion {
+    const int DEPTH_WIDTH = 256; //a multiple of 4 for the SSE path
+    const int DEPTH_HEIGHT = 128;
+    const int MIN_OCCLUDER_AREA = 48; //in blocks; smaller rectangles hide too little to be worth rasterizing
+    const size_t MAX_OCCLUDER_CHUNKS = 96; //the nearest chunks in view contribute their occluders each frame
+    const unsigned int RASTER_THREADS = 2; //besides the render thread, which rasterizes a band itself
+
+    //the largest solid rectangle across each axis, or all six faces of a completely solid chunk.
+    std::vector<OccluderQuad> findOccluders(const BlockList& blocks);
+
+    void beginFrame(const mat4& viewProjection);
+    void addOccluders(vec3 chunkOrigin, const std::vector<OccluderQuad>& occluders);
+    //rasterizes the occluders added since beginFrame and builds the depth pyramid.
+    void finishOccluders();
+    //false if the box is certainly behind the occluders.
+    bool isBoxVisible(vec3 boxMin, vec3 boxMax);
+
+    //occluder triangles rasterized by the last finishOccluders.
+    size_t triangleCount();
+}
@@ -0,0 +1,302 @@
+#include "physics.h"
+#include "density.h"
+#include "heightmap.h"
+#include "jobs.h"
+#include "worldgen.h"
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace physics {
+    namespace {
+        //a box resting flush against a block doesn't count as overlapping it
+        const float SKIN = 1e-4f;
+        const std::array<int, 3> SWEEP_AXES = { 1, 0, 2 };
+
+        struct Counters {
+            uint64_t sweeps = 0;
+            uint64_t blocksTested = 0;
+            uint64_t bricksSkipped = 0;
+        };
+
+        struct PhysicsStats {
+            std::atomic<uint64_t> sweeps{ 0 };
+            std::atomic<uint64_t> blocksTested{ 0 };
+            std::atomic<uint64_t> bricksSkipped{ 0 };
+            uint64_t ticks = 0;
+            uint64_t droppedTicks = 0;
+            uint64_t bodyTicks = 0;
+            double tickMs = 0.0;
+        };
+
+        struct Slot {
+            Body body;
+            bool alive = false;
+        };
+
+        std::vector<Slot> slots;
+        std::vector<BodyId> freeIds;
+        float pendingSeconds = 0.f;
+        PhysicsStats stats;
+
+        int floorDiv(int a, int b) {
+            return (a >= 0 ? a : a - b + 1) / b;
+        }
+
+        int floorToInt(float value) {
+            return static_cast<int>(floorf(value));
+        }
+
+        //how much of delta the box can move along axis before it touches a solid block.
+        float clampAxis(vec3 boxMin, vec3 boxMax, int axis, float delta, Counters& counters) {
+            if (delta == 0.f) {
+                return 0.f;
+            }
+            //the blocks the box sweeps into, leaving out any it already overlaps so it can't get stuck in them
+            ivec3 first, last;
+            for (int other = 0; other < 3; other++) {
+                first[other] = floorToInt(boxMin[other] + SKIN);
+                last[other] = floorToInt(boxMax[other] - SKIN);
+            }
+            if (delta > 0.f) {
+                first[axis] = floorToInt(boxMax[axis] - SKIN) + 1;
+                last[axis] = floorToInt(boxMax[axis] + delta - SKIN);
+            }
+            else {
+                first[axis] = floorToInt(boxMin[axis] + delta + SKIN);
+                last[axis] = floorToInt(boxMin[axis] + SKIN) - 1;
+            }
+            if (first[axis] > last[axis]) {
+                return delta;
+            }
+            auto stopAt = [&](int block) {
+                if (delta > 0.f) {
+                    delta = glm::min(delta, glm::max(static_cast<float>(block) - boxMax[axis], 0.f));
+                }
+                else {
+                    delta = glm::max(delta, glm::min(static_cast<float>(block + 1) - boxMin[axis], 0.f));
+                }
+            };
+
+            ivec3 firstChunk = { floorDiv(first.x, BLOCKS_PER_SIDE), floorDiv(first.y, BLOCKS_PER_SIDE), floorDiv(first.z, BLOCKS_PER_SIDE) };
+            ivec3 lastChunk = { floorDiv(last.x, BLOCKS_PER_SIDE), floorDiv(last.y, BLOCKS_PER_SIDE), floorDiv(last.z, BLOCKS_PER_SIDE) };
+            ChunkKey key;
+            for (key.z = firstChunk.z; key.z <= lastChunk.z; key.z++) {
+                for (key.y = firstChunk.y; key.y <= lastChunk.y; key.y++) {
+                    for (key.x = firstChunk.x; key.x <= lastChunk.x; key.x++) {
+                        ivec3 origin = key * BLOCKS_PER_SIDE;
+                        ivec3 low = glm::max(first, origin) - origin;
+                        ivec3 high = glm::min(last, origin + (BLOCKS_PER_SIDE - 1)) - origin;
+                        auto iter = perChunkState.find(key);
+                        if (iter == perChunkState.end()) {
+                            if (!worldgen::isEmptySky(key)) {
+                                stopAt(origin[axis] + (delta > 0.f ? low[axis] : high[axis]));
+                            }
+                            continue;
+                        }
+                        const PerChunkState& chunk = iter->second;
+                        if (chunk.solidBricks == 0) {
+                            continue;
+                        }
+                        ivec3 brick;
+                        for (brick.z = low.z / BRICK_SIDE; brick.z <= high.z / BRICK_SIDE; brick.z++) {
+                            for (brick.y = low.y / BRICK_SIDE; brick.y <= high.y / BRICK_SIDE; brick.y++) {
+                                for (brick.x = low.x / BRICK_SIDE; brick.x <= high.x / BRICK_SIDE; brick.x++) {
+                                    ivec3 brickLow = glm::max(low, brick * BRICK_SIDE);
+                                    ivec3 brickHigh = glm::min(high, brick * BRICK_SIDE + (BRICK_SIDE - 1));
+                                    if ((chunk.solidBricks & (1ull << getBrickIndex(brickLow))) == 0) {
+                                        counters.bricksSkipped++;
+                                        continue;
+                                    }
+                                    ivec3 coords;
+                                    for (coords.z = brickLow.z; coords.z <= brickHigh.z; coords.z++) {
+                                        for (coords.y = brickLow.y; coords.y <= brickHigh.y; coords.y++) {
+                                            for (coords.x = brickLow.x; coords.x <= brickHigh.x; coords.x++) {
+                                                counters.blocksTested++;
+                                                if (chunk.blocks[getChunkIndex(coords)] != AIR) {
+                                                    stopAt(origin[axis] + coords[axis]);
+                                                }
+                                            }
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            return delta;
+        }
+
+        vec3 sweep(vec3 center, vec3 halfExtents, vec3 displacement, Counters& counters) {
+            counters.sweeps++;
+            vec3 boxMin = center - halfExtents;
+            vec3 boxMax = center + halfExtents;
+            vec3 moved(0.f);
+            for (int axis : SWEEP_AXES) {
+                moved[axis] = clampAxis(boxMin, boxMax, axis, displacement[axis], counters);
+                boxMin[axis] += moved[axis];
+                boxMax[axis] += moved[axis];
+            }
+            return moved;
+        }
+
+        void tickBody(Body& body, Counters& counters) {
+            body.velocity.y -= GRAVITY * body.gravityScale * TICK_SECONDS;
+            vec3 wanted = body.velocity * TICK_SECONDS;
+            vec3 moved = sweep(body.position, body.halfExtents, wanted, counters);
+            body.position += moved;
+            body.onGround = false;
+            for (int axis = 0; axis < 3; axis++) {
+                if (moved[axis] != wanted[axis]) {
+                    body.onGround = body.onGround || (axis == 1 && wanted.y < 0.f);
+                    body.velocity[axis] = 0.f;
+                }
+            }
+        }
+
+        void addCounters(const Counters& counters) {
+            stats.sweeps += counters.sweeps;
+            stats.blocksTested += counters.blocksTested;
+            stats.bricksSkipped += counters.bricksSkipped;
+        }
+
+        void tickRange(size_t first, size_t last) {
+            Counters counters;
+            for (size_t i = first; i < last; i++) {
+                if (slots[i].alive) {
+                    tickBody(slots[i].body, counters);
+                }
+            }
+            addCounters(counters);
+        }
+
+        //blocks only change on the main thread, which waits here, so the workers can read them freely
+        void tick(bool parallel) {
+            auto start = std::chrono::steady_clock::now();
+            if (parallel) {
+                parallelRanges(slots.size(), MIN_BODIES_PER_JOB, tickRange);
+            }
+            else {
+                tickRange(0, slots.size());
+            }
+            stats.ticks++;
+            stats.bodyTicks += slots.size() - freeIds.size();
+            stats.tickMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    BodyId addBody(const Body& body) {
+        BodyId id;
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        }
+        else {
+            id = static_cast<BodyId>(slots.size());
+            slots.emplace_back();
+        }
+        slots[id].body = body;
+        slots[id].alive = true;
+        return id;
+    }
+
+    void removeBody(BodyId id) {
+        slots[id].alive = false;
+        freeIds.push_back(id);
+    }
+
+    Body& body(BodyId id) {
+        return slots[id].body;
+    }
+
+    vec3 sweepBox(vec3 center, vec3 halfExtents, vec3 displacement) {
+        Counters counters;
+        vec3 moved = sweep(center, halfExtents, displacement, counters);
+        addCounters(counters);
+        return moved;
+    }
+
+    void update(float seconds) {
+        pendingSeconds += seconds;
+        int ticks = static_cast<int>(pendingSeconds / TICK_SECONDS);
+        pendingSeconds -= ticks * TICK_SECONDS;
+        if (ticks > MAX_TICKS_PER_UPDATE) {
+            stats.droppedTicks += ticks - MAX_TICKS_PER_UPDATE;
+            ticks = MAX_TICKS_PER_UPDATE;
+        }
+        for (int i = 0; i < ticks; i++) {
+            tick(true);
+        }
+    }
+
+    void benchmark(int bodyCount) {
+        //8x8 columns of generated terrain, from below the lowest surface to above the highest
+        const int COLUMNS = 8;
+        int highestSurface = INT_MIN;
+        for (int z = 0; z < COLUMNS; z++) {
+            for (int x = 0; x < COLUMNS; x++) {
+                const ColumnHeights& heights = heightmap::column({ x, z });
+                int lowestChunk = static_cast<int>(floorf((heights.minSurface - density::OVERHANG_AMPLITUDE) / BLOCKS_PER_SIDE)) - 1;
+                highestSurface = glm::max(highestSurface, heights.maxSurface);
+                //up to the sky, as chunks below it that aren't resident stop bodies
+                for (int y = lowestChunk; !worldgen::isEmptySky({ x, y, z }); y++) {
+                    PerChunkState& chunk = perChunkState[{ x, y, z }];
+                    density::generateChunk({ x, y, z }, chunk);
+                    chunk.solidBricks = findSolidBricks(chunk.blocks);
+                }
+            }
+        }
+
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> across(4.f, COLUMNS * BLOCKS_PER_SIDE - 4.f);
+        std::uniform_real_distribution<float> height(2.f, 24.f);
+        std::uniform_real_distribution<float> speed(-8.f, 8.f);
+        std::vector<Body> dropped;
+        for (int i = 0; i < bodyCount; i++) {
+            Body body;
+            body.position = { across(random), highestSurface + height(random), across(random) };
+            body.halfExtents = { 0.3f, 0.9f, 0.3f };
+            body.velocity = { speed(random), 0.f, speed(random) };
+            dropped.push_back(body);
+        }
+
+        //five seconds of falling, landing and sliding into walls, on one thread and then on all of them
+        const int TICKS = 300;
+        for (bool parallel : { false, true }) {
+            slots.clear();
+            freeIds.clear();
+            for (auto& body : dropped) {
+                addBody(body);
+            }
+            uint64_t blocksTestedBefore = stats.blocksTested;
+            uint64_t sweepsBefore = stats.sweeps;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < TICKS; i++) {
+                tick(parallel);
+            }
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            int grounded = 0;
+            for (auto& slot : slots) {
+                grounded += slot.body.onGround;
+            }
+            printf("physics: %d bodies for %d ticks on %s, %.0f body ticks per ms, %.1f blocks tested per sweep, %d on the ground at the end\n",
+                bodyCount, TICKS, parallel ? "the worker pool" : "one thread", bodyCount * static_cast<double>(TICKS) / milliseconds,
+                static_cast<double>(stats.blocksTested - blocksTestedBefore) / glm::max<uint64_t>(stats.sweeps - sweepsBefore, 1), grounded);
+        }
+        slots.clear();
+        freeIds.clear();
+        perChunkState.clear();
+    }
+
+    void printStats() {
+        printf("physics: %zu bodies, %llu ticks (%llu dropped) at %.3fms, %.1f blocks tested and %.1f bricks skipped per sweep\n",
+            slots.size() - freeIds.size(), static_cast<unsigned long long>(stats.ticks), static_cast<unsigned long long>(stats.droppedTicks),
+            stats.ticks > 0 ? stats.tickMs / stats.ticks : 0.0,
+            stats.sweeps > 0 ? static_cast<double>(stats.blocksTested) / stats.sweeps : 0.0,
+            stats.sweeps > 0 ? static_cast<double>(stats.bricksSkipped) / stats.sweeps : 0.0);
+    }
+}
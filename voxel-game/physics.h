@@ -0,0 +1,40 @@
+#pragma once
+#include "chunk.h"
+
+//axis-aligned boxes moving through the resident blocks. a move is swept one axis at a time (y, then x, then z)
+//and stops flush against the nearest solid block in the way, so nothing tunnels however fast it goes. only
+//the bricks set in each chunk's solidBricks have their blocks tested. a chunk that isn't resident stops
+//bodies unless it's sky (see worldgen::isEmptySky), so they wait for the ground and trees to load instead
+//of passing through them.
+//bodies only collide with blocks, not each other, so a tick is split over the workers when there are many.
+namespace physics {
+    const float TICK_SECONDS = 1.f / 60.f;
+    const int MAX_TICKS_PER_UPDATE = 4; //further behind than this the simulation slows down instead of catching up
+    const float GRAVITY = 32.f; //blocks per second squared
+    const size_t MIN_BODIES_PER_JOB = 256; //bodies claimed at a time by each thread in a tick, see parallelRanges
+
+    typedef uint32_t BodyId;
+
+    struct Body {
+        vec3 position; //center of the box
+        vec3 halfExtents;
+        vec3 velocity = vec3(0.f); //blocks per second
+        float gravityScale = 1.f;
+        bool onGround = false; //a block stopped it falling in the last tick
+    };
+
+    BodyId addBody(const Body& body);
+    void removeBody(BodyId id);
+    //until the body is removed.
+    Body& body(BodyId id);
+
+    //how far the box gets towards displacement before blocks stop it.
+    vec3 sweepBox(vec3 center, vec3 halfExtents, vec3 displacement);
+
+    //runs the fixed ticks that fit into the time since the last update.
+    void update(float seconds);
+
+    //drops bodies onto generated terrain and prints how many body ticks run per millisecond.
+    void benchmark(int bodyCount);
+    void printStats();
+}
@@ -0,0 +1,216 @@
+#include "raycast.h"
+#include "jobs.h"
+#include "worldgen.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <future>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace raycast {
+    namespace {
+        struct Counters {
+            uint64_t rays = 0;
+            uint64_t blocksTested = 0;
+            uint64_t bricksSkipped = 0;
+            uint64_t chunksSkipped = 0;
+        };
+
+        struct RaycastStats {
+            std::atomic<uint64_t> rays{ 0 };
+            std::atomic<uint64_t> blocksTested{ 0 };
+            std::atomic<uint64_t> bricksSkipped{ 0 };
+            std::atomic<uint64_t> chunksSkipped{ 0 };
+            uint64_t batches = 0;
+            uint64_t batchedRays = 0;
+            double batchMs = 0.0;
+        };
+
+        RaycastStats stats;
+
+        int floorDiv(int a, int b) {
+            return (a >= 0 ? a : a - b + 1) / b;
+        }
+
+        //the cell the ray is in, and at which distance it crosses into the next cell along each axis.
+        struct Walk {
+            vec3 origin;
+            vec3 direction; //normalized
+            vec3 inverse; //of direction, infinite along axes it doesn't move on
+            ivec3 step;
+            ivec3 cell;
+            vec3 nextCrossing;
+            float distance = 0.f; //at which the ray entered cell
+            int enteredAxis = -1;
+
+            Walk(vec3 rayOrigin, vec3 rayDirection) : origin(rayOrigin), direction(glm::normalize(rayDirection)) {
+                for (int axis = 0; axis < 3; axis++) {
+                    step[axis] = direction[axis] > 0.f ? 1 : direction[axis] < 0.f ? -1 : 0;
+                    inverse[axis] = step[axis] != 0 ? 1.f / direction[axis] : std::numeric_limits<float>::infinity();
+                }
+                cell = ivec3(glm::floor(origin));
+                findCrossings();
+            }
+
+            void findCrossings() {
+                for (int axis = 0; axis < 3; axis++) {
+                    nextCrossing[axis] = step[axis] == 0 ? std::numeric_limits<float>::infinity()
+                        : (static_cast<float>(cell[axis] + (step[axis] > 0 ? 1 : 0)) - origin[axis]) * inverse[axis];
+                }
+            }
+
+            int nearestAxis(vec3 crossings) const {
+                return crossings.x < crossings.y ? (crossings.x < crossings.z ? 0 : 2) : (crossings.y < crossings.z ? 1 : 2);
+            }
+
+            void stepCell() {
+                int axis = nearestAxis(nextCrossing);
+                distance = nextCrossing[axis];
+                cell[axis] += step[axis];
+                nextCrossing[axis] += glm::abs(inverse[axis]);
+                enteredAxis = axis;
+            }
+
+            //moves to the first cell past the empty box of size cells with its lowest cell at boxMin.
+            void leaveBox(ivec3 boxMin, int size) {
+                vec3 exits;
+                for (int axis = 0; axis < 3; axis++) {
+                    exits[axis] = step[axis] == 0 ? std::numeric_limits<float>::infinity()
+                        : (static_cast<float>(boxMin[axis] + (step[axis] > 0 ? size : 0)) - origin[axis]) * inverse[axis];
+                }
+                int axis = nearestAxis(exits);
+                distance = glm::max(distance, exits[axis]);
+                vec3 exit = origin + direction * distance;
+                for (int other = 0; other < 3; other++) {
+                    //clamped, since the exit point can round into a neighboring cell near the box's edges
+                    cell[other] = glm::clamp(static_cast<int>(glm::floor(exit[other])), boxMin[other], boxMin[other] + size - 1);
+                }
+                cell[axis] = step[axis] > 0 ? boxMin[axis] + size : boxMin[axis] - 1;
+                enteredAxis = axis;
+                findCrossings();
+            }
+        };
+
+        bool isFinite(vec3 v) {
+            return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+        }
+
+        Hit castCounted(const Ray& ray, Counters& counters) {
+            Hit hit;
+            counters.rays++;
+            if (ray.direction == vec3(0.f) || !isFinite(ray.origin) || !isFinite(ray.direction) || !std::isfinite(ray.maxDistance)) {
+                return hit;
+            }
+            float maxDistance = glm::min(ray.maxDistance, MAX_DISTANCE);
+            Walk walk(ray.origin, ray.direction);
+            auto stop = [&]() {
+                hit.hit = true;
+                hit.block = walk.cell;
+                if (walk.enteredAxis >= 0) {
+                    hit.normal[walk.enteredAxis] = -walk.step[walk.enteredAxis];
+                }
+                hit.distance = walk.distance;
+            };
+            ChunkKey cachedKey;
+            const PerChunkState* chunk = nullptr;
+            bool cached = false;
+            while (walk.distance <= maxDistance) {
+                ChunkKey key = { floorDiv(walk.cell.x, BLOCKS_PER_SIDE), floorDiv(walk.cell.y, BLOCKS_PER_SIDE), floorDiv(walk.cell.z, BLOCKS_PER_SIDE) };
+                if (!cached || key != cachedKey) {
+                    auto iter = perChunkState.find(key);
+                    chunk = iter != perChunkState.end() ? &iter->second : nullptr;
+                    cachedKey = key;
+                    cached = true;
+                }
+                if (chunk == nullptr && !worldgen::isEmptySky(key)) {
+                    stop();
+                    hit.unloaded = true;
+                    return hit;
+                }
+                if (chunk == nullptr || chunk->solidBricks == 0) {
+                    walk.leaveBox(key * BLOCKS_PER_SIDE, BLOCKS_PER_SIDE);
+                    counters.chunksSkipped++;
+                    continue;
+                }
+                ivec3 local = walk.cell - key * BLOCKS_PER_SIDE;
+                if ((chunk->solidBricks & (1ull << getBrickIndex(local))) == 0) {
+                    walk.leaveBox(walk.cell - local % BRICK_SIDE, BRICK_SIDE);
+                    counters.bricksSkipped++;
+                    continue;
+                }
+                counters.blocksTested++;
+                Block block = chunk->blocks[getChunkIndex(local)];
+                if (block != AIR) {
+                    stop();
+                    hit.material = block;
+                    return hit;
+                }
+                walk.stepCell();
+            }
+            return hit;
+        }
+
+        void addCounters(const Counters& counters) {
+            stats.rays += counters.rays;
+            stats.blocksTested += counters.blocksTested;
+            stats.bricksSkipped += counters.bricksSkipped;
+            stats.chunksSkipped += counters.chunksSkipped;
+        }
+
+        void castRange(const Ray* rays, size_t first, size_t last, Hit* hits) {
+            Counters counters;
+            for (size_t i = first; i < last; i++) {
+                hits[i] = castCounted(rays[i], counters);
+            }
+            addCounters(counters);
+        }
+    }
+
+    Hit cast(const Ray& ray) {
+        Counters counters;
+        Hit hit = castCounted(ray, counters);
+        addCounters(counters);
+        return hit;
+    }
+
+    void castBatch(const Ray* rays, size_t count, Hit* hits) {
+        auto start = std::chrono::steady_clock::now();
+        //the calling thread takes the first share instead of waiting behind whatever the workers are doing
+        size_t jobs = glm::max<size_t>(glm::min<size_t>(count / MIN_RAYS_PER_JOB, workerPool().size() + 1), 1);
+        size_t raysPerJob = (count + jobs - 1) / jobs;
+        std::vector<std::future<void>> pending;
+        for (size_t job = 1; job < jobs; job++) {
+            size_t first = job * raysPerJob;
+            size_t last = glm::min(first + raysPerJob, count);
+            auto task = std::make_shared<std::packaged_task<void()>>([=]() { castRange(rays, first, last, hits); });
+            pending.push_back(task->get_future());
+            workerPool().submit([task]() { (*task)(); });
+        }
+        castRange(rays, 0, glm::min(raysPerJob, count), hits);
+        for (auto& job : pending) {
+            job.wait();
+        }
+        stats.batches++;
+        stats.batchedRays += count;
+        stats.batchMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool isVisible(vec3 from, vec3 to) {
+        float distance = glm::distance(from, to);
+        return distance == 0.f || !cast({ from, to - from, distance }).hit;
+    }
+
+    void printStats() {
+        uint64_t rays = stats.rays;
+        printf("raycast: %llu rays, %.1f blocks tested, %.1f bricks and %.1f chunks skipped per ray, %llu batches at %.3fus per ray\n",
+            static_cast<unsigned long long>(rays),
+            rays > 0 ? static_cast<double>(stats.blocksTested) / rays : 0.0,
+            rays > 0 ? static_cast<double>(stats.bricksSkipped) / rays : 0.0,
+            rays > 0 ? static_cast<double>(stats.chunksSkipped) / rays : 0.0,
+            static_cast<unsigned long long>(stats.batches),
+            stats.batchedRays > 0 ? stats.batchMs * 1000.0 / stats.batchedRays : 0.0);
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "chunk.h"
+
+//ray queries against the resident blocks, for block picking, line of sight and light probes. a ray walks the
+//block grid cell by cell (3D DDA) across chunk borders, and jumps across whole chunks that are sky or have no
+//solid blocks, and across 4x4x4 bricks whose bit in the chunk's solidBricks is clear. like a body in physics.h,
+//a ray stops at a chunk that isn't resident unless it's sky (see worldgen::isEmptySky), as its blocks are unknown.
+namespace raycast {
+    //below this many rays a batch isn't worth splitting over the workers
+    const size_t MIN_RAYS_PER_JOB = 64;
+    //longer rays are cut short, so e.g. an infinite one doesn't walk up through the sky forever
+    const float MAX_DISTANCE = 65536.f;
+
+    struct Ray {
+        vec3 origin;
+        vec3 direction; //needn't be normalized
+        float maxDistance; //in blocks. rays with a non-finite origin, direction or distance miss
+    };
+
+    struct Hit {
+        bool hit = false;
+        bool unloaded = false; //stopped at a chunk that isn't resident, so the block may well be air
+        ivec3 block = ivec3(0); //the solid block the ray stopped in
+        ivec3 normal = ivec3(0); //of the face it entered through, zero if it started inside the block
+        float distance = 0.f; //from the origin, in blocks
+        Block material = AIR;
+    };
+
+    //the first solid block along the ray, or the first unloaded chunk, within maxDistance.
+    Hit cast(const Ray& ray);
+    //cast for every ray, in parallel on the worker pool. blocks must not change until it returns.
+    void castBatch(const Ray* rays, size_t count, Hit* hits);
+    //whether the segment between the points crosses no solid block.
+    bool isVisible(vec3 from, vec3 to);
+
+    void printStats();
+}
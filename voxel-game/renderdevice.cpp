@@ -0,0 +1,238 @@
+#include "renderdevice.h"
+#include <cstdio>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace render {
+    namespace {
+        std::unique_ptr<Device> currentDevice;
+
+        class RecordingDevice : public Device {
+        public:
+            BufferId createBuffer(size_t bytes, const void* data) override {
+                deviceStats.calls++;
+                deviceStats.buffersCreated++;
+                BufferId buffer = nextBuffer++;
+                bufferBytes[buffer] = bytes;
+                if (data != nullptr) {
+                    deviceStats.bytesUploaded += bytes;
+                }
+                return buffer;
+            }
+
+            void setBufferData(BufferId buffer, size_t bytes, const void* data) override {
+                deviceStats.calls++;
+                auto iter = bufferBytes.find(buffer);
+                if (iter == bufferBytes.end()) {
+                    deviceStats.invalidCalls++;
+                    return;
+                }
+                iter->second = bytes;
+                if (data != nullptr) {
+                    deviceStats.bytesUploaded += bytes;
+                }
+            }
+
+            void uploadBuffer(BufferId buffer, size_t offset, size_t bytes, const void* data) override {
+                deviceStats.calls++;
+                if (!isInRange(buffer, offset, bytes)) {
+                    deviceStats.invalidCalls++;
+                    return;
+                }
+                deviceStats.bytesUploaded += bytes;
+            }
+
+            void copyBuffer(BufferId source, size_t sourceOffset, BufferId target, size_t targetOffset, size_t bytes) override {
+                deviceStats.calls++;
+                if (!isInRange(source, sourceOffset, bytes) || !isInRange(target, targetOffset, bytes)) {
+                    deviceStats.invalidCalls++;
+                    return;
+                }
+                deviceStats.bytesCopied += bytes;
+            }
+
+            void deleteBuffer(BufferId buffer) override {
+                deviceStats.calls++;
+                if (bufferBytes.erase(buffer) == 0) {
+                    deviceStats.invalidCalls++;
+                    return;
+                }
+                deviceStats.buffersDeleted++;
+            }
+
+            void* createMappedBuffer(size_t bytes, BufferId& buffer) override {
+                buffer = createBuffer(bytes, nullptr);
+                auto& memory = mappedMemory[buffer];
+                memory.resize(bytes);
+                return memory.data();
+            }
+
+            void deleteMappedBuffer(BufferId buffer) override {
+                mappedMemory.erase(buffer);
+                deleteBuffer(buffer);
+            }
+
+            FenceId insertFence() override {
+                deviceStats.calls++;
+                return nextFence++;
+            }
+
+            bool isFenceSignaled(FenceId fence) override {
+                deviceStats.calls++;
+                return true;
+            }
+
+            void deleteFence(FenceId fence) override {
+                deviceStats.calls++;
+            }
+
+            ProgramId createProgram(const std::string& vertexSource, const std::string& fragmentSource) override {
+                deviceStats.calls++;
+                return nextProgram++;
+            }
+
+            void setViewport(int width, int height) override {
+                deviceStats.calls++;
+            }
+
+            void clear() override {
+                deviceStats.calls++;
+            }
+
+            void useProgram(ProgramId program) override {
+                deviceStats.calls++;
+            }
+
+            void setUniform(int location, const mat4& value) override {
+                deviceStats.calls++;
+            }
+
+            void setUniform(int location, const vec4& value) override {
+                deviceStats.calls++;
+            }
+
+            void setIndexBuffer(BufferId buffer) override {
+                countBufferUse(buffer);
+            }
+
+            void setChunkVertexBuffer(BufferId buffer) override {
+                countBufferUse(buffer);
+            }
+
+            void setChunkOriginBuffer(BufferId buffer) override {
+                countBufferUse(buffer);
+            }
+
+            void setChunkOrigin(vec4 origin) override {
+                deviceStats.calls++;
+            }
+
+            void drawIndexed(uint32_t indexCount, int32_t baseVertex) override {
+                deviceStats.calls++;
+                deviceStats.drawCalls++;
+                deviceStats.draws++;
+                deviceStats.indices += indexCount;
+            }
+
+            void multiDrawIndexedIndirect(BufferId commands, size_t firstCommand, size_t commandCount) override {
+                deviceStats.calls++;
+                if (!isInRange(commands, firstCommand * sizeof(DrawIndirectCommand), commandCount * sizeof(DrawIndirectCommand))) {
+                    deviceStats.invalidCalls++;
+                    return;
+                }
+                deviceStats.drawCalls++;
+                deviceStats.draws += commandCount;
+            }
+
+            TextureId createShadowMaps(int size, int layers) override {
+                deviceStats.calls++;
+                TextureId maps = nextTexture++;
+                shadowMapLayers[maps] = layers;
+                return maps;
+            }
+
+            void deleteShadowMaps(TextureId maps) override {
+                deviceStats.calls++;
+                if (shadowMapLayers.erase(maps) == 0) {
+                    deviceStats.invalidCalls++;
+                }
+            }
+
+            void beginShadowPass(TextureId maps, int layer) override {
+                deviceStats.calls++;
+                auto iter = shadowMapLayers.find(maps);
+                if (iter == shadowMapLayers.end() || layer < 0 || layer >= iter->second || inShadowPass) {
+                    deviceStats.invalidCalls++;
+                }
+                inShadowPass = true;
+            }
+
+            void endShadowPass() override {
+                deviceStats.calls++;
+                if (!inShadowPass) {
+                    deviceStats.invalidCalls++;
+                }
+                inShadowPass = false;
+            }
+
+            void bindShadowMaps(int unit, TextureId maps) override {
+                deviceStats.calls++;
+                if (shadowMapLayers.find(maps) == shadowMapLayers.end()) {
+                    deviceStats.invalidCalls++;
+                }
+            }
+
+            void finish() override {
+                deviceStats.calls++;
+            }
+
+        private:
+            bool isInRange(BufferId buffer, size_t offset, size_t bytes) {
+                auto iter = bufferBytes.find(buffer);
+                return iter != bufferBytes.end() && offset + bytes <= iter->second;
+            }
+
+            void countBufferUse(BufferId buffer) {
+                deviceStats.calls++;
+                if (bufferBytes.find(buffer) == bufferBytes.end()) {
+                    deviceStats.invalidCalls++;
+                }
+            }
+
+            std::unordered_map<BufferId, size_t> bufferBytes;
+            std::unordered_map<BufferId, std::vector<uint8_t>> mappedMemory;
+            std::unordered_map<TextureId, int> shadowMapLayers;
+            bool inShadowPass = false;
+            BufferId nextBuffer = 1;
+            ProgramId nextProgram = 1;
+            FenceId nextFence = 1;
+            TextureId nextTexture = 1;
+        };
+    }
+
+    Device& device() {
+        return *currentDevice;
+    }
+
+    void setDevice(Device* newDevice) {
+        currentDevice.reset(newDevice);
+    }
+
+    Device* createRecordingDevice() {
+        return new RecordingDevice();
+    }
+
+    void printStats() {
+        const DeviceStats& stats = currentDevice->stats();
+        printf("render device: %llu calls, %llu buffers created, %llu deleted, %.1fMB uploaded, %.1fMB copied, %llu draw calls for %llu draws, %llu invalid calls\n",
+            static_cast<unsigned long long>(stats.calls),
+            static_cast<unsigned long long>(stats.buffersCreated),
+            static_cast<unsigned long long>(stats.buffersDeleted),
+            stats.bytesUploaded / (1024.0 * 1024.0),
+            stats.bytesCopied / (1024.0 * 1024.0),
+            static_cast<unsigned long long>(stats.drawCalls),
+            static_cast<unsigned long long>(stats.draws),
+            static_cast<unsigned long long>(stats.invalidCalls));
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+#define GLM_FORCE_SWIZZLE
+#define GLM_ENABLE_EXPERIMENTAL
+#include "glm/glm.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace glm;
+
+//the renderer's only way to the GPU. draw.cpp, gpumem and uploadring go through the current device, so the
+//whole streaming, meshing and upload pipeline can run against the recording device without a GL context.
+//the interface is as thin as this renderer needs: buffers, fences, one kind of program input, draws and the
+//shadow map depth passes.
+namespace render {
+    typedef uint32_t BufferId;
+    typedef uint32_t ProgramId;
+    typedef uint64_t FenceId;
+    typedef uint32_t TextureId;
+    const BufferId NO_BUFFER = 0;
+    const TextureId NO_TEXTURE = 0;
+
+    //layout fixed by glMultiDrawElementsIndirect
+    struct DrawIndirectCommand {
+        uint32_t count;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        int32_t baseVertex;
+        uint32_t baseInstance;
+    };
+
+    struct DeviceStats {
+        uint64_t calls = 0; //to the device
+        uint64_t buffersCreated = 0;
+        uint64_t buffersDeleted = 0;
+        uint64_t bytesUploaded = 0; //from CPU memory
+        uint64_t bytesCopied = 0; //between buffers
+        uint64_t drawCalls = 0; //a multi-draw is one call
+        uint64_t draws = 0; //a multi-draw counts each of its commands
+        uint64_t indices = 0; //only known for direct draws
+        uint64_t invalidCalls = 0; //unknown buffers or out of range, recording device only
+    };
+
+    class Device {
+    public:
+        virtual ~Device() {}
+
+        //data may be null.
+        virtual BufferId createBuffer(size_t bytes, const void* data) = 0;
+        //replaces the buffer's storage, e.g. to stream per-frame data without waiting on the last frame's.
+        virtual void setBufferData(BufferId buffer, size_t bytes, const void* data) = 0;
+        virtual void uploadBuffer(BufferId buffer, size_t offset, size_t bytes, const void* data) = 0;
+        virtual void copyBuffer(BufferId source, size_t sourceOffset, BufferId target, size_t targetOffset, size_t bytes) = 0;
+        virtual void deleteBuffer(BufferId buffer) = 0;
+        //a persistently mapped, coherent buffer for the CPU to write into. returns nullptr if unsupported.
+        virtual void* createMappedBuffer(size_t bytes, BufferId& buffer) = 0;
+        virtual void deleteMappedBuffer(BufferId buffer) = 0;
+
+        //signals once the GPU has finished everything issued before it.
+        virtual FenceId insertFence() = 0;
+        virtual bool isFenceSignaled(FenceId fence) = 0;
+        virtual void deleteFence(FenceId fence) = 0;
+
+        virtual ProgramId createProgram(const std::string& vertexSource, const std::string& fragmentSource) = 0;
+        virtual void setViewport(int width, int height) = 0;
+        //clears color and depth.
+        virtual void clear() = 0;
+        virtual void useProgram(ProgramId program) = 0;
+        virtual void setUniform(int location, const mat4& value) = 0;
+        virtual void setUniform(int location, const vec4& value) = 0;
+        virtual void setIndexBuffer(BufferId buffer) = 0;
+        //ChunkVertexFormat vertices for the next draws.
+        virtual void setChunkVertexBuffer(BufferId buffer) = 0;
+        //chunk origins per draw, read at each draw's baseInstance.
+        virtual void setChunkOriginBuffer(BufferId buffer) = 0;
+        //one chunk origin for the next direct draws.
+        virtual void setChunkOrigin(vec4 origin) = 0;
+        virtual void drawIndexed(uint32_t indexCount, int32_t baseVertex) = 0;
+        virtual void multiDrawIndexedIndirect(BufferId commands, size_t firstCommand, size_t commandCount) = 0;
+        //an array of square depth textures, one per layer, sampled with depth comparison.
+        virtual TextureId createShadowMaps(int size, int layers) = 0;
+        virtual void deleteShadowMaps(TextureId maps) = 0;
+        //clears the layer, and the next draws only write depth into it, pushed back by their slope.
+        virtual void beginShadowPass(TextureId maps, int layer) = 0;
+        //back to the framebuffer and viewport that were current at beginShadowPass.
+        virtual void endShadowPass() = 0;
+        virtual void bindShadowMaps(int unit, TextureId maps) = 0;
+        //blocks until everything issued so far has executed, e.g. to time whole frames without a swap.
+        virtual void finish() = 0;
+
+        const DeviceStats& stats() const { return deviceStats; }
+
+    protected:
+        DeviceStats deviceStats;
+    };
+
+    Device& device();
+    //takes ownership and deletes the previous device.
+    void setDevice(Device* newDevice);
+
+    typedef void* (*ProcLoader)(const char* name);
+    //needs a current GL 4.3 context with glad already loaded.
+    Device* createGLDevice(ProcLoader loader);
+    //executes nothing and only counts. mapped buffers are plain memory and fences signal immediately.
+    Device* createRecordingDevice();
+
+    void printStats();
+}
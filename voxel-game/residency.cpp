@@ -0,0 +1,142 @@
+#include "residency.h"
+#include "connectivity.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace residency {
+    namespace {
+        struct Resident {
+            uint64_t bytes = 0;
+            int bucket = 0;
+        };
+
+        struct ResidencyStats {
+            uint64_t evictions = 0;
+            uint64_t evictedBytes = 0;
+            uint64_t rebuckets = 0;
+            uint64_t framesStuckOverBudget = 0; //over budget with nothing out of range left to evict
+            uint64_t peakBytes = 0;
+        };
+
+        uint64_t budgetBytes = DEFAULT_BUDGET_BYTES;
+        uint64_t totalBytes = 0;
+        std::unordered_map<ChunkKey, Resident> residents; //every chunk in chunkGLBuffers
+        std::vector<std::unordered_set<ChunkKey>> buckets; //by distance from bucketCenter
+        ChunkKey bucketCenter = { 0, 0, 0 };
+        ResidencyStats stats;
+
+        int distance(ChunkKey from, ChunkKey to) {
+            ivec3 offset = glm::abs(to - from);
+            return std::max(offset.x, std::max(offset.y, offset.z));
+        }
+
+        void addToBucket(ChunkKey key, Resident& resident) {
+            resident.bucket = distance(bucketCenter, key);
+            if (resident.bucket >= static_cast<int>(buckets.size())) {
+                buckets.resize(resident.bucket + 1);
+            }
+            buckets[resident.bucket].insert(key);
+        }
+
+        void rebucket(ChunkKey center) {
+            bucketCenter = center;
+            for (auto& bucket : buckets) {
+                bucket.clear();
+            }
+            for (auto& keyAndResident : residents) {
+                addToBucket(keyAndResident.first, keyAndResident.second);
+            }
+            while (!buckets.empty() && buckets.back().empty()) {
+                buckets.pop_back();
+            }
+            stats.rebuckets++;
+        }
+
+        //the caller removes the key from its bucket.
+        void evict(ChunkKey key) {
+            auto resident = residents.find(key);
+            totalBytes -= resident->second.bytes;
+            if (resident->second.bytes > 0) {
+                stats.evictions++;
+                stats.evictedBytes += resident->second.bytes;
+            }
+            residents.erase(resident);
+
+            auto chunkGLState = chunkGLBuffers.find(key);
+            gpumem::free(chunkGLState->second.mesh);
+            chunkGLBuffers.erase(chunkGLState);
+            //the blocks are still loaded, but the next time the chunk is drawn it needs a new mesh
+            notUpdated.insert(key);
+        }
+    }
+
+    void setBudget(uint64_t bytes) {
+        budgetBytes = bytes;
+    }
+
+    void meshStored(ChunkKey key, uint64_t bytes) {
+        auto iter = residents.find(key);
+        if (iter == residents.end()) {
+            iter = residents.insert({ key, Resident() }).first;
+            addToBucket(key, iter->second);
+        }
+        totalBytes = totalBytes - iter->second.bytes + bytes;
+        iter->second.bytes = bytes;
+        stats.peakBytes = std::max(stats.peakBytes, totalBytes);
+    }
+
+    void update() {
+        ChunkKey viewerChunk = connectivity::chunkContaining(viewerPosition);
+        if (viewerChunk != bucketCenter) {
+            rebucket(viewerChunk);
+        }
+        if (totalBytes <= budgetBytes) {
+            return;
+        }
+
+        //everything this close is in the renderDistance cube, so it can't be evicted
+        int drawnDistance = std::min(renderDistance.x, std::min(renderDistance.y, renderDistance.z));
+        int evictions = 0;
+        bool evictedAny = false;
+        for (int bucket = static_cast<int>(buckets.size()) - 1; bucket > drawnDistance; bucket--) {
+            auto& keys = buckets[bucket];
+            for (auto iter = keys.begin(); iter != keys.end() && totalBytes > budgetBytes && evictions < MAX_EVICTIONS_PER_FRAME;) {
+                if (chunksThatShouldBeDrawn.find(*iter) != chunksThatShouldBeDrawn.end()) {
+                    ++iter;
+                    continue;
+                }
+                //chunks without a mesh cost nothing to drop and don't count towards the limit
+                if (residents[*iter].bytes > 0) {
+                    evictions++;
+                }
+                evict(*iter);
+                iter = keys.erase(iter);
+                evictedAny = true;
+            }
+            if (totalBytes <= budgetBytes || evictions == MAX_EVICTIONS_PER_FRAME) {
+                break;
+            }
+        }
+        while (!buckets.empty() && buckets.back().empty()) {
+            buckets.pop_back();
+        }
+        if (totalBytes > budgetBytes && evictions < MAX_EVICTIONS_PER_FRAME) {
+            stats.framesStuckOverBudget++;
+        }
+        if (evictedAny) {
+            drawableChunksVersion++;
+        }
+    }
+
+    uint64_t residentBytes() {
+        return totalBytes;
+    }
+
+    void printStats() {
+        auto megabytes = [](uint64_t bytes) { return bytes / (1024.0 * 1024.0); };
+        printf("residency: %zu chunks, %.1fMB of %.1fMB budget (peak %.1fMB), %llu meshes evicted (%.1fMB), %llu rebuckets, %llu frames stuck over budget\n",
+            residents.size(), megabytes(totalBytes), megabytes(budgetBytes), megabytes(stats.peakBytes),
+            static_cast<unsigned long long>(stats.evictions), megabytes(stats.evictedBytes),
+            static_cast<unsigned long long>(stats.rebuckets), static_cast<unsigned long long>(stats.framesStuckOverBudget));
+    }
+}
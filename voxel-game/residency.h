@@ -0,0 +1,21 @@
+#pragma once
+#include "chunk.h"
+
+//keeps chunk meshes on the GPU within a byte budget. resident chunks are kept in buckets by their
+//distance in chunks (the largest axis) from the viewer's chunk, and the buckets are only rebuilt when the
+//viewer enters another chunk. while over budget, update() evicts from the farthest bucket inwards, at
+//most MAX_EVICTIONS_PER_FRAME meshes a frame and never a chunk that should be drawn. evicted chunks keep
+//their blocks and are meshed again once they come back into range.
+namespace residency {
+    const uint64_t DEFAULT_BUDGET_BYTES = 192ull << 20;
+    const int MAX_EVICTIONS_PER_FRAME = 16;
+
+    void setBudget(uint64_t bytes);
+    //the chunk's mesh was replaced. bytes as allocated from gpumem, 0 without a mesh.
+    void meshStored(ChunkKey key, uint64_t bytes);
+    //once per frame.
+    void update();
+
+    uint64_t residentBytes();
+    void printStats();
+}
@@ -9,17 +9,54 @@ vec3 hsv2rgb(vec3 c)
     return c.z * mix(K.xxx, clamp(p - K.xxx, 0.0, 1.0), c.y);
 }
 
+in vec3 worldPosition;
 in vec3 normal;
 flat in uint material;
+in vec2 lightLevels; //sky and block light as brightness
+in float ambient;
+
+//indexed by BlockMaterial in chunk.h
+const vec3 materialColors[10] = vec3[](
+    vec3(1.0, 0.0, 1.0), //air, never drawn
+    vec3(0.5, 0.5, 0.52), //stone
+    vec3(0.45, 0.3, 0.18), //dirt
+    vec3(0.3, 0.75, 0.2), //grass
+    vec3(0.4, 0.26, 0.12), //log
+    vec3(0.15, 0.5, 0.12), //leaves
+    vec3(0.2, 0.2, 0.25), //ore
+    vec3(1.0, 0.85, 0.55), //lamp
+    vec3(0.86, 0.78, 0.52), //sand
+    vec3(0.2, 0.35, 0.75) //water
+);
 
 out vec4 fragColor;
 
-//layout(location = 4) uniform sampler2D shadowMap1;
-//layout(location = 5) uniform sampler2D shadowMap2;
-//layout(location = 6) uniform vec4 lightDir;
+//one layer per cascade, nearest first. see shadow:: in draw.cpp
+layout(binding = 0) uniform sampler2DArrayShadow shadowMaps;
+layout(location = 4) uniform vec4 sunDirection;
+layout(location = 5) uniform vec4 viewer;
+layout(location = 6) uniform vec4 cascadeRadii; //0 when the cascade isn't drawn
+layout(location = 7) uniform vec4 cascadeTexels; //in blocks
+layout(location = 8) uniform mat4 shadowMatrices[3];
+
+//how much of the sun reaches the point, from the nearest cascade that covers it
+float sunVisibility() {
+  float distanceToViewer = distance(worldPosition, viewer.xyz);
+  for (int cascade = 0; cascade < 3; cascade++) {
+    if (distanceToViewer < cascadeRadii[cascade]) {
+      //looked up a little off the surface, so it doesn't shadow itself between texel centers
+      vec3 position = worldPosition + normal * (1.5 * cascadeTexels[cascade]);
+      vec3 shadowCoord = (shadowMatrices[cascade] * vec4(position, 1.0)).xyz * 0.5 + 0.5;
+      return texture(shadowMaps, vec4(shadowCoord.xy, float(cascade), shadowCoord.z));
+    }
+  }
+  return 1.0;
+}
 
 void main() {
-  float brightness = max(dot(normal, normalize(vec3(1.0, 2.0, 3.0))), 0.15);
-  fragColor = vec4(brightness * hsv2rgb(vec3(float(1) * 0.3, 1.0, 1.0)) * (1.0 - gl_FragCoord.z / gl_FragCoord.w / 300.0), 1.0);
+  float facing = max(dot(normal, sunDirection.xyz), 0.0);
+  float sun = max(facing > 0.0 ? facing * sunVisibility() : 0.0, 0.15);
+  float brightness = max(max(sun * lightLevels.x, lightLevels.y), 0.03) * ambient;
+  fragColor = vec4(brightness * materialColors[min(material, 9u)] * (1.0 - gl_FragCoord.z / gl_FragCoord.w / 12000.0), 1.0);
   //fragColor = vec4(normal * 0.5 + 0.5, 1.0);
 }
\ No newline at end of file
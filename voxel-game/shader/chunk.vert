@@ -5,8 +5,11 @@ layout(location=1) in uint panelVertexPosition;
 layout(location=2) in uint panelMaterialAndOrientation;
 
 out vec3 vertexPositionOut;
+out vec3 worldPosition;
 out vec3 normal;
 flat out uint material;
+out vec2 lightLevels;
+out float ambient;
 
 layout(location = 0) uniform uint chunkModuloBitmask;
 layout(location = 1) uniform uint chunkModuloBitshiftY;
@@ -44,7 +47,10 @@ void main() {
     }
     vec3 pos = (panelBasePos + panelPos);
     vertexPositionOut = pos;
+    worldPosition = pos;
     gl_Position = modelViewProjection * vec4(pos, 1.0);
     normal = normalTable[panelOrientation];
     material = panelMaterialAndOrientation & 8191u; //first 13 bits.
+    lightLevels = vec2(1.0, 0.0); //no light or occlusion in this format
+    ambient = 1.0;
 }
\ No newline at end of file
@@ -2,14 +2,24 @@
 
 layout(location=0) in vec4 vertexPositionIn;
 layout(location=1) in vec4 normalIn;
+layout(location=2) in vec4 chunkOriginIn; //per draw, through the draw's base instance. w scales coarser levels of detail
+layout(location=3) in uint lightIn; //sky light level in the high nibble, block light in the low one
 
+out vec3 worldPosition;
 out vec3 normal;
 flat out uint material;
+out vec2 lightLevels; //sky and block light as brightness
+out float ambient; //darkened by the blocks around the corner
 
-layout(location = 3) uniform mat4 modelViewProjection;
+layout(location = 3) uniform mat4 viewProjection;
 
 void main() {
-    gl_Position = modelViewProjection * vec4(vertexPositionIn.xyz, 1.0);
+    worldPosition = vertexPositionIn.xyz * chunkOriginIn.w + chunkOriginIn.xyz;
+    gl_Position = viewProjection * vec4(worldPosition, 1.0);
     normal = normalIn.xyz;
-    material = int(normalIn.w);
+    uint materialAndOcclusion = uint(vertexPositionIn.w);
+    material = materialAndOcclusion & 255u;
+    ambient = 1.0 - 0.2 * float(materialAndOcclusion >> 8u);
+    //each level is 80% as bright as the one above it
+    lightLevels = pow(vec2(0.8), vec2(15u - (lightIn >> 4u), 15u - (lightIn & 15u)));
 }
\ No newline at end of file
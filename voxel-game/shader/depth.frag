@@ -0,0 +1,5 @@
+#version 430
+
+//shadow map passes only write depth
+void main() {
+}
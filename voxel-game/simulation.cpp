@@ -0,0 +1,420 @@
+#include "simulation.h"
+#include "edit.h"
+#include "jobs.h"
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace simulation {
+    namespace {
+        const ivec3 UP = { 0, 1, 0 };
+        const std::array<ivec3, 4> SIDEWAYS = { ivec3{ -1, 0, 0 }, { 1, 0, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+        //from a changed block to the blocks whose rules look at it. grass looks furthest, at the block above
+        //dirt one up and to the side of it
+        const ivec3 WAKE_MIN = { -1, -2, -1 };
+        const ivec3 WAKE_MAX = { 1, 1, 1 };
+
+        struct ActiveChunk {
+            std::vector<uint16_t> queued; //for the next tick, by getChunkIndex
+            std::bitset<VOLUME> isQueued;
+            std::vector<uint16_t> arrived; //moved here from a neighbor this tick, so not ticked again until the next
+        };
+
+        //a chunk and its 26 neighbors, null where they aren't resident, indexed like getChunkIndex on a 3x3x3 grid.
+        struct Neighborhood {
+            std::array<PerChunkState*, 27> chunks;
+
+            PerChunkState& center() const {
+                return *chunks[13];
+            }
+
+            //local is from the center chunk's origin and at most a chunk outside it.
+            Block get(ivec3 local) const {
+                ivec3 cell = (local + BLOCKS_PER_SIDE) / BLOCKS_PER_SIDE;
+                const PerChunkState* chunk = chunks[cell.x + 3 * (cell.y + 3 * cell.z)];
+                //blocks that aren't resident act as solid, so nothing moves into them
+                return chunk != nullptr ? chunk->blocks[getChunkIndex(local - (cell - 1) * BLOCKS_PER_SIDE)] : STONE;
+            }
+        };
+
+        //a change that reaches into a neighbor chunk, made after the pass if both blocks are still as the rule saw them.
+        struct Exchange {
+            ivec3 from;
+            Block fromWas;
+            Block fromBecomes;
+            ivec3 to;
+            Block toWas;
+            Block toBecomes;
+        };
+
+        struct ChunkTick {
+            ChunkKey key;
+            Neighborhood around;
+            std::vector<uint16_t> cells;
+            std::vector<uint16_t> arrived;
+            //filled in by the job
+            std::vector<ivec3> changed;
+            std::vector<Exchange> exchanges;
+            std::vector<uint16_t> requeued;
+        };
+
+        struct SimulationStats {
+            std::atomic<uint64_t> blocksTicked{ 0 };
+            uint64_t ticks = 0;
+            uint64_t droppedTicks = 0;
+            uint64_t blocksChanged = 0;
+            uint64_t chunkTicks = 0;
+            uint64_t exchanges = 0;
+            uint64_t staleExchanges = 0;
+            uint64_t sleeps = 0;
+            size_t peakActiveChunks = 0;
+            double tickMs = 0.0;
+        };
+
+        std::unordered_map<ChunkKey, ActiveChunk> active;
+        uint64_t tickNumber = 0;
+        float pendingSeconds = 0.f;
+        SimulationStats stats;
+
+        int floorDiv(int a, int b) {
+            return (a >= 0 ? a : a - b + 1) / b;
+        }
+
+        ChunkKey chunkOf(ivec3 position) {
+            return { floorDiv(position.x, BLOCKS_PER_SIDE), floorDiv(position.y, BLOCKS_PER_SIDE), floorDiv(position.z, BLOCKS_PER_SIDE) };
+        }
+
+        bool isInside(ivec3 local) {
+            return glm::all(glm::greaterThanEqual(local, ivec3(0))) && glm::all(glm::lessThan(local, ivec3(BLOCKS_PER_SIDE)));
+        }
+
+        bool hasRules(Block block) {
+            return block == SAND || block == WATER || block == GRASS;
+        }
+
+        //the same for a block on a tick wherever it's ticked, so results don't depend on how the work was split
+        uint32_t randomFor(ivec3 position, uint64_t tick) {
+            uint32_t hash = static_cast<uint32_t>(position.x) * 73856093u ^ static_cast<uint32_t>(position.y) * 19349663u
+                ^ static_cast<uint32_t>(position.z) * 83492791u ^ static_cast<uint32_t>(tick) * 2654435761u;
+            hash ^= hash >> 15;
+            hash *= 0x2c1b3c6du;
+            hash ^= hash >> 12;
+            return hash;
+        }
+
+        void queue(ActiveChunk& chunk, int index) {
+            if (!chunk.isQueued.test(index)) {
+                chunk.isQueued.set(index);
+                chunk.queued.push_back(static_cast<uint16_t>(index));
+            }
+        }
+
+        //writes the change if it stays in the chunk, and otherwise leaves it for the exchange after the pass.
+        void change(ChunkTick& work, std::bitset<VOLUME>& settled, ivec3 from, Block fromBecomes, ivec3 to, Block toBecomes) {
+            PerChunkState& chunk = work.around.center();
+            ivec3 origin = work.key * BLOCKS_PER_SIDE;
+            if (!isInside(to)) {
+                work.exchanges.push_back({ origin + from, chunk.blocks[getChunkIndex(from)], fromBecomes, origin + to, work.around.get(to), toBecomes });
+                return;
+            }
+            for (auto& block : { std::make_pair(from, fromBecomes), std::make_pair(to, toBecomes) }) {
+                Block& stored = chunk.blocks[getChunkIndex(block.first)];
+                if (stored != block.second) {
+                    stored = block.second;
+                    work.changed.push_back(origin + block.first);
+                }
+            }
+            settled.set(getChunkIndex(to));
+        }
+
+        void tickChunk(ChunkTick& work) {
+            const Neighborhood& around = work.around;
+            PerChunkState& chunk = around.center();
+            ivec3 origin = work.key * BLOCKS_PER_SIDE;
+            std::bitset<VOLUME> settled;
+            for (uint16_t index : work.arrived) {
+                settled.set(index);
+            }
+            uint64_t ticked = 0;
+            for (uint16_t index : work.cells) {
+                if (settled.test(index)) {
+                    continue;
+                }
+                ticked++;
+                ivec3 local = { index % BLOCKS_PER_SIDE, index / BLOCKS_PER_SIDE % BLOCKS_PER_SIDE, index / (BLOCKS_PER_SIDE * BLOCKS_PER_SIDE) };
+                Block block = chunk.blocks[index];
+                ivec3 below = local - UP;
+                if (block == SAND) {
+                    Block under = around.get(below);
+                    if (under == AIR || under == WATER) {
+                        change(work, settled, local, under, below, SAND);
+                    }
+                }
+                else if (block == WATER) {
+                    if (around.get(below) == AIR) {
+                        change(work, settled, local, AIR, below, WATER);
+                        continue;
+                    }
+                    //runs off ledges, trying the sides from a different one each tick so it doesn't drift one way
+                    uint32_t firstSide = randomFor(origin + local, tickNumber);
+                    for (int i = 0; i < 4; i++) {
+                        ivec3 side = local + SIDEWAYS[(firstSide + i) % 4];
+                        if (around.get(side) == AIR && around.get(side - UP) == AIR) {
+                            change(work, settled, local, AIR, side, WATER);
+                            break;
+                        }
+                    }
+                }
+                else if (block == GRASS) {
+                    if (around.get(local + UP) != AIR) {
+                        change(work, settled, local, DIRT, local, DIRT);
+                        continue;
+                    }
+                    bool waiting = false;
+                    for (ivec3 side : SIDEWAYS) {
+                        for (int height = -1; height <= 1; height++) {
+                            ivec3 target = local + side + UP * height;
+                            if (around.get(target) != DIRT || around.get(target + UP) != AIR) {
+                                continue;
+                            }
+                            if (randomFor(origin + target, tickNumber) % GRASS_SPREAD_ODDS != 0) {
+                                waiting = true;
+                                continue;
+                            }
+                            change(work, settled, local, GRASS, target, GRASS);
+                        }
+                    }
+                    //stays awake while there's dirt it hasn't spread to yet
+                    if (waiting) {
+                        work.requeued.push_back(index);
+                    }
+                }
+            }
+            stats.blocksTicked += ticked;
+        }
+
+        void tickRange(std::vector<ChunkTick>& pass, size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                tickChunk(pass[i]);
+            }
+        }
+
+        void applyExchange(const Exchange& exchange, std::vector<ivec3>& changed) {
+            stats.exchanges++;
+            auto fromChunk = perChunkState.find(chunkOf(exchange.from));
+            auto toChunk = perChunkState.find(chunkOf(exchange.to));
+            if (fromChunk == perChunkState.end() || toChunk == perChunkState.end()) {
+                stats.staleExchanges++;
+                return;
+            }
+            Block& from = fromChunk->second.blocks[getChunkIndex(exchange.from - fromChunk->first * BLOCKS_PER_SIDE)];
+            int toIndex = getChunkIndex(exchange.to - toChunk->first * BLOCKS_PER_SIDE);
+            Block& to = toChunk->second.blocks[toIndex];
+            //an earlier exchange in the pass got there first
+            if (from != exchange.fromWas || to != exchange.toWas) {
+                stats.staleExchanges++;
+                return;
+            }
+            if (from != exchange.fromBecomes) {
+                from = exchange.fromBecomes;
+                changed.push_back(exchange.from);
+            }
+            to = exchange.toBecomes;
+            changed.push_back(exchange.to);
+            auto toActive = active.find(toChunk->first);
+            if (toActive != active.end()) {
+                toActive->second.arrived.push_back(static_cast<uint16_t>(toIndex));
+            }
+        }
+
+        void tick() {
+            auto start = std::chrono::steady_clock::now();
+            tickNumber++;
+            std::array<std::vector<ChunkTick>, 8> passes;
+            for (auto iter = active.begin(); iter != active.end();) {
+                ChunkKey key = iter->first;
+                if (perChunkState.find(key) == perChunkState.end()) {
+                    iter = active.erase(iter);
+                    continue;
+                }
+                ChunkTick work;
+                work.key = key;
+                work.cells.swap(iter->second.queued);
+                iter->second.isQueued.reset();
+                ivec3 offset;
+                for (offset.z = -1; offset.z <= 1; offset.z++) {
+                    for (offset.y = -1; offset.y <= 1; offset.y++) {
+                        for (offset.x = -1; offset.x <= 1; offset.x++) {
+                            auto neighbor = perChunkState.find(key + offset);
+                            work.around.chunks[(offset.x + 1) + 3 * ((offset.y + 1) + 3 * (offset.z + 1))] = neighbor != perChunkState.end() ? &neighbor->second : nullptr;
+                        }
+                    }
+                }
+                passes[(key.x & 1) | (key.y & 1) << 1 | (key.z & 1) << 2].push_back(std::move(work));
+                ++iter;
+            }
+            stats.peakActiveChunks = glm::max(stats.peakActiveChunks, active.size());
+
+            std::vector<ivec3> changed;
+            for (auto& pass : passes) {
+                if (pass.empty()) {
+                    continue;
+                }
+                for (ChunkTick& work : pass) {
+                    work.arrived.swap(active[work.key].arrived);
+                }
+                //blocks only change on the main thread, which waits here, and in each job's own chunk, which no
+                //other job in the pass reads
+                parallelRanges(pass.size(), MIN_CHUNKS_PER_JOB, [&pass](size_t first, size_t last) { tickRange(pass, first, last); });
+
+                //the border exchange
+                for (ChunkTick& work : pass) {
+                    changed.insert(changed.end(), work.changed.begin(), work.changed.end());
+                    for (const Exchange& exchange : work.exchanges) {
+                        applyExchange(exchange, changed);
+                    }
+                    ActiveChunk& chunk = active[work.key];
+                    for (uint16_t index : work.requeued) {
+                        queue(chunk, index);
+                    }
+                }
+                stats.chunkTicks += pass.size();
+            }
+
+            //relit, remeshed and saved once, which also queues the blocks around the changes for the next tick
+            edit::commit(changed);
+            for (auto iter = active.begin(); iter != active.end();) {
+                iter->second.arrived.clear();
+                if (iter->second.queued.empty()) {
+                    stats.sleeps++;
+                    iter = active.erase(iter);
+                }
+                else {
+                    ++iter;
+                }
+            }
+            stats.ticks++;
+            stats.blocksChanged += changed.size();
+            stats.tickMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    void blocksChanged(const std::vector<ivec3>& positions) {
+        ChunkKey cachedKey;
+        PerChunkState* chunk = nullptr;
+        ActiveChunk* activeChunk = nullptr;
+        bool cached = false;
+        for (ivec3 position : positions) {
+            ivec3 offset;
+            for (offset.z = WAKE_MIN.z; offset.z <= WAKE_MAX.z; offset.z++) {
+                for (offset.y = WAKE_MIN.y; offset.y <= WAKE_MAX.y; offset.y++) {
+                    for (offset.x = WAKE_MIN.x; offset.x <= WAKE_MAX.x; offset.x++) {
+                        ivec3 at = position + offset;
+                        ChunkKey key = chunkOf(at);
+                        if (!cached || key != cachedKey) {
+                            auto iter = perChunkState.find(key);
+                            chunk = iter != perChunkState.end() ? &iter->second : nullptr;
+                            activeChunk = nullptr;
+                            cachedKey = key;
+                            cached = true;
+                        }
+                        if (chunk == nullptr) {
+                            continue;
+                        }
+                        int index = getChunkIndex(at - key * BLOCKS_PER_SIDE);
+                        if (!hasRules(chunk->blocks[index])) {
+                            continue;
+                        }
+                        if (activeChunk == nullptr) {
+                            activeChunk = &active[key];
+                        }
+                        queue(*activeChunk, index);
+                    }
+                }
+            }
+        }
+    }
+
+    void blockChanged(ivec3 position) {
+        blocksChanged({ position });
+    }
+
+    void update(float seconds) {
+        pendingSeconds += seconds;
+        int ticks = static_cast<int>(pendingSeconds / TICK_SECONDS);
+        pendingSeconds -= ticks * TICK_SECONDS;
+        if (ticks > MAX_TICKS_PER_UPDATE) {
+            stats.droppedTicks += ticks - MAX_TICKS_PER_UPDATE;
+            ticks = MAX_TICKS_PER_UPDATE;
+        }
+        for (int i = 0; i < ticks; i++) {
+            tick();
+        }
+    }
+
+    size_t activeChunks() {
+        return active.size();
+    }
+
+    void benchmark(int areaCount) {
+        //32x16x32 chunks, the lower half solid stone
+        const ivec3 CHUNKS = { 32, 16, 32 };
+        const int GROUND = CHUNKS.y / 2 * BLOCKS_PER_SIDE; //the lowest air block
+        PerChunkState stone = {};
+        stone.blocks.fill(STONE);
+        stone.solidBricks = findSolidBricks(stone.blocks);
+        PerChunkState air = {};
+        ChunkKey key;
+        for (key.z = 0; key.z < CHUNKS.z; key.z++) {
+            for (key.y = 0; key.y < CHUNKS.y; key.y++) {
+                for (key.x = 0; key.x < CHUNKS.x; key.x++) {
+                    perChunkState[key] = key.y * BLOCKS_PER_SIDE < GROUND ? stone : air;
+                }
+            }
+        }
+
+        //each area is a lawn of dirt for grass to spread over from one corner, with sand dropped on it and water
+        //poured onto a pillar to run off
+        std::mt19937 random(1);
+        std::uniform_int_distribution<int> across(32, CHUNKS.x * BLOCKS_PER_SIDE - 32);
+        for (int i = 0; i < areaCount; i++) {
+            ivec3 center = { across(random), GROUND, across(random) };
+            edit::fillBox(center + ivec3{ -12, -1, -12 }, center + ivec3{ 12, -1, 12 }, DIRT);
+            edit::fillBox(center + ivec3{ -12, -1, -12 }, center + ivec3{ -12, -1, -12 }, GRASS);
+            edit::fillBox(center + ivec3{ -8, 20, -8 }, center + ivec3{ -3, 30, -3 }, SAND);
+            edit::fillBox(center + ivec3{ 4, 0, 4 }, center + ivec3{ 5, 4, 5 }, STONE);
+            edit::fillBox(center + ivec3{ 3, 12, 3 }, center + ivec3{ 6, 15, 6 }, WATER);
+        }
+
+        const int TICKS = 400;
+        uint64_t blocksTickedBefore = stats.blocksTicked;
+        uint64_t chunkTicksBefore = stats.chunkTicks;
+        double busiest = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < TICKS; i++) {
+            auto tickStart = std::chrono::steady_clock::now();
+            tick();
+            busiest = glm::max(busiest, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tickStart).count());
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("simulation: %d areas among %zu loaded chunks, %.3fms per tick (%.3fms at most) over %d ticks, %.1f active chunks and %.0f blocks ticked per tick, %zu chunks still active\n",
+            areaCount, perChunkState.size(), milliseconds / TICKS, busiest, TICKS,
+            static_cast<double>(stats.chunkTicks - chunkTicksBefore) / TICKS,
+            static_cast<double>(stats.blocksTicked - blocksTickedBefore) / TICKS, active.size());
+        active.clear();
+        perChunkState.clear();
+    }
+
+    void printStats() {
+        printf("simulation: %zu active chunks (%zu at most), %llu ticks (%llu dropped) at %.3fms, %.1f blocks ticked and %.1f changed per tick, %llu border exchanges (%llu stale), %llu chunks slept\n",
+            active.size(), stats.peakActiveChunks, static_cast<unsigned long long>(stats.ticks), static_cast<unsigned long long>(stats.droppedTicks),
+            stats.ticks > 0 ? stats.tickMs / stats.ticks : 0.0,
+            stats.ticks > 0 ? static_cast<double>(stats.blocksTicked) / stats.ticks : 0.0,
+            stats.ticks > 0 ? static_cast<double>(stats.blocksChanged) / stats.ticks : 0.0,
+            static_cast<unsigned long long>(stats.exchanges), static_cast<unsigned long long>(stats.staleExchanges),
+            static_cast<unsigned long long>(stats.sleeps));
+    }
+}
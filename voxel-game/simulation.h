@@ -0,0 +1,31 @@
+#pragma once
+#include "chunk.h"
+
+//block rules run at a fixed tick: sand falls, water falls and runs off ledges, and grass spreads onto dirt
+//that has air above it and dies back to dirt when covered. only blocks that might do something are queued, by
+//blocksChanged around every changed block, and each chunk with queued blocks is in the active set until a
+//tick leaves nothing queued in it, when it sleeps. a tick costs what its queued blocks do, however many
+//chunks are loaded. loaded and generated chunks start asleep, so e.g. water saved mid-fall waits for a change
+//next to it.
+//active chunks are ticked in 8 passes by the parity of their coordinates, so no two chunks in a pass are
+//neighbors. each chunk's blocks are then written by only its own job, which reads the neighbors freely as
+//none of them change during the pass. moves across a chunk border are exchanged after the pass, on the main
+//thread, and everything that changed is committed once per tick like an edit. see edit.h
+namespace simulation {
+    const float TICK_SECONDS = 1.f / 20.f;
+    const int MAX_TICKS_PER_UPDATE = 4; //further behind than this the simulation slows down instead of catching up
+    const size_t MIN_CHUNKS_PER_JOB = 4; //chunks claimed at a time by each thread in a pass, see parallelRanges
+    const uint32_t GRASS_SPREAD_ODDS = 16; //one in this many ticks grass spreads to a given dirt block
+
+    //queues the blocks near changed ones whose rules might now do something.
+    void blocksChanged(const std::vector<ivec3>& positions);
+    void blockChanged(ivec3 position);
+
+    //runs the fixed ticks that fit into the time since the last update.
+    void update(float seconds);
+    size_t activeChunks();
+
+    //ticks a few busy areas among 16k loaded chunks and prints the time per tick.
+    void benchmark(int areaCount);
+    void printStats();
+}
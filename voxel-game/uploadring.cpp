@@ -0,0 +1,174 @@
+#include "uploadring.h"
+#include "jobs.h"
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <mutex>
+
+namespace uploadring {
+    namespace {
+        struct Region {
+            uint64_t id;
+            size_t offset;
+            size_t bytes;
+            bool consumed = false;
+            uint64_t fenceSerial = 0; //0 until the fence after its copy has been inserted
+        };
+
+        struct Fence {
+            render::FenceId sync;
+            uint64_t serial;
+        };
+
+        struct RingStats {
+            uint64_t reservations = 0;
+            uint64_t bytesStaged = 0;
+            uint64_t ringFull = 0;
+            size_t peakBytesInUse = 0;
+        };
+
+        render::BufferId ringBuffer = render::NO_BUFFER;
+        uint8_t* mapping = nullptr;
+
+        std::mutex regionsMutex;
+        std::deque<Region> regions; //in reservation order; the front is the oldest space in use
+        uint64_t nextId = 1;
+        size_t bytesInUse = 0;
+        RingStats stats;
+
+        //render thread
+        std::deque<Fence> fences;
+        uint64_t nextFenceSerial = 1;
+        uint64_t completedFenceSerial = 0;
+        bool copiesSinceFence = false;
+
+        //where a reservation of this size would start, or RING_BYTES if it doesn't fit. needs regionsMutex.
+        size_t findSpace(size_t bytes) {
+            if (regions.empty()) {
+                return bytes <= RING_BYTES ? 0 : RING_BYTES;
+            }
+            size_t tail = regions.front().offset;
+            size_t head = regions.back().offset + regions.back().bytes;
+            if (regions.back().offset >= tail) {
+                //in use is [tail, head); free is [head, end) and [0, tail)
+                if (head + bytes <= RING_BYTES) {
+                    return head;
+                }
+                return bytes <= tail ? 0 : RING_BYTES;
+            }
+            //wrapped: in use is [tail, end) and [0, head); free is [head, tail)
+            return head + bytes <= tail ? head : RING_BYTES;
+        }
+    }
+
+    bool init() {
+        mapping = static_cast<uint8_t*>(render::device().createMappedBuffer(RING_BYTES, ringBuffer));
+        if (mapping == nullptr) {
+            std::cout << "no upload ring, uploading meshes from their own memory" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void shutdown() {
+        if (mapping == nullptr) {
+            return;
+        }
+        workerPool().waitIdle();
+        for (auto& fence : fences) {
+            render::device().deleteFence(fence.sync);
+        }
+        fences.clear();
+        render::device().deleteMappedBuffer(ringBuffer);
+        ringBuffer = render::NO_BUFFER;
+        std::lock_guard<std::mutex> lock(regionsMutex);
+        mapping = nullptr;
+        regions.clear();
+        bytesInUse = 0;
+    }
+
+    bool reserve(size_t bytes, Reservation& reservation) {
+        std::lock_guard<std::mutex> lock(regionsMutex);
+        if (mapping == nullptr || bytes == 0) {
+            return false;
+        }
+        size_t offset = findSpace(bytes);
+        if (offset == RING_BYTES) {
+            stats.ringFull++;
+            return false;
+        }
+        Region region;
+        region.id = nextId++;
+        region.offset = offset;
+        region.bytes = bytes;
+        regions.push_back(region);
+        bytesInUse += bytes;
+        stats.reservations++;
+        stats.bytesStaged += bytes;
+        stats.peakBytesInUse = std::max(stats.peakBytesInUse, bytesInUse);
+
+        reservation.id = region.id;
+        reservation.offset = offset;
+        reservation.bytes = bytes;
+        reservation.data = mapping + offset;
+        return true;
+    }
+
+    render::BufferId buffer() {
+        return ringBuffer;
+    }
+
+    void consumed(const Reservation& reservation) {
+        std::lock_guard<std::mutex> lock(regionsMutex);
+        for (auto& region : regions) {
+            if (region.id == reservation.id) {
+                region.consumed = true;
+                copiesSinceFence = true;
+                return;
+            }
+        }
+    }
+
+    void endFrame() {
+        if (mapping == nullptr) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(regionsMutex);
+        if (copiesSinceFence) {
+            uint64_t serial = nextFenceSerial++;
+            fences.push_back({ render::device().insertFence(), serial });
+            for (auto& region : regions) {
+                if (region.consumed && region.fenceSerial == 0) {
+                    region.fenceSerial = serial;
+                }
+            }
+            copiesSinceFence = false;
+        }
+        while (!fences.empty()) {
+            if (!render::device().isFenceSignaled(fences.front().sync)) {
+                break;
+            }
+            completedFenceSerial = fences.front().serial;
+            render::device().deleteFence(fences.front().sync);
+            fences.pop_front();
+        }
+        //a region still being written or waiting to be uploaded holds back everything reserved after it
+        while (!regions.empty() && regions.front().fenceSerial != 0 && regions.front().fenceSerial <= completedFenceSerial) {
+            bytesInUse -= regions.front().bytes;
+            regions.pop_front();
+        }
+    }
+
+    void printStats() {
+        std::lock_guard<std::mutex> lock(regionsMutex);
+        printf("upload ring: %s, %llu meshes (%.1fMB) staged, %llu times full, peak %.1fMB of %.1fMB in use, %zu fences pending\n",
+            mapping != nullptr ? "persistent" : "unavailable",
+            static_cast<unsigned long long>(stats.reservations),
+            stats.bytesStaged / (1024.0 * 1024.0),
+            static_cast<unsigned long long>(stats.ringFull),
+            stats.peakBytesInUse / (1024.0 * 1024.0),
+            RING_BYTES / (1024.0 * 1024.0),
+            fences.size());
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "renderdevice.h"
+#include <cstddef>
+#include <cstdint>
+
+//staging ring for mesh uploads: one persistently mapped, coherent buffer that meshing workers write
+//finished vertices into directly. the render thread only issues buffer copies from the ring into the
+//mesh arenas, then fences those copies once per frame; ring space is reused once its fence has
+//signaled. space is handed out and given back in FIFO order. when the render device can't map buffers
+//(or the ring is full) reserve() fails and callers upload from their own memory instead.
+namespace uploadring {
+    const size_t RING_BYTES = 32 << 20;
+
+    struct Reservation {
+        uint64_t id = 0;
+        size_t offset = 0;
+        size_t bytes = 0; //0 if nothing was reserved
+        void* data = nullptr;
+    };
+
+    //needs the render device. returns false if persistent mapping isn't available.
+    bool init();
+    //waits for the worker pool so nothing is writing into the mapping, then releases the ring.
+    void shutdown();
+
+    //any thread.
+    bool reserve(size_t bytes, Reservation& reservation);
+
+    //render thread only.
+    render::BufferId buffer();
+    //the copy out of the reservation has been issued.
+    void consumed(const Reservation& reservation);
+    //fences the copies issued since the last call and reclaims space the GPU has finished reading.
+    void endFrame();
+
+    void printStats();
+}
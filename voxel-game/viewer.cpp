@@ -0,0 +1,93 @@
+#include "viewer.h"
+#include "chunkio.h"
+#include "frustum.h"
+
+namespace viewer {
+    namespace {
+        vec3 lastPosition;
+        bool hasLastPosition = false;
+        vec3 smoothedVelocity = { 0.f, 0.f, 0.f };
+        vec3 look = { 0.f, 0.f, -1.f };
+
+        struct PopInStats {
+            uint64_t frames = 0;
+            uint64_t framesWithPopIn = 0;
+            uint64_t missingChunks = 0;
+        } stats;
+    }
+
+    void update(vec3 position, vec2 rotation, float deltaSeconds) {
+        if (hasLastPosition && deltaSeconds > 0.f) {
+            vec3 frameVelocity = (position - lastPosition) / deltaSeconds;
+            smoothedVelocity = glm::mix(smoothedVelocity, frameVelocity, VELOCITY_SMOOTHING);
+        }
+        lastPosition = position;
+        hasLastPosition = true;
+        //inverse of the yaw/pitch rotation in drawFrame applied to -z
+        look = {
+            cosf(rotation.y) * sinf(rotation.x),
+            -sinf(rotation.y),
+            -cosf(rotation.y) * cosf(rotation.x)
+        };
+    }
+
+    vec3 velocity() {
+        return smoothedVelocity;
+    }
+
+    vec3 lookDirection() {
+        return look;
+    }
+
+    vec3 heading() {
+        float speed = glm::length(smoothedVelocity);
+        return speed > 0.5f ? smoothedVelocity / speed : look;
+    }
+
+    vec3 predictedPosition(float secondsAhead) {
+        return lastPosition + smoothedVelocity * secondsAhead;
+    }
+
+    float chunkPriority(ChunkKey key) {
+        vec3 chunkCenter = (vec3{ key.x, key.y, key.z } + 0.5f) * static_cast<float>(BLOCKS_PER_SIDE);
+        vec3 toChunk = chunkCenter - lastPosition;
+        float distance = glm::length(toChunk);
+        if (distance < 0.001f) {
+            return 0.f;
+        }
+        return distance * (1.f - HEADING_BIAS * glm::dot(toChunk / distance, heading()));
+    }
+
+    void recordFrame(const mat4& viewProjection) {
+        Frustum frustum(viewProjection);
+        uint64_t missing = 0;
+        for (auto& key : chunksThatShouldBeDrawn) {
+            if (chunkGLBuffers.find(key) != chunkGLBuffers.end()) {
+                continue;
+            }
+            if (perChunkState.find(key) == perChunkState.end() && !chunkio::isLoading(key)) {
+                continue; //nothing exists there to pop in
+            }
+            vec3 chunkMin = vec3{ key.x, key.y, key.z } * static_cast<float>(BLOCKS_PER_SIDE);
+            if (frustum.intersectsBox(chunkMin, chunkMin + static_cast<float>(BLOCKS_PER_SIDE))) {
+                missing++;
+            }
+        }
+        stats.frames++;
+        stats.missingChunks += missing;
+        if (missing > 0) {
+            stats.framesWithPopIn++;
+        }
+    }
+
+    void printStats() {
+        float popInFraction = stats.frames == 0 ? 0.f : static_cast<float>(stats.framesWithPopIn) / static_cast<float>(stats.frames);
+        float missingPerFrame = stats.frames == 0 ? 0.f : static_cast<float>(stats.missingChunks) / static_cast<float>(stats.frames);
+        printf("pop-in: %.1f%% of frames had missing in-frustum chunks (%llu/%llu, %.2f missing per frame), speed %.1f blocks/s\n",
+            100.f * popInFraction,
+            static_cast<unsigned long long>(stats.framesWithPopIn),
+            static_cast<unsigned long long>(stats.frames),
+            missingPerFrame,
+            glm::length(smoothedVelocity));
+    }
+}
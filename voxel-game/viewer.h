@@ -0,0 +1,25 @@
+#pragma once
+#include "chunk.h"
+
+//tracks how the viewer moves so streaming work can be ordered towards where the camera is heading,
+//and measures how often that work falls behind (pop-in).
+namespace viewer {
+    const float PREWARM_SECONDS = 2.f;       //how far along the predicted path chunks are loaded and meshed early
+    const float VELOCITY_SMOOTHING = 0.2f;   //weight of the newest frame in the velocity average
+    const float HEADING_BIAS = 0.5f;         //chunks straight ahead count as this much closer, straight behind this much further
+
+    void update(vec3 position, vec2 rotation, float deltaSeconds);
+
+    vec3 velocity();
+    vec3 lookDirection();
+    //velocity direction while moving, look direction while standing still.
+    vec3 heading();
+    vec3 predictedPosition(float secondsAhead);
+
+    //lower is more urgent. distance to the chunk, shrunk for chunks in the heading direction.
+    float chunkPriority(ChunkKey key);
+
+    //counts chunks that should be drawn, are in the frustum and have data, but have no mesh on the GPU yet.
+    void recordFrame(const mat4& viewProjection);
+    void printStats();
+}
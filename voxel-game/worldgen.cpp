@@ -0,0 +1,455 @@
+#include "worldgen.h"
+#include "chunkio.h"
+#include "connectivity.h"
+#include "density.h"
+#include "heightmap.h"
+#include "jobs.h"
+#include "lod.h"
+#include "viewer.h"
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <mutex>
+
+namespace worldgen {
+    namespace {
+        const uint32_t ORE_SALT = 1;
+        const uint32_t TREE_SALT = 2;
+
+        struct Spill {
+            uint16_t index; //in the receiving chunk
+            Block block;
+        };
+        typedef std::array<std::vector<Spill>, 27> Spills; //by offset of the receiving chunk, see neighborSlot
+
+        struct StageDefinition {
+            const char* name;
+            ivec3 neighborRadius; //neighbors that must have finished the previous stage before this one runs
+        };
+
+        const std::array<StageDefinition, STAGE_COUNT> STAGES = { {
+            { "not started", { 0, 0, 0 } },
+            { "terrain", { 0, 0, 0 } },
+            { "surface", { 0, 1, 0 } },    //grass needs to know if the block above, maybe in the chunk above, is air
+            { "decoration", { 0, 0, 0 } }, //only reads its own chunk; writes outside it are queued
+            { "finalized", { 1, 1, 1 } },  //every neighbor a tree could spill from has to be decorated
+        } };
+
+        struct GenerationState {
+            Stage stage = NOT_STARTED;
+            bool running = false;
+            uint64_t lastNeeded = 0; //update that last required this chunk
+            uint64_t lastQueued = 0;
+            std::shared_ptr<const PerChunkState> terrain; //kept for the surface stage of the chunk below
+            std::shared_ptr<const PerChunkState> blocks;  //output of the latest finished stage
+            std::shared_ptr<const Spills> spills;         //set once decorated
+        };
+
+        struct StageResult {
+            ChunkKey key;
+            Stage stage;
+            std::shared_ptr<const PerChunkState> blocks;
+            std::shared_ptr<const Spills> spills;
+        };
+
+        struct ReadyStage {
+            ChunkKey key;
+            Stage stage;
+            float priority;
+        };
+
+        struct GenerationStats {
+            std::array<uint64_t, STAGE_COUNT> stagesRun = {};
+            uint64_t chunksFinalized = 0;
+            uint64_t spilledBlocks = 0;
+            uint64_t requestsDropped = 0;
+        };
+
+        std::mutex finishedMutex;
+        std::vector<StageResult> finished;
+
+        //main-thread bookkeeping
+        std::unordered_map<ChunkKey, GenerationState> states;
+        std::unordered_set<ChunkKey> wantedChunks;
+        //the sky predicate is also asked from physics jobs
+        std::mutex skyMutex;
+        std::unordered_map<ivec2, int> skyLevels; //per column, lowest y no terrain or decoration reaches
+        std::unordered_set<ChunkKey> claimedSky;
+        std::vector<ReadyStage> readyStages;
+        size_t jobsInFlight = 0;
+        uint64_t updateCount = 0;
+        GenerationStats stats;
+
+        int neighborSlot(ivec3 offset) {
+            return (offset.x + 1) + 3 * ((offset.y + 1) + 3 * (offset.z + 1));
+        }
+
+        uint32_t hashPosition(ivec3 position, uint32_t salt) {
+            uint32_t hash = static_cast<uint32_t>(position.x) * 0x8da6b343u
+                ^ static_cast<uint32_t>(position.y) * 0xd8163841u
+                ^ static_cast<uint32_t>(position.z) * 0xcb1ab31fu
+                ^ salt * 0x165667b1u;
+            hash ^= hash >> 15;
+            hash *= 0x2c1b3c6du;
+            hash ^= hash >> 12;
+            hash *= 0x297a2d39u;
+            hash ^= hash >> 15;
+            return hash;
+        }
+
+        bool canReplace(Block existing, Block placed) {
+            return existing == AIR || (existing == LEAVES && placed == LOG);
+        }
+
+        std::shared_ptr<const PerChunkState> runTerrain(ChunkKey key) {
+            auto chunk = std::make_shared<PerChunkState>();
+            density::generateChunk(key, *chunk); //solid blocks come out as STONE
+            return chunk;
+        }
+
+        //above is null for an empty sky chunk.
+        std::shared_ptr<const PerChunkState> runSurface(ChunkKey key, const PerChunkState& terrain, const PerChunkState* above) {
+            auto chunk = std::make_shared<PerChunkState>(terrain);
+            const ColumnHeights& heights = heightmap::column({ key.x, key.z });
+            int baseY = key.y * BLOCKS_PER_SIDE;
+            //cave floors deep below the surface stay stone
+            int surfaceBand = static_cast<int>(ceilf(density::OVERHANG_AMPLITUDE)) + DIRT_DEPTH;
+            for (int z = 0; z < BLOCKS_PER_SIDE; z++) {
+                for (int x = 0; x < BLOCKS_PER_SIDE; x++) {
+                    int surface = heights.surface[x + BLOCKS_PER_SIDE * z];
+                    if (baseY + BLOCKS_PER_SIDE <= surface - surfaceBand) {
+                        continue;
+                    }
+                    //solid blocks since the last air block going down, starting in the chunk above
+                    int depth = 0;
+                    if (above != nullptr) {
+                        depth = DIRT_DEPTH + 1;
+                        for (int y = DIRT_DEPTH - 1; y >= 0; y--) {
+                            depth = above->blocks[getChunkIndex({ x, y, z })] == AIR ? 0 : std::min(depth + 1, DIRT_DEPTH + 1);
+                        }
+                    }
+                    for (int y = BLOCKS_PER_SIDE - 1; y >= 0; y--) {
+                        Block& block = chunk->blocks[getChunkIndex({ x, y, z })];
+                        if (block == AIR) {
+                            depth = 0;
+                            continue;
+                        }
+                        depth = std::min(depth + 1, DIRT_DEPTH + 1);
+                        if (baseY + y < surface - surfaceBand) {
+                            continue;
+                        }
+                        if (depth == 1) {
+                            block = GRASS;
+                        }
+                        else if (depth <= DIRT_DEPTH) {
+                            block = DIRT;
+                        }
+                    }
+                }
+            }
+            return chunk;
+        }
+
+        std::shared_ptr<const PerChunkState> runDecoration(ChunkKey key, const PerChunkState& surfaced, Spills& spills) {
+            auto chunk = std::make_shared<PerChunkState>(surfaced);
+            ivec3 origin = key * BLOCKS_PER_SIDE;
+
+            auto place = [&](ivec3 local, Block block) {
+                ivec3 offset = {
+                    local.x < 0 ? -1 : (local.x >= BLOCKS_PER_SIDE ? 1 : 0),
+                    local.y < 0 ? -1 : (local.y >= BLOCKS_PER_SIDE ? 1 : 0),
+                    local.z < 0 ? -1 : (local.z >= BLOCKS_PER_SIDE ? 1 : 0)
+                };
+                int index = getChunkIndex(local - offset * BLOCKS_PER_SIDE);
+                if (offset == ivec3{ 0, 0, 0 }) {
+                    if (canReplace(chunk->blocks[index], block)) {
+                        chunk->blocks[index] = block;
+                    }
+                }
+                else {
+                    spills[neighborSlot(offset)].push_back({ static_cast<uint16_t>(index), block });
+                }
+            };
+
+            //ore blobs only replace stone inside this chunk, so they never spill
+            for (int vein = 0; vein < ORE_VEINS_PER_CHUNK; vein++) {
+                uint32_t hash = hashPosition(key, ORE_SALT + vein * 16);
+                ivec3 center = { static_cast<int>(hash & 15), static_cast<int>((hash >> 4) & 15), static_cast<int>((hash >> 8) & 15) };
+                static3DLoop<-1, -1, -1, 2, 2, 2>([&](ivec3 offset) {
+                    ivec3 local = center + offset;
+                    if (glm::any(glm::lessThan(local, ivec3{ 0 })) || glm::any(glm::greaterThanEqual(local, ivec3{ BLOCKS_PER_SIDE }))) {
+                        return;
+                    }
+                    Block& block = chunk->blocks[getChunkIndex(local)];
+                    if (block == STONE && (hashPosition(origin + local, ORE_SALT) & 1)) {
+                        block = ORE;
+                    }
+                });
+            }
+
+            //trees grow from grass with air above it, which is always inside the chunk for roots below the top row
+            for (int z = 0; z < BLOCKS_PER_SIDE; z++) {
+                for (int x = 0; x < BLOCKS_PER_SIDE; x++) {
+                    for (int y = 0; y < BLOCKS_PER_SIDE - 1; y++) {
+                        if (surfaced.blocks[getChunkIndex({ x, y, z })] != GRASS || surfaced.blocks[getChunkIndex({ x, y + 1, z })] != AIR) {
+                            continue;
+                        }
+                        ivec3 root = { x, y, z };
+                        uint32_t hash = hashPosition(origin + root, TREE_SALT);
+                        if (hash % 1000 >= TREE_CHANCE_PER_MILLE) {
+                            continue;
+                        }
+                        int trunkHeight = 4 + (hash >> 16) % 3;
+                        for (int dy = trunkHeight - 2; dy <= trunkHeight + 1; dy++) {
+                            int radius = dy < trunkHeight ? 2 : 1;
+                            for (int dz = -radius; dz <= radius; dz++) {
+                                for (int dx = -radius; dx <= radius; dx++) {
+                                    if (abs(dx) == radius && abs(dz) == radius) {
+                                        continue; //round off the corners
+                                    }
+                                    place(root + ivec3{ dx, dy, dz }, LEAVES);
+                                }
+                            }
+                        }
+                        for (int dy = 1; dy <= trunkHeight; dy++) {
+                            place(root + ivec3{ 0, dy, 0 }, LOG);
+                        }
+                    }
+                }
+            }
+            return chunk;
+        }
+
+        void finish(StageResult result) {
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            finished.push_back(std::move(result));
+        }
+
+        void startStage(ChunkKey key, Stage stage, GenerationState& state) {
+            state.running = true;
+            jobsInFlight++;
+            switch (stage) {
+            case TERRAIN:
+                workerPool().submit([key]() {
+                    finish({ key, TERRAIN, runTerrain(key), nullptr });
+                });
+                break;
+            case SURFACE: {
+                //the terrain snapshot rather than the latest stage, which may already hold the above chunk's trees
+                std::shared_ptr<const PerChunkState> above;
+                ChunkKey aboveKey = key + ivec3{ 0, 1, 0 };
+                if (!isEmptySky(aboveKey)) {
+                    above = states[aboveKey].terrain;
+                }
+                std::shared_ptr<const PerChunkState> terrain = state.terrain;
+                workerPool().submit([key, terrain, above]() {
+                    finish({ key, SURFACE, runSurface(key, *terrain, above.get()), nullptr });
+                });
+                break;
+            }
+            case DECORATION: {
+                std::shared_ptr<const PerChunkState> surfaced = state.blocks;
+                workerPool().submit([key, surfaced]() {
+                    auto spills = std::make_shared<Spills>();
+                    auto decorated = runDecoration(key, *surfaced, *spills);
+                    finish({ key, DECORATION, decorated, spills });
+                });
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        void finalize(ChunkKey key, GenerationState& state) {
+            state.stage = FINALIZED;
+            if (perChunkState.find(key) != perChunkState.end()) {
+                return; //loaded or created some other way while it was generating
+            }
+            PerChunkState chunk = *state.blocks;
+            static3DLoop<-1, -1, -1, 2, 2, 2>([&](ivec3 offset) {
+                auto neighbor = states.find(key + offset);
+                if (offset == ivec3{ 0, 0, 0 } || neighbor == states.end() || !neighbor->second.spills) {
+                    return; //sky neighbors never spill
+                }
+                for (auto& spill : (*neighbor->second.spills)[neighborSlot(-offset)]) {
+                    if (canReplace(chunk.blocks[spill.index], spill.block)) {
+                        chunk.blocks[spill.index] = spill.block;
+                    }
+                    stats.spilledBlocks++;
+                }
+            });
+            insertChunk(key, chunk.blocks.data());
+            chunkio::requestSave(key, chunk);
+            stats.chunksFinalized++;
+        }
+
+        //true once the chunk has reached the stage. otherwise pushes it one stage further when its
+        //prerequisites are met, or walks into the prerequisites that aren't.
+        bool require(ChunkKey key, Stage stage) {
+            if (isEmptySky(key)) {
+                return true;
+            }
+            GenerationState& state = states[key]; //references into the map survive the inserts below
+            state.lastNeeded = updateCount;
+            if (state.stage >= stage) {
+                return true;
+            }
+            if (state.running) {
+                return false;
+            }
+            Stage next = Stage(state.stage + 1);
+            if (next < stage) {
+                require(key, next);
+                return false;
+            }
+
+            bool neighborsReady = true;
+            ivec3 radius = STAGES[next].neighborRadius;
+            ivec3 offset;
+            for (offset.z = -radius.z; offset.z <= radius.z; offset.z++) {
+                for (offset.y = -radius.y; offset.y <= radius.y; offset.y++) {
+                    for (offset.x = -radius.x; offset.x <= radius.x; offset.x++) {
+                        if (offset != ivec3{ 0, 0, 0 }) {
+                            neighborsReady = require(key + offset, Stage(next - 1)) && neighborsReady;
+                        }
+                    }
+                }
+            }
+            if (!neighborsReady) {
+                return false;
+            }
+            if (next == FINALIZED) {
+                finalize(key, state);
+                return true;
+            }
+            if (state.lastQueued != updateCount) {
+                state.lastQueued = updateCount;
+                readyStages.push_back({ key, next, viewer::chunkPriority(key) });
+            }
+            return false;
+        }
+    }
+
+    bool isEmptySky(ChunkKey key) {
+        std::lock_guard<std::mutex> lock(skyMutex);
+        if (!claimedSky.empty() && claimedSky.find(key) != claimedSky.end()) {
+            return false;
+        }
+        ivec2 columnKey = { key.x, key.z };
+        auto iter = skyLevels.find(columnKey);
+        if (iter == skyLevels.end()) {
+            //trees rooted in a neighboring column can lean over into this one
+            int highestSurface = INT_MIN;
+            for (int dz = -1; dz <= 1; dz++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    highestSurface = std::max(highestSurface, heightmap::column(columnKey + ivec2{ dx, dz }).maxSurface);
+                }
+            }
+            int skyLevel = highestSurface + static_cast<int>(ceilf(density::OVERHANG_AMPLITUDE)) + MAX_DECORATION_HEIGHT;
+            iter = skyLevels.emplace(columnKey, skyLevel).first;
+        }
+        return key.y * BLOCKS_PER_SIDE >= iter->second;
+    }
+
+    void claimSky(ChunkKey key) {
+        std::lock_guard<std::mutex> lock(skyMutex);
+        claimedSky.insert(key);
+    }
+
+    bool hasClaimedSky(ChunkKey min, ChunkKey max) {
+        std::lock_guard<std::mutex> lock(skyMutex);
+        for (const ChunkKey& key : claimedSky) {
+            if (glm::all(glm::greaterThanEqual(key, min)) && glm::all(glm::lessThanEqual(key, max))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool request(ChunkKey key) {
+        if (perChunkState.find(key) != perChunkState.end() || isEmptySky(key)) {
+            return false;
+        }
+        return wantedChunks.insert(key).second;
+    }
+
+    bool isGenerating(ChunkKey key) {
+        return wantedChunks.find(key) != wantedChunks.end();
+    }
+
+    void update() {
+        updateCount++;
+        std::vector<StageResult> results;
+        {
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            results.swap(finished);
+        }
+        for (auto& result : results) {
+            GenerationState& state = states[result.key];
+            state.running = false;
+            state.stage = result.stage;
+            state.blocks = result.blocks;
+            if (result.stage == TERRAIN) {
+                state.terrain = result.blocks;
+            }
+            if (result.spills) {
+                state.spills = result.spills;
+            }
+            stats.stagesRun[result.stage]++;
+            jobsInFlight--;
+        }
+
+        readyStages.clear();
+        ChunkKey viewerChunk = connectivity::chunkContaining(viewerPosition);
+        glm::ivec3 keepDistance = glm::ivec3{ lod::reach() + GENERATION_DISTANCE_MARGIN };
+        std::vector<ChunkKey> pending(wantedChunks.begin(), wantedChunks.end());
+        for (auto key : pending) {
+            if (glm::any(glm::greaterThan(glm::abs(key - viewerChunk), keepDistance))) {
+                wantedChunks.erase(key); //requested again by chunkio if the viewer comes back
+                stats.requestsDropped++;
+                continue;
+            }
+            if (require(key, FINALIZED)) {
+                wantedChunks.erase(key);
+            }
+        }
+
+        //like meshing, only a bounded number of stages are queued so newly urgent chunks don't wait behind stale ones
+        size_t slots = MAX_GENERATION_JOBS_PER_WORKER * workerPool().size();
+        std::sort(readyStages.begin(), readyStages.end(), [](const ReadyStage& a, const ReadyStage& b) {
+            return a.priority < b.priority;
+        });
+        for (auto& ready : readyStages) {
+            if (jobsInFlight >= slots) {
+                break;
+            }
+            startStage(ready.key, ready.stage, states[ready.key]);
+        }
+
+        //every stage is deterministic, so results no pending chunk has needed in a while are rebuilt if ever needed again
+        if (updateCount % IDLE_UPDATES_BEFORE_DISCARD == 0) {
+            for (auto iter = states.begin(); iter != states.end();) {
+                if (!iter->second.running && updateCount - iter->second.lastNeeded > IDLE_UPDATES_BEFORE_DISCARD) {
+                    iter = states.erase(iter);
+                }
+                else {
+                    ++iter;
+                }
+            }
+        }
+    }
+
+    void printStats() {
+        printf("worldgen: %llu chunks finalized, stages run:",
+            static_cast<unsigned long long>(stats.chunksFinalized));
+        for (int stage = TERRAIN; stage < FINALIZED; stage++) {
+            printf(" %s %llu", STAGES[stage].name, static_cast<unsigned long long>(stats.stagesRun[stage]));
+        }
+        printf(", %llu blocks spilled across borders, %zu pending, %zu cached, %llu dropped\n",
+            static_cast<unsigned long long>(stats.spilledBlocks),
+            wantedChunks.size(),
+            states.size(),
+            static_cast<unsigned long long>(stats.requestsDropped));
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "chunk.h"
+
+//staged world generation. every chunk goes through
+//  TERRAIN     density::generateChunk, stone and air
+//  SURFACE     grass on top of near-surface stone with dirt under it
+//  DECORATION  ores and trees. blocks a tree puts outside its own chunk are queued for that neighbor
+//  FINALIZED   the neighbor queues have been applied and the chunk is in perChunkState
+//each stage declares how far around the chunk its prerequisites reach, and a stage only runs once the
+//chunk and every neighbor in that radius have finished the stage before it. stage outputs are immutable
+//snapshots, so stages of neighboring chunks run in parallel on the worker pool without locking. since a
+//chunk is only finalized once nothing can spill into it any more, it is meshed once, with its decorations.
+//all stages are deterministic, so a neighbor that was already saved is simply re-decorated to recover
+//what it spills, instead of the finished chunk being regenerated.
+namespace worldgen {
+    enum Stage : int { NOT_STARTED, TERRAIN, SURFACE, DECORATION, FINALIZED, STAGE_COUNT };
+
+    const int DIRT_DEPTH = 3;
+    const int MAX_DECORATION_HEIGHT = 8; //blocks above their root that decorations can reach
+    const int TREE_CHANCE_PER_MILLE = 12; //per grass block
+    const int ORE_VEINS_PER_CHUNK = 3;
+    const size_t MAX_GENERATION_JOBS_PER_WORKER = 2;
+    const int GENERATION_DISTANCE_MARGIN = 12; //chunks past lod::reach() a request is kept alive for
+    const uint64_t IDLE_UPDATES_BEFORE_DISCARD = 120; //intermediate stages no pending chunk needs are dropped after this
+
+    //true if neither terrain nor any decoration can reach into the chunk, so it is never generated or allocated,
+    //unless it has been claimed. safe to call from any thread.
+    bool isEmptySky(ChunkKey key);
+    //for a sky chunk an edit puts blocks in, which is loaded and saved like any other chunk from then on.
+    void claimSky(ChunkKey key);
+    //whether any chunk in the box, corners included, has been claimed.
+    bool hasClaimedSky(ChunkKey min, ChunkKey max);
+
+    //generates the chunk and inserts it into perChunkState. no-op if it is resident or already requested; returns
+    //whether it was requested now.
+    bool request(ChunkKey key);
+    bool isGenerating(ChunkKey key);
+
+    //called once per frame: collects finished stages, finalizes chunks and schedules the next stages.
+    void update();
+
+    void printStats();
+}